@@ -0,0 +1,1255 @@
+/*
+ * Throughput benchmark on generated Unity scene-like corpora.
+ *
+ * Every corpus is run through eight paths, each reported under its own name:
+ *
+ *   scan    the scanner alone (Scan)
+ *   parse   the parser (Parse)
+ *   sax     the parser calling a handler (ParseWith)
+ *   load    the composer (Load)
+ *   push    the parser fed in 64 KB pieces (Feed)
+ *   files   a file per document, each with a parser of its own
+ *   reset   a file per document, with one parser that is Reset for each
+ *   batch   a file per document, composed on a pool of threads (LoadBatch)
+ *
+ * For each path the benchmark reports MB/s, tokens, events or nodes per
+ * second, allocations per MB and the peak RSS of the process so far.  Build
+ * with MJ_BENCH_LIBYAML defined and link against libyaml to run the upstream
+ * parser on the same corpus as well.  --selftest checks the SIMD kernels of
+ * the reader instead of timing anything.
+ */
+
+#include "mj/yaml.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef MJ_BENCH_LIBYAML
+#include <yaml.h>
+#endif
+
+#define MEGABYTE (1024.0 * 1024.0)
+#define MAX_SIZES 16
+// The size of the pieces that the push path feeds the corpus in.
+#define PUSH_CHUNK_SIZE 65536
+// The number of random streams of each encoding that the self-test checks.
+#define SELFTEST_INPUTS 2000
+
+/*
+ * The relative weights of the kinds of properties the generator writes.
+ */
+struct Mix
+{
+  int flow     = 4; // Flow mappings: {fileID: 0}, {x: 0, y: 0, z: 0}.
+  int sequence = 3; // Block sequences of flow mappings and of scalars.
+  int hex      = 1; // Long hexadecimal blobs, as in mesh and texture data.
+  int string   = 2; // Long quoted strings with escapes and line folds.
+};
+
+struct Options
+{
+  Mix mix;
+  int nest                = 0;
+  unsigned seed           = 1;
+  size_t arena            = 0;
+  bool borrow             = false;
+  bool lazy               = false;
+  bool numeric            = false;
+  bool classify           = false;
+  bool selftest           = false;
+  int repeat              = 3;
+  unsigned threads        = 0;
+  const char* file        = nullptr;
+  const char* write       = nullptr;
+  double sizes[MAX_SIZES] = {};
+  int size_count          = 0;
+};
+
+// Allocation counting
+
+// Atomic, as the batch path allocates on many threads.
+static std::atomic<size_t> NumMalloc;
+static std::atomic<size_t> NumRealloc;
+static std::atomic<size_t> NumStrdup;
+
+static void* Malloc(size_t size)
+{
+  ++NumMalloc;
+  return malloc(size);
+}
+
+static void* Realloc(void* ptr, size_t size)
+{
+  ++NumRealloc;
+  return realloc(ptr, size);
+}
+
+static void Free(void* ptr)
+{
+  free(ptr);
+}
+
+static char* Strdup(const char* src)
+{
+  ++NumStrdup;
+#ifdef _WIN32
+  return _strdup(src);
+#else
+  return strdup(src);
+#endif
+}
+
+static size_t allocations()
+{
+  return NumMalloc + NumRealloc + NumStrdup;
+}
+
+/*
+ * The peak resident set size of the process, in bytes.
+ */
+static size_t peak_rss()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;
+#else
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Corpus generator
+
+/*
+ * A xorshift generator, so that a seed gives the same corpus everywhere.
+ */
+struct Random
+{
+  uint64_t state;
+
+  uint32_t Next()
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t)(state >> 32);
+  }
+
+  uint32_t Below(uint32_t n)
+  {
+    return Next() % n;
+  }
+};
+
+static void append(std::string& out, const char* format, ...)
+{
+  char line[512];
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  if (length > 0)
+  {
+    out.append(line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+  }
+}
+
+static void append_hex(std::string& out, Random& random, size_t count)
+{
+  static const char digits[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < count; i++)
+  {
+    out += digits[random.Below(16)];
+  }
+}
+
+/*
+ * Write a flow mapping 'nest' levels deep around a flow sequence, for the
+ * cost of the scanner's bookkeeping per level.
+ */
+static void write_nested(std::string& out, Random& random, int property, int nest)
+{
+  append(out, "  m_Nested%d: ", property);
+  for (int level = 0; level < nest; level++)
+  {
+    append(out, "{n%d: ", level);
+  }
+  out += '[';
+  for (uint32_t i = 0, count = 4 + random.Below(12); i < count; i++)
+  {
+    append(out, i ? ", %u" : "%u", random.Below(1000));
+  }
+  out += ']';
+  out.append((size_t)nest, '}');
+  out += '\n';
+}
+
+static void write_flow(std::string& out, Random& random, int property, int nest)
+{
+  if (nest)
+  {
+    write_nested(out, random, property, nest);
+    return;
+  }
+
+  switch (random.Below(3))
+  {
+  case 0:
+    append(out, "  m_Reference%d: {fileID: %u}\n", property, random.Next());
+    break;
+
+  case 1:
+    append(out, "  m_Asset%d: {fileID: %u, guid: ", property, random.Below(100000));
+    append_hex(out, random, 32);
+    append(out, ", type: %u}\n", random.Below(4));
+    break;
+
+  default:
+    append(out, "  m_LocalPosition%d: {x: %d.%u, y: %d.%u, z: %u}\n", property,
+           (int)random.Below(2000) - 1000, random.Below(1000), (int)random.Below(2000) - 1000,
+           random.Below(1000), random.Below(10));
+    break;
+  }
+}
+
+static void write_sequence(std::string& out, Random& random, int property)
+{
+  uint32_t count = 1 + random.Below(12);
+
+  if (random.Below(2))
+  {
+    append(out, "  m_Component%d:\n", property);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      append(out, "  - component: {fileID: %u}\n", random.Next());
+    }
+  }
+  else
+  {
+    append(out, "  m_Weights%d:\n", property);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      append(out, "    - %u.%u\n", random.Below(10), random.Below(100000));
+    }
+  }
+}
+
+static void write_hex(std::string& out, Random& random, int property)
+{
+  append(out, "  _typelessdata%d: ", property);
+  append_hex(out, random, 2 * (64 + random.Below(4096)));
+  out += '\n';
+}
+
+static void write_string(std::string& out, Random& random, int property)
+{
+  static const char* words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "\\u00E9t\\u00E9",
+                                "consectetur", "adipiscing", "\\\"elit\\\"", "sed", "do",
+                                "eiusmod", "tempor", "\\tincididunt", "ut", "labore"};
+  uint32_t lines = 1 + random.Below(6);
+
+  append(out, "  m_Text%d: \"", property);
+  for (uint32_t line = 0; line < lines; line++)
+  {
+    if (line)
+    {
+      // Unity wraps long strings, indenting the continuation lines.
+      out += random.Below(4) ? "\n    " : "\\n\n    ";
+    }
+    for (uint32_t word = 0, count = 4 + random.Below(12); word < count; word++)
+    {
+      if (word) out += ' ';
+      out += words[random.Below(sizeof(words) / sizeof(words[0]))];
+    }
+  }
+  out += "\"\n";
+}
+
+/*
+ * Write documents like the objects of a Unity scene until the corpus is at
+ * least 'size' bytes long.  The flow mappings are nested 'nest' levels deep if
+ * it is not 0.
+ */
+static void generate(std::string& out, size_t size, const Mix& mix, int nest, unsigned seed)
+{
+  static const struct
+  {
+    int id;
+    const char* name;
+  } classes[] = {{1, "GameObject"},  {4, "Transform"},   {23, "MeshRenderer"},
+                 {33, "MeshFilter"}, {43, "Mesh"},       {114, "MonoBehaviour"},
+                 {65, "BoxCollider"}, {222, "CanvasRenderer"}};
+
+  Random random = {0x9E3779B97F4A7C15ull ^ seed};
+  int total     = mix.flow + mix.sequence + mix.hex + mix.string;
+  uint32_t id   = 100;
+
+  out.clear();
+  out.reserve(size + 65536);
+  out += "%YAML 1.1\n%TAG !u! tag:unity3d.com,2011:\n";
+
+  if (total <= 0) return;
+
+  while (out.size() < size)
+  {
+    const auto& object = classes[random.Below(sizeof(classes) / sizeof(classes[0]))];
+
+    append(out, "--- !u!%d &%u\n%s:\n", object.id, id++, object.name);
+    append(out, "  m_ObjectHideFlags: 0\n  serializedVersion: %u\n", 1 + random.Below(10));
+
+    for (int property = 0, count = 2 + (int)random.Below(10); property < count; property++)
+    {
+      int pick = (int)random.Below((uint32_t)total);
+
+      if ((pick -= mix.flow) < 0) write_flow(out, random, property, nest);
+      else if ((pick -= mix.sequence) < 0) write_sequence(out, random, property);
+      else if ((pick -= mix.hex) < 0) write_hex(out, random, property);
+      else write_string(out, random, property);
+    }
+  }
+}
+
+// Benchmark paths
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Result
+{
+  double seconds   = 0.0;
+  size_t items     = 0;
+  size_t allocated = 0;
+  bool failed      = false;
+};
+
+static mj::YamlFns make_fns(const Options& options)
+{
+  mj::YamlFns Fns;
+  Fns.Malloc         = Malloc;
+  Fns.Realloc        = Realloc;
+  Fns.Free           = Free;
+  Fns.Strdup         = Strdup;
+  Fns.ArenaBlockSize = options.arena;
+  return Fns;
+}
+
+static bool run_scan(mj::YamlParser& p, size_t& tokens)
+{
+  mj::YamlToken token;
+  mj::EYamlTokenType type;
+
+  do
+  {
+    if (!p.Scan(token) || p.error != mj::EYamlError::None) return false;
+    tokens++;
+    type = token.type;
+    token.Delete(p);
+  } while (type != mj::EYamlTokenType::StreamEnd);
+
+  return true;
+}
+
+static bool run_parse(mj::YamlParser& p, size_t& events)
+{
+  mj::YamlEvent event;
+  mj::EYamlEventType type;
+
+  do
+  {
+    if (!p.Parse(event) || p.error != mj::EYamlError::None) return false;
+    events++;
+    type = event.type;
+    event.Delete(p);
+  } while (type != mj::EYamlEventType::StreamEnd);
+
+  return true;
+}
+
+struct EventCounter : mj::YamlHandler
+{
+  typedef mj::YamlMark Mark;
+  size_t events = 0;
+
+  void OnStreamStart(const mj::YamlEvent::stream_start_t&, const Mark&, const Mark&) { events++; }
+  void OnStreamEnd(const Mark&, const Mark&) { events++; }
+  void OnDocumentStart(const mj::YamlEvent::document_start_t&, const Mark&, const Mark&)
+  {
+    events++;
+  }
+  void OnDocumentEnd(const mj::YamlEvent::document_end_t&, const Mark&, const Mark&) { events++; }
+  void OnAlias(const mj::YamlEvent::alias_t&, const Mark&, const Mark&) { events++; }
+  void OnScalar(const mj::YamlEvent::scalar_t&, const Mark&, const Mark&) { events++; }
+  void OnSequenceStart(const mj::YamlEvent::sequence_start_t&, const Mark&, const Mark&)
+  {
+    events++;
+  }
+  void OnSequenceEnd(const Mark&, const Mark&) { events++; }
+  void OnMappingStart(const mj::YamlEvent::mapping_start_t&, const Mark&, const Mark&)
+  {
+    events++;
+  }
+  void OnMappingEnd(const Mark&, const Mark&) { events++; }
+};
+
+static bool run_sax(mj::YamlParser& p, size_t& events)
+{
+  EventCounter counter;
+  bool success = p.ParseWith(counter);
+
+  events += counter.events;
+  return success;
+}
+
+static bool run_load(mj::YamlParser& p, size_t& nodes)
+{
+  while (1)
+  {
+    mj::YamlDocument document;
+
+    if (!p.Load(document) || p.error != mj::EYamlError::None) return false;
+    if (!document.GetRootNode())
+    {
+      document.Delete(p);
+      return true;
+    }
+    nodes += document.nodes.top - document.nodes.start;
+    document.Delete(p);
+  }
+}
+
+/*
+ * Run a path 'repeat' times on a fresh parser and keep the fastest run.
+ */
+static Result measure(const Options& options, const std::string& corpus,
+                      bool (*run)(mj::YamlParser&, size_t&))
+{
+  Result best;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    Result result;
+    size_t allocated = allocations();
+    auto start       = std::chrono::steady_clock::now();
+    {
+      mj::YamlParser p(make_fns(options), (const unsigned char*)corpus.data(), corpus.size());
+      p.borrow_scalars  = options.borrow;
+      p.lazy_marks      = options.lazy;
+      p.numeric_anchors = options.numeric;
+      result.failed     = !run(p, result.items);
+      if (result.failed)
+      {
+        fprintf(stderr, "Failed to parse: %s\n", p.problem ? p.problem : "");
+      }
+    }
+    result.seconds   = seconds_since(start);
+    result.allocated = allocations() - allocated;
+
+    if (result.failed) return result;
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+
+  return best;
+}
+
+/*
+ * Feed the corpus in pieces, the way it would come in over a pipe, and drain
+ * the events after each piece.
+ */
+static bool run_push(mj::YamlParser& p, const std::string& corpus, size_t& events)
+{
+  mj::YamlEvent event;
+  mj::EYamlEventType type;
+  size_t fed    = 0;
+  bool finished = false;
+
+  do
+  {
+    if (!p.Parse(event) || p.error != mj::EYamlError::None) return false;
+    type = event.type;
+    event.Delete(p);
+
+    if (type != mj::EYamlEventType::None)
+    {
+      events++;
+      continue;
+    }
+    if (finished) return false;
+
+    size_t size = corpus.size() - fed;
+    if (size > PUSH_CHUNK_SIZE) size = PUSH_CHUNK_SIZE;
+    if (size)
+    {
+      if (!p.Feed((const unsigned char*)corpus.data() + fed, size)) return false;
+      fed += size;
+    }
+    else
+    {
+      if (!p.Finish()) return false;
+      finished = true;
+    }
+  } while (type != mj::EYamlEventType::StreamEnd);
+
+  return true;
+}
+
+static Result measure_push(const Options& options, const std::string& corpus)
+{
+  Result best;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    Result result;
+    size_t allocated = allocations();
+    auto start       = std::chrono::steady_clock::now();
+    {
+      mj::YamlParser p(make_fns(options));
+      result.failed = !run_push(p, corpus, result.items);
+      if (result.failed)
+      {
+        fprintf(stderr, "Failed to parse: %s\n", p.problem ? p.problem : "");
+      }
+    }
+    result.seconds   = seconds_since(start);
+    result.allocated = allocations() - allocated;
+
+    if (result.failed) return result;
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+
+  return best;
+}
+
+/*
+ * Split the corpus at its '---' lines into a file per document, each with the
+ * directives of the corpus in front, like the assets of a project. Returns
+ * the size of all files together.
+ */
+static size_t split_files(const std::string& corpus, std::vector<std::string>& files)
+{
+  size_t first = corpus.compare(0, 3, "---") ? corpus.find("\n---") : 0;
+  size_t size  = 0;
+
+  if (first == std::string::npos)
+  {
+    files.push_back(corpus);
+    return corpus.size();
+  }
+  if (first) first++;
+
+  std::string header = corpus.substr(0, first);
+  for (size_t start = first; start < corpus.size();)
+  {
+    size_t end = corpus.find("\n---", start + 1);
+    end        = end == std::string::npos ? corpus.size() : end + 1;
+    files.push_back(header + corpus.substr(start, end - start));
+    size += files.back().size();
+    start = end;
+  }
+
+  return size;
+}
+
+static bool parse_file(mj::YamlParser& p, const Options& options, size_t& events)
+{
+  p.borrow_scalars  = options.borrow;
+  p.lazy_marks      = options.lazy;
+  p.numeric_anchors = options.numeric;
+  if (run_parse(p, events)) return true;
+
+  fprintf(stderr, "Failed to parse: %s\n", p.problem ? p.problem : "");
+  return false;
+}
+
+/*
+ * Parse every file with a parser of its own, or with one parser that is Reset
+ * for each file.
+ */
+static Result measure_files(const Options& options, const std::vector<std::string>& files,
+                            bool reset)
+{
+  Result best;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    Result result;
+    size_t allocated = allocations();
+    auto start       = std::chrono::steady_clock::now();
+    {
+      mj::YamlParser shared(make_fns(options), (const unsigned char*)"", 0);
+
+      for (const std::string& file : files)
+      {
+        const unsigned char* input = (const unsigned char*)file.data();
+
+        if (reset)
+        {
+          result.failed =
+              !shared.Reset(input, file.size()) || !parse_file(shared, options, result.items);
+        }
+        else
+        {
+          mj::YamlParser p(make_fns(options), input, file.size());
+          result.failed = !parse_file(p, options, result.items);
+        }
+        if (result.failed) break;
+      }
+    }
+    result.seconds   = seconds_since(start);
+    result.allocated = allocations() - allocated;
+
+    if (result.failed) return result;
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+
+  return best;
+}
+
+struct BatchCount
+{
+  std::atomic<size_t> nodes{0};
+  std::atomic<bool> failed{false};
+};
+
+static void count_batch(void* data, const mj::YamlBatchResult& result)
+{
+  BatchCount& count = *(BatchCount*)data;
+
+  for (size_t k = 0; k < result.documents.count; k++)
+  {
+    const mj::YamlDocument& document = result.documents.start[k];
+    count.nodes += document.nodes.top - document.nodes.start;
+  }
+  if (result.error != mj::EYamlError::None)
+  {
+    fprintf(stderr, "Failed to load: %s\n", result.problem ? result.problem : "");
+    count.failed = true;
+  }
+}
+
+/*
+ * Compose every file with LoadBatch, on 'threads' threads.
+ */
+static Result measure_batch(const Options& options, const std::vector<std::string>& files)
+{
+  std::vector<mj::YamlBatchInput> inputs(files.size());
+  mj::YamlBatchOptions batch;
+  Result best;
+
+  for (size_t k = 0; k < files.size(); k++)
+  {
+    inputs[k].data = (const unsigned char*)files[k].data();
+    inputs[k].size = files[k].size();
+  }
+  batch.threads        = options.threads;
+  batch.borrow_scalars = options.borrow;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    Result result;
+    BatchCount count;
+    size_t allocated = allocations();
+    auto start       = std::chrono::steady_clock::now();
+
+    bool loaded = mj::YamlParser::LoadBatch(make_fns(options), inputs.data(), inputs.size(), batch,
+                                            count_batch, &count);
+    result.seconds   = seconds_since(start);
+    result.allocated = allocations() - allocated;
+    result.items     = count.nodes;
+    result.failed    = !loaded || count.failed;
+
+    if (result.failed) return result;
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+
+  return best;
+}
+
+/*
+ * Run the character predicates of the scanner on every octet of the corpus,
+ * to measure what they cost per octet.
+ */
+static size_t run_classify(const std::string& corpus)
+{
+  mj::YamlString string;
+  size_t count = 0;
+
+  // The predicates look ahead up to three octets.
+  if (corpus.size() < 4) return 0;
+
+  string.start = (uint8_t*)corpus.data();
+  string.end   = string.start + corpus.size() - 3;
+
+  for (string.pointer = string.start; string.pointer != string.end; string.pointer++)
+  {
+    count += string.IsBlankOrNulAt();
+    count += string.IsBreakOrNulAt();
+    count += string.IsSpaceOrNulAt();
+    count += string.IsBreakAt();
+    count += string.IsAlphaAt();
+    count += string.IsHexAt();
+  }
+
+  return count;
+}
+
+static void measure_classify(const Options& options, const std::string& corpus)
+{
+  double best  = 0.0;
+  size_t count = 0;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    auto start     = std::chrono::steady_clock::now();
+    count          = run_classify(corpus);
+    double seconds = seconds_since(start);
+
+    if (i == 0 || seconds < best) best = seconds;
+  }
+
+  printf("%-8s %10.1f %14.2f ns/octet (%zu matches)\n", "classify",
+         corpus.size() / MEGABYTE / best, best * 1e9 / corpus.size(), count);
+}
+
+#ifdef MJ_BENCH_LIBYAML
+static bool run_libyaml(const std::string& corpus, size_t& events)
+{
+  yaml_parser_t parser;
+  yaml_event_t event;
+  bool done = false;
+
+  if (!yaml_parser_initialize(&parser)) return false;
+  yaml_parser_set_input_string(&parser, (const unsigned char*)corpus.data(), corpus.size());
+
+  while (!done)
+  {
+    if (!yaml_parser_parse(&parser, &event))
+    {
+      yaml_parser_delete(&parser);
+      return false;
+    }
+    events++;
+    done = (event.type == YAML_STREAM_END_EVENT);
+    yaml_event_delete(&event);
+  }
+
+  yaml_parser_delete(&parser);
+  return true;
+}
+
+static Result measure_libyaml(const Options& options, const std::string& corpus)
+{
+  Result best;
+
+  for (int i = 0; i < options.repeat; i++)
+  {
+    Result result;
+    auto start     = std::chrono::steady_clock::now();
+    result.failed  = !run_libyaml(corpus, result.items);
+    result.seconds = seconds_since(start);
+
+    if (result.failed) return result;
+    if (i == 0 || result.seconds < best.seconds) best = result;
+  }
+
+  return best;
+}
+#endif
+
+static void report(const char* path, const char* unit, const Result& result, size_t size,
+                   bool counted)
+{
+  double megabytes = size / MEGABYTE;
+
+  if (result.failed)
+  {
+    printf("%-8s failed\n", path);
+    return;
+  }
+
+  printf("%-8s %10.1f %14.0f %-7s", path, megabytes / result.seconds, result.items / result.seconds,
+         unit);
+  if (counted)
+  {
+    printf(" %12.0f", result.allocated / megabytes);
+  }
+  else
+  {
+    printf(" %12s", "-");
+  }
+  printf(" %12.1f\n", peak_rss() / MEGABYTE);
+}
+
+static void benchmark(const Options& options, const std::string& corpus, const char* name)
+{
+  printf("%s: %.1f MB\n", name, corpus.size() / MEGABYTE);
+  printf("%-8s %10s %22s %12s %12s\n", "path", "MB/s", "items/s", "allocs/MB", "peak RSS MB");
+
+  report("scan", "tokens", measure(options, corpus, run_scan), corpus.size(), true);
+  report("parse", "events", measure(options, corpus, run_parse), corpus.size(), true);
+  report("sax", "events", measure(options, corpus, run_sax), corpus.size(), true);
+  report("load", "nodes", measure(options, corpus, run_load), corpus.size(), true);
+  report("push", "events", measure_push(options, corpus), corpus.size(), true);
+
+  std::vector<std::string> files;
+  size_t files_size = split_files(corpus, files);
+  report("files", "events", measure_files(options, files, false), files_size, true);
+  report("reset", "events", measure_files(options, files, true), files_size, true);
+  report("batch", "nodes", measure_batch(options, files), files_size, true);
+#ifdef MJ_BENCH_LIBYAML
+  report("libyaml", "events", measure_libyaml(options, corpus), corpus.size(), false);
+#endif
+  if (options.classify) measure_classify(options, corpus);
+  printf("\n");
+}
+
+// Self-test
+
+/*
+ * Write the UTF-16 code units of a random stream of double-quoted lines,
+ * mostly allowed characters and surrogate pairs, with long runs of ASCII now
+ * and then.  Every other stream has one unit that the reader must reject: a
+ * lone surrogate, a control character or #xFFFE.
+ */
+static void generate_units(std::vector<uint32_t>& units, Random& random)
+{
+  static const uint32_t invalid[] = {0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0x01,
+                                     0x7F,   0x80,   0x9F,   0xFFFE, 0xFFFF};
+
+  units.clear();
+  for (uint32_t line = 0, lines = 1 + random.Below(8); line < lines; line++)
+  {
+    units.push_back('-');
+    units.push_back(' ');
+    units.push_back('"');
+    for (uint32_t k = 0, count = random.Below(4) ? random.Below(40) : 100 + random.Below(200);
+         k < count; k++)
+    {
+      uint32_t kind = random.Below(100);
+
+      if (kind < 55)
+      {
+        uint32_t value = 0x20 + random.Below(0x5F);
+        units.push_back(value == '"' || value == '\\' ? 'x' : value);
+      }
+      else if (kind < 65)
+      {
+        units.push_back(0xA0 + random.Below(0x800 - 0xA0));
+      }
+      else if (kind < 75)
+      {
+        units.push_back(0x800 + random.Below(0xD800 - 0x800));
+      }
+      else if (kind < 80)
+      {
+        units.push_back(0xE000 + random.Below(0xFFFE - 0xE000));
+      }
+      else if (kind < 92)
+      {
+        uint32_t value = random.Below(0x100000);
+        units.push_back(0xD800 + (value >> 10));
+        units.push_back(0xDC00 + (value & 0x3FF));
+      }
+      else
+      {
+        units.push_back(random.Below(2) ? 0x85 : '\t');
+      }
+    }
+    units.push_back('"');
+    units.push_back('\n');
+  }
+
+  if (random.Below(2))
+  {
+    units[3 + random.Below((uint32_t)units.size() - 3)] =
+        invalid[random.Below(sizeof(invalid) / sizeof(invalid[0]))];
+  }
+}
+
+static void encode_utf16(const std::vector<uint32_t>& units, bool big_endian, std::string& out)
+{
+  out = big_endian ? "\xFE\xFF" : "\xFF\xFE";
+  for (uint32_t unit : units)
+  {
+    out += (char)(big_endian ? unit >> 8 : unit & 0xFF);
+    out += (char)(big_endian ? unit & 0xFF : unit >> 8);
+  }
+}
+
+/*
+ * Encode the units in UTF-8, surrogate pairs as the characters they stand
+ * for and lone surrogates as the three octets that the reader rejects.
+ */
+static void encode_utf8(const std::vector<uint32_t>& units, std::string& out)
+{
+  out.clear();
+  for (size_t k = 0; k < units.size(); k++)
+  {
+    uint32_t value = units[k];
+
+    if (value >= 0xD800 && value <= 0xDBFF && k + 1 < units.size() && units[k + 1] >= 0xDC00 &&
+        units[k + 1] <= 0xDFFF)
+    {
+      value = 0x10000 + ((value & 0x3FF) << 10) + (units[++k] & 0x3FF);
+    }
+
+    if (value <= 0x7F)
+    {
+      out += (char)value;
+    }
+    else if (value <= 0x7FF)
+    {
+      out += (char)(0xC0 + (value >> 6));
+      out += (char)(0x80 + (value & 0x3F));
+    }
+    else if (value <= 0xFFFF)
+    {
+      out += (char)(0xE0 + (value >> 12));
+      out += (char)(0x80 + ((value >> 6) & 0x3F));
+      out += (char)(0x80 + (value & 0x3F));
+    }
+    else
+    {
+      out += (char)(0xF0 + (value >> 18));
+      out += (char)(0x80 + ((value >> 12) & 0x3F));
+      out += (char)(0x80 + ((value >> 6) & 0x3F));
+      out += (char)(0x80 + (value & 0x3F));
+    }
+  }
+}
+
+/*
+ * An input that the read handler below hands over in pieces of random size,
+ * so that characters and surrogate pairs straddle the reads.
+ */
+struct Pieces
+{
+  const std::string* input;
+  size_t offset;
+  Random random;
+};
+
+static int read_pieces(mj::YamlParser& parser, unsigned char* buffer, size_t size,
+                       size_t* size_read)
+{
+  Pieces& pieces = *(Pieces*)parser.read_handler_data;
+  size_t piece   = 1 + pieces.random.Below(64);
+
+  if (piece > size) piece = size;
+  if (piece > pieces.input->size() - pieces.offset) piece = pieces.input->size() - pieces.offset;
+  memcpy(buffer, pieces.input->data() + pieces.offset, piece);
+  pieces.offset += piece;
+  *size_read = piece;
+
+  return 1;
+}
+
+/*
+ * Write down the events of a parse with their marks and scalars, and the
+ * error that ends it if there is one.
+ */
+static void describe_parse(mj::YamlParser& p, std::string& out)
+{
+  mj::YamlEvent event;
+  mj::EYamlEventType type;
+
+  out.clear();
+  do
+  {
+    if (!p.Parse(event))
+    {
+      append(out, "error %d: %s\n", (int)p.error, p.problem ? p.problem : "");
+      return;
+    }
+    append(out, "%d %zu:%zu:%zu-%zu:%zu:%zu", (int)event.type, event.start_mark.index,
+           event.start_mark.line, event.start_mark.column, event.end_mark.index,
+           event.end_mark.line, event.end_mark.column);
+    if (event.type == mj::EYamlEventType::Scalar)
+    {
+      const mj::YamlEvent::scalar_t& scalar = std::get<mj::YamlEvent::scalar_t>(event.data);
+      out += ' ';
+      out.append((const char*)scalar.value, scalar.length);
+    }
+    out += '\n';
+    type = event.type;
+    event.Delete(p);
+  } while (type != mj::EYamlEventType::StreamEnd);
+}
+
+/*
+ * Parse an input at every SIMD level up to the one of the machine, from
+ * memory and in pieces, and compare each parse with the one that decodes a
+ * character at a time from the same source.  The sources read ahead by
+ * different amounts, so they may stop at an error after different events.
+ * The parser that read in pieces is then Reset to the input in memory, and
+ * must parse it as a new parser does.  Returns the number of parses that
+ * differ.
+ */
+static int selftest_input(const Options& options, const std::string& input, const char* name,
+                          uint32_t number, uint32_t seed, mj::EYamlSimdLevel top)
+{
+  static const char* levels[] = {"decode", "scalar", "sse2", "avx2"};
+  std::string expected[2], actual, in_memory;
+  int failures = 0;
+
+  for (int level = 0; level <= (int)top; level++)
+  {
+    mj::yaml_set_simd_level((mj::EYamlSimdLevel)level);
+
+    for (int split = 0; split < 2; split++)
+    {
+      if (split)
+      {
+        Pieces pieces = {&input, 0, {seed}};
+        mj::YamlParser p(make_fns(options), read_pieces, &pieces, 16);
+        describe_parse(p, actual);
+
+        // Reset lets go of the raw buffer of a size of its own.
+        std::string reset;
+        if (p.Reset((const unsigned char*)input.data(), input.size())) describe_parse(p, reset);
+        if (reset != in_memory)
+        {
+          fprintf(stderr, "selftest: %s input %u differs at %s after Reset\n", name, number,
+                  levels[level]);
+          failures++;
+        }
+      }
+      else
+      {
+        mj::YamlParser p(make_fns(options), (const unsigned char*)input.data(), input.size());
+        describe_parse(p, in_memory);
+        actual = in_memory;
+      }
+
+      if (!level)
+      {
+        expected[split] = actual;
+      }
+      else if (actual != expected[split])
+      {
+        fprintf(stderr, "selftest: %s input %u differs at %s%s\n", name, number, levels[level],
+                split ? " in pieces" : "");
+        failures++;
+      }
+    }
+  }
+
+  return failures;
+}
+
+/*
+ * Check the bulk transcoding of the reader and the vector kernels against
+ * decoding one character at a time, on random streams in UTF-16LE, UTF-16BE
+ * and UTF-8.  Returns the exit status.
+ */
+static int selftest(const Options& options)
+{
+  mj::EYamlSimdLevel top = mj::yaml_get_simd_level();
+  Random random          = {0x9E3779B97F4A7C15ull ^ options.seed};
+  std::vector<uint32_t> units;
+  std::string input;
+  int failures = 0;
+
+  for (uint32_t i = 0; i < SELFTEST_INPUTS; i++)
+  {
+    uint32_t seed = random.Next() | 1;
+
+    generate_units(units, random);
+    for (int big_endian = 0; big_endian < 2; big_endian++)
+    {
+      encode_utf16(units, big_endian, input);
+      // An odd octet at the end is an incomplete character.
+      if (!random.Below(8)) input += '\n';
+      failures += selftest_input(options, input, big_endian ? "UTF-16BE" : "UTF-16LE", i, seed,
+                                 top);
+    }
+    encode_utf8(units, input);
+    failures += selftest_input(options, input, "UTF-8", i, seed, top);
+  }
+  mj::yaml_set_simd_level(top);
+
+  printf("selftest: %d inputs per encoding, %d failures\n", SELFTEST_INPUTS, failures);
+  return failures ? 1 : 0;
+}
+
+static bool read_file(const char* path, std::string& out)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  out.resize(size > 0 ? (size_t)size : 0);
+  bool success = out.empty() || fread(&out[0], 1, out.size(), f) == out.size();
+  fclose(f);
+
+  return success;
+}
+
+static void usage()
+{
+  fprintf(stderr,
+          "usage: mj-yaml-bench [options] [megabytes...]\n"
+          "  --flow N, --sequence N, --hex N, --string N\n"
+          "                   relative weights of the generated properties (4, 3, 1, 2)\n"
+          "  --nest N         nest the flow mappings N levels deep (0)\n"
+          "  --seed N         seed of the generator (1)\n"
+          "  --arena BYTES    parse with an arena of blocks of this size\n"
+          "  --borrow         borrow scalars from the input\n"
+          "  --lazy           leave the lines and columns out of the marks\n"
+          "  --numeric        take decimal anchors as numbers instead of copying them\n"
+          "  --classify       also time the character predicates of the scanner\n"
+          "  --selftest       check the SIMD kernels of the reader against decoding a\n"
+          "                   character at a time on random input, instead\n"
+          "  --repeat N       runs per path, the fastest is reported (3)\n"
+          "  --threads N      threads of the batch path, 0 for one per core (0)\n"
+          "  --file PATH      benchmark a file instead of a generated corpus\n"
+          "  --write PATH     write the corpus of the first size to a file instead\n"
+          "The corpora are 1, 16 and 128 MB by default. The peak RSS is that of the\n"
+          "whole process, so run one size at a time to compare it.\n");
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char* arg   = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (!strcmp(arg, "--borrow"))
+    {
+      options.borrow = true;
+      continue;
+    }
+    if (!strcmp(arg, "--lazy"))
+    {
+      options.lazy = true;
+      continue;
+    }
+    if (!strcmp(arg, "--numeric"))
+    {
+      options.numeric = true;
+      continue;
+    }
+    if (!strcmp(arg, "--classify"))
+    {
+      options.classify = true;
+      continue;
+    }
+    if (!strcmp(arg, "--selftest"))
+    {
+      options.selftest = true;
+      continue;
+    }
+    if (arg[0] != '-')
+    {
+      if (options.size_count == MAX_SIZES) return false;
+      options.sizes[options.size_count++] = atof(arg);
+      continue;
+    }
+    if (!value) return false;
+    i++;
+
+    if (!strcmp(arg, "--flow")) options.mix.flow = atoi(value);
+    else if (!strcmp(arg, "--sequence")) options.mix.sequence = atoi(value);
+    else if (!strcmp(arg, "--hex")) options.mix.hex = atoi(value);
+    else if (!strcmp(arg, "--string")) options.mix.string = atoi(value);
+    else if (!strcmp(arg, "--nest")) options.nest = atoi(value);
+    else if (!strcmp(arg, "--seed")) options.seed = (unsigned)strtoul(value, nullptr, 10);
+    else if (!strcmp(arg, "--arena")) options.arena = (size_t)strtoull(value, nullptr, 10);
+    else if (!strcmp(arg, "--repeat")) options.repeat = atoi(value);
+    else if (!strcmp(arg, "--threads")) options.threads = (unsigned)strtoul(value, nullptr, 10);
+    else if (!strcmp(arg, "--file")) options.file = value;
+    else if (!strcmp(arg, "--write")) options.write = value;
+    else return false;
+  }
+
+  if (options.repeat < 1) options.repeat = 1;
+  if (options.size_count == 0)
+  {
+    options.sizes[0]   = 1;
+    options.sizes[1]   = 16;
+    options.sizes[2]   = 128;
+    options.size_count = 3;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  std::string corpus;
+  char name[128];
+
+  if (!parse_options(argc, argv, options))
+  {
+    usage();
+    return 1;
+  }
+
+  if (options.selftest) return selftest(options);
+
+  if (options.file)
+  {
+    if (!read_file(options.file, corpus))
+    {
+      fprintf(stderr, "Failed to read %s\n", options.file);
+      return 1;
+    }
+    benchmark(options, corpus, options.file);
+    return 0;
+  }
+
+  for (int i = 0; i < options.size_count; i++)
+  {
+    generate(corpus, (size_t)(options.sizes[i] * MEGABYTE), options.mix, options.nest,
+             options.seed);
+
+    if (options.write)
+    {
+      FILE* f = fopen(options.write, "wb");
+      if (!f || fwrite(corpus.data(), 1, corpus.size(), f) != corpus.size())
+      {
+        fprintf(stderr, "Failed to write %s\n", options.write);
+        if (f) fclose(f);
+        return 1;
+      }
+      fclose(f);
+      return 0;
+    }
+
+    snprintf(name, sizeof(name),
+             "corpus (flow %d, sequence %d, hex %d, string %d, nest %d, seed %u)",
+             options.mix.flow, options.mix.sequence, options.mix.hex, options.mix.string,
+             options.nest, options.seed);
+    benchmark(options, corpus, name);
+  }
+
+  return 0;
+}
@@ -1,8 +1,10 @@
 #ifndef MJ_YAML_H
 #define MJ_YAML_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <variant>
 
 namespace mj
@@ -68,6 +70,12 @@ struct YamlTagDirective
   uint8_t* prefix = nullptr;
 };
 
+// The IDs of the tags that the composer gives to nodes without a specific
+// tag. Every parser interns them first, so they are the same everywhere.
+#define YAML_STR_TAG_ID 1
+#define YAML_SEQ_TAG_ID 2
+#define YAML_MAP_TAG_ID 3
+
 enum class EYamlError
 {
   None,
@@ -116,11 +124,22 @@ struct YamlEvent
     bool implicit = false;
   };
 
+  // An anchor that the parser took as a number, as YamlParser::numeric_anchors
+  // has it, is in 'anchor_number' with 'numeric_anchor' set, and 'anchor' is
+  // null.
+
   struct alias_t
   {
-    uint8_t* anchor = nullptr;
+    uint8_t* anchor        = nullptr;
+    bool numeric_anchor    = false;
+    uint64_t anchor_number = 0;
   };
 
+  // The tags of events are interned in the parser, with the prefix of their
+  // handle in front. They are not freed with the event and stay valid as long
+  // as the parser. 'tag_id' tells them apart without comparing them, and is 0
+  // for no tag.
+
   struct scalar_t
   {
     uint8_t* anchor        = nullptr;
@@ -130,6 +149,12 @@ struct YamlEvent
     bool plain_implicit    = false;
     bool quoted_implicit   = false;
     EYamlScalarStyle style = EYamlScalarStyle::Any;
+    // The value points into the input and is not NUL-terminated. It is not
+    // freed with the event and stays valid as long as the input does.
+    bool borrowed          = false;
+    int tag_id             = 0;
+    bool numeric_anchor    = false;
+    uint64_t anchor_number = 0;
   };
 
   struct sequence_start_t
@@ -138,6 +163,9 @@ struct YamlEvent
     uint8_t* tag             = nullptr;
     int implicit             = 0;
     EYamlSequenceStyle style = EYamlSequenceStyle::Any;
+    int tag_id               = 0;
+    bool numeric_anchor      = false;
+    uint64_t anchor_number   = 0;
   };
 
   struct mapping_start_t
@@ -146,11 +174,14 @@ struct YamlEvent
     uint8_t* tag            = nullptr;
     int implicit            = 0;
     EYamlMappingStyle style = EYamlMappingStyle::Any;
+    int tag_id              = 0;
+    bool numeric_anchor     = false;
+    uint64_t anchor_number  = 0;
   };
 
   std::variant<stream_start_t, document_start_t, document_end_t, alias_t, scalar_t,
                sequence_start_t, mapping_start_t>
-      data;
+      data = stream_start_t();
 
   YamlMark start_mark;
   YamlMark end_mark;
@@ -168,13 +199,15 @@ public:
   void InitAlias(uint8_t* anchor, const YamlMark& start_mark, const YamlMark& end_mark);
   void InitScalar(uint8_t* anchor, uint8_t* tag, uint8_t* value, size_t length, bool plain_implicit,
                   bool quoted_implicit, EYamlScalarStyle style, const YamlMark& start_mark,
-                  const YamlMark& end_mark);
+                  const YamlMark& end_mark, bool borrowed = false, int tag_id = 0);
   void InitSequenceStart(uint8_t* anchor, uint8_t* tag, bool implicit, EYamlSequenceStyle style,
-                         const YamlMark& start_mark, const YamlMark& end_mark);
+                         const YamlMark& start_mark, const YamlMark& end_mark, int tag_id = 0);
   void InitSequenceEnd(const YamlMark& start_mark, const YamlMark& end_mark);
   void InitMappingStart(uint8_t* anchor, uint8_t* tag, bool implicit, EYamlMappingStyle style,
-                        const YamlMark& start_mark, const YamlMark& end_mark);
+                        const YamlMark& start_mark, const YamlMark& end_mark, int tag_id = 0);
   void InitMappingEnd(const YamlMark& start_mark, const YamlMark& end_mark);
+  // Gives an alias or a node event the anchor that was taken as a number.
+  void SetAnchorNumber(uint64_t number);
 
   void Delete(YamlParser& parser);
 }; // YamlEvent
@@ -212,14 +245,19 @@ struct YamlToken
     EYamlEncoding encoding = EYamlEncoding::Any;
   };
 
+  // The value of an alias or an anchor is null if the scanner took it as
+  // 'number'.
+
   struct alias_t
   {
-    uint8_t* value = nullptr;
+    uint8_t* value  = nullptr;
+    uint64_t number = 0;
   };
 
   struct anchor_t
   {
-    uint8_t* value = nullptr;
+    uint8_t* value  = nullptr;
+    uint64_t number = 0;
   };
 
   struct tag_t
@@ -233,6 +271,7 @@ struct YamlToken
     uint8_t* value         = nullptr;
     size_t length          = 0;
     EYamlScalarStyle style = EYamlScalarStyle::Any;
+    bool borrowed          = false;
   };
 
   struct version_directive_t
@@ -251,7 +290,7 @@ struct YamlToken
 
   std::variant<stream_start_t, alias_t, anchor_t, tag_t, scalar_t, version_directive_t,
                tag_directive_t>
-      data;
+      data = stream_start_t();
 
   YamlMark start_mark;
   YamlMark end_mark;
@@ -262,14 +301,14 @@ struct YamlToken
                                    const YamlMark& end_mark);
   static YamlToken InitStreamEnd(const YamlMark& start_mark, const YamlMark& end_mark);
   static YamlToken InitAlias(uint8_t* token_value, const YamlMark& start_mark,
-                             const YamlMark& end_mark);
+                             const YamlMark& end_mark, uint64_t token_number = 0);
   static YamlToken InitAnchor(uint8_t* token_value, const YamlMark& start_mark,
-                              const YamlMark& end_mark);
+                              const YamlMark& end_mark, uint64_t token_number = 0);
   static YamlToken InitTag(uint8_t* token_handle, uint8_t* token_suffix, const YamlMark& start_mark,
                            const YamlMark& end_mark);
   static YamlToken InitScalar(uint8_t* token_value, size_t token_length,
                               EYamlScalarStyle token_style, const YamlMark& start_mark,
-                              const YamlMark& end_mark);
+                              const YamlMark& end_mark, bool token_borrowed = false);
   static YamlToken InitVersionDirective(int token_major, int token_minor,
                                         const YamlMark& start_mark, const YamlMark& end_mark);
   static YamlToken InitTagDirective(uint8_t* token_handle, uint8_t* token_prefix,
@@ -310,38 +349,55 @@ struct YamlStack
 
 struct YamlNode
 {
-  EYamlNodeType type;
+  EYamlNodeType type = EYamlNodeType::None;
 
-  uint8_t* tag;
+  // Interned in the parser, as the tags of events. Nodes without a specific
+  // tag get the default one of their kind: YAML_STR_TAG_ID and so on.
+  uint8_t* tag = nullptr;
+  int tag_id   = 0;
 
   struct scalar_t
   {
     uint8_t* value         = nullptr;
     size_t length          = 0;
     EYamlScalarStyle style = EYamlScalarStyle::Any;
+    bool borrowed          = false;
   };
 
+  // The items of a sequence are 'count' node indices from 'start' in the
+  // document's items.
   struct sequence_t
   {
-    YamlStack<YamlNode> items;
+    size_t start             = 0;
+    size_t count             = 0;
     EYamlSequenceStyle style = EYamlSequenceStyle::Any;
   };
 
+  // The pairs of a mapping are 'count' entries from 'start' in the document's
+  // pairs.
   struct mapping_t
   {
-    YamlStack<YamlNodePair> pairs;
+    size_t start            = 0;
+    size_t count            = 0;
     EYamlMappingStyle style = EYamlMappingStyle::Any;
   };
 
-  std::variant<scalar_t, sequence_t, mapping_t> data;
+  std::variant<scalar_t, sequence_t, mapping_t> data = scalar_t();
 
   YamlMark start_mark;
   YamlMark end_mark;
 };
 
+/*
+ * A document composed by YamlParser::Load.  Nodes are numbered from 1, in the
+ * order they appear, and the root node is node 1.  The children of every
+ * collection are stored next to each other.
+ */
 struct YamlDocument
 {
   YamlStack<YamlNode> nodes;
+  YamlStack<int> items;
+  YamlStack<YamlNodePair> pairs;
 
   YamlVersionDirective* version_directive = nullptr;
 
@@ -356,16 +412,177 @@ struct YamlDocument
 
   YamlMark start_mark;
   YamlMark end_mark;
+
+  YamlNode* GetNode(int index);
+  YamlNode* GetRootNode();
+  int* GetItems(const YamlNode& node);
+  YamlNodePair* GetPairs(const YamlNode& node);
+
+  void Delete(YamlParser& parser);
+};
+
+/*
+ * The documents of a stream in order, as composed by YamlParser::LoadAll.
+ */
+struct YamlDocumentList
+{
+  YamlDocument* start = nullptr;
+  size_t count        = 0;
+
+  void Delete(YamlParser& parser);
+};
+
+/*
+ * An input of YamlParser::LoadBatch: the file at 'path', or else 'size'
+ * octets at 'data'.
+ */
+struct YamlBatchInput
+{
+  const char* path          = nullptr;
+  const unsigned char* data = nullptr;
+  size_t size               = 0;
+};
+
+struct YamlBatchOptions
+{
+  // The number of threads, the calling one included (0 for one per core).
+  unsigned threads = 0;
+  // Hand the results over in the order of the inputs instead of as they are
+  // done. Results that are done early are held until their turn.
+  bool ordered = false;
+  // Borrow scalars from the inputs in memory, as YamlParser::borrow_scalars.
+  bool borrow_scalars = false;
+};
+
+/*
+ * The documents of an input of YamlParser::LoadBatch, as composed up to the
+ * error if there was one.  They are deleted when the handler returns.  Each
+ * thread interns tags on its own, so tag IDs past the default ones only tell
+ * tags apart within a result.
+ */
+struct YamlBatchResult
+{
+  size_t index = 0;
+  YamlDocumentList documents;
+
+  EYamlError error      = EYamlError::None;
+  const char* problem   = nullptr;
+  const char* context   = nullptr;
+  size_t problem_offset = 0;
+  int problem_value     = 0;
+  YamlMark problem_mark;
+  YamlMark context_mark;
+};
+
+/*
+ * Takes the result of an input of YamlParser::LoadBatch, along with the data
+ * that was passed to it.  Unless the batch is ordered, the handler is called
+ * from several threads at once.
+ */
+typedef void yaml_batch_handler_t(void* data, const YamlBatchResult& result);
+
+/*
+ * Where a document starts, as found by YamlParser::BuildIndex.  The tag and
+ * the anchor are the ones written after its '---', as views into the input.
+ */
+struct YamlDocumentEntry
+{
+  size_t offset = 0;
+  YamlMark mark;
+  // The tag directives of the index in effect before the document, from the
+  // first: those before the first document and those of the documents before
+  // it.
+  size_t tag_directive_count = 0;
+
+  const uint8_t* tag    = nullptr;
+  size_t tag_length     = 0;
+  const uint8_t* anchor = nullptr;
+  size_t anchor_length  = 0;
+};
+
+/*
+ * The documents of a stream, and the tag directives in effect at them in the
+ * order they are written.
+ */
+struct YamlDocumentIndex
+{
+  YamlStack<YamlDocumentEntry> entries;
+  YamlStack<YamlTagDirective> tag_directives;
+
+  YamlDocumentEntry* Find(const uint8_t* anchor, size_t length);
+  void Delete(YamlParser& parser);
+};
+
+/*
+ * The events of YamlParser::ParseWith, each with its data and its marks.  A
+ * handler derives from this and hides the members for the events it takes;
+ * the others do nothing.  The calls are resolved at compile time, so they can
+ * be inlined into the parser.
+ */
+struct YamlHandler
+{
+  void OnStreamStart(const YamlEvent::stream_start_t&, const YamlMark&, const YamlMark&) {}
+  void OnStreamEnd(const YamlMark&, const YamlMark&) {}
+  void OnDocumentStart(const YamlEvent::document_start_t&, const YamlMark&, const YamlMark&) {}
+  void OnDocumentEnd(const YamlEvent::document_end_t&, const YamlMark&, const YamlMark&) {}
+  void OnAlias(const YamlEvent::alias_t&, const YamlMark&, const YamlMark&) {}
+  void OnScalar(const YamlEvent::scalar_t&, const YamlMark&, const YamlMark&) {}
+  void OnSequenceStart(const YamlEvent::sequence_start_t&, const YamlMark&, const YamlMark&) {}
+  void OnSequenceEnd(const YamlMark&, const YamlMark&) {}
+  void OnMappingStart(const YamlEvent::mapping_start_t&, const YamlMark&, const YamlMark&) {}
+  void OnMappingEnd(const YamlMark&, const YamlMark&) {}
 };
 
+struct YamlLoadChunk;
+struct YamlAsyncReader;
+struct YamlBatchRun;
+
+/*
+ * Reads up to 'size' octets of input into 'buffer' and stores how many were
+ * read in 'size_read', 0 at the end of the input. Returns 0 on an error. The
+ * handler finds its source in the parser's 'read_handler_data'.
+ */
 typedef int yaml_read_handler_t(YamlParser& parser, unsigned char* buffer, size_t size,
                                 size_t* size_read);
 
+// Reads from a file descriptor, cast to the handler data with intptr_t.
+int yaml_fd_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                         size_t* size_read);
+// Reads from a FILE*, which is the handler data.
+int yaml_file_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                           size_t* size_read);
+
+/*
+ * The widest instruction set that the kernels of the reader and the scanner
+ * use.  At Decode the reader also decodes every character on its own, without
+ * taking runs of them in bulk.
+ */
+enum class EYamlSimdLevel
+{
+  Decode,
+  Scalar,
+  Sse2,
+  Avx2,
+};
+
+// The level in use: the widest the machine supports, unless it was capped.
+EYamlSimdLevel yaml_get_simd_level();
+// Caps the level for the whole process, to check the kernels against each
+// other. Call it while no parser runs.
+void yaml_set_simd_level(EYamlSimdLevel level);
+
 struct YamlSimpleKey
 {
-  bool possible       = false;
-  bool required       = false;
+  bool possible = false;
+  bool required = false;
+  // The position in the token queue of the slot kept for the KEY token, which
+  // a slot for BLOCK-MAPPING-START comes before if the key would open a block
+  // mapping.
   size_t token_number = 0;
+  // Where the key starts for the scanner's own checks, in case the mark is
+  // lazy.
+  size_t index  = 0;
+  size_t column = 0;
   YamlMark mark;
 };
 
@@ -402,10 +619,15 @@ struct YamlString
   uint8_t* start   = nullptr;
   uint8_t* end     = nullptr;
   uint8_t* pointer = nullptr;
+  bool is_value    = false; // Allocated with YamlParser::ValueMalloc.
 
   bool Init(YamlParser& parser, size_t size);
+  bool InitValue(YamlParser& parser, size_t size);
   bool CheckAt(char octet, size_t offset = 0);
   bool IsAlphaAt(size_t offset = 0);
+  bool IsUriAt(size_t offset = 0);
+  bool IsFlowIndicatorAt(size_t offset = 0);
+  bool IsIndicatorAt(size_t offset = 0);
   bool IsDigitAt(size_t offset = 0);
   uint8_t AsDigitAt(size_t offset = 0);
   bool IsHexAt(size_t offset = 0);
@@ -434,6 +656,20 @@ struct YamlString
   void Del(YamlParser& parser);
 };
 
+/*
+ * The strings the scalar scanners fold a scalar in.  The parser keeps them,
+ * grown, from one scalar to the next, and copies out only the final value.
+ */
+struct YamlScalarScratch
+{
+  YamlString string;
+  YamlString leading_break;
+  YamlString trailing_breaks;
+  YamlString whitespaces;
+
+  void Del(YamlParser& parser);
+};
+
 struct YamlBuffer : public YamlString
 {
   uint8_t* last = nullptr;
@@ -447,41 +683,168 @@ struct YamlRawBuffer : public YamlBuffer
   // unsigned char* last    = nullptr;
 };
 
+/*
+ * Input that is fed to the parser in pieces.  The pieces are gathered in a
+ * block that 'input' points into, and the octets the reader has taken are
+ * dropped from its front.  Offsets are from the start of the stream.
+ */
+struct YamlPushInput
+{
+  size_t capacity = 0;
+  // Offset of 'input.start'.
+  size_t offset = 0;
+  // Offset of the first line that has not been checked for a document
+  // indicator yet.
+  size_t line = 0;
+  // One past the offset of the last complete line that starts with a document
+  // indicator. The scanner does not start a token past it.
+  size_t limit  = 0;
+  bool finished = false;
+};
+
 struct YamlAlias
 {
+  // Null for an anchor that was taken as 'number'.
   uint8_t* anchor = nullptr;
+  uint64_t number = 0;
   int index       = 0;
   YamlMark mark;
 };
 
+/*
+ * The anchors of the document being composed, in an open-addressing hash
+ * table.  A slot is free if its index is 0.
+ */
+struct YamlAliasMap
+{
+  YamlAlias* start = nullptr;
+  size_t capacity  = 0;
+  size_t count     = 0;
+
+  YamlAlias* Find(const uint8_t* anchor, uint64_t number);
+  bool Insert(YamlParser& parser, const YamlAlias& alias);
+  bool Grow(YamlParser& parser);
+  void Clear(YamlParser& parser);
+  void Del(YamlParser& parser);
+};
+
+struct YamlTag
+{
+  uint8_t* name = nullptr;
+  size_t length = 0;
+  int id        = 0;
+};
+
+/*
+ * The tags that a parser has resolved, each built once, in an open-addressing
+ * hash table.  A slot is free if its name is null.  The IDs count from 1 in
+ * the order the tags were first seen, after the default tags.
+ */
+struct YamlTagTable
+{
+  YamlTag* start  = nullptr;
+  size_t capacity = 0;
+  // The names by ID, from 1.
+  YamlStack<uint8_t*> names;
+
+  bool Init(YamlParser& parser);
+  const YamlTag* Intern(YamlParser& parser, const uint8_t* prefix, size_t prefix_length,
+                        const uint8_t* suffix, size_t suffix_length);
+  YamlTag* Insert(YamlParser& parser, const YamlTag& tag);
+  bool Grow(YamlParser& parser);
+  void Del(YamlParser& parser);
+};
+
+/*
+ * A collection that the composer has started but not finished.  Its children
+ * so far are on the composer's stack of children from 'children' up.
+ */
+struct YamlComposerFrame
+{
+  int node        = 0;
+  size_t children = 0;
+};
+
 typedef void* (*YamlMallocFn)(size_t size);
 typedef void* (*YamlReallocFn)(void* ptr, size_t size);
 typedef void (*YamlFreeFn)(void* ptr);
 typedef char* (*YamlStrdupFn)(const char* src);
 
+/*
+ * A ring buffer with a capacity that is a power of two.  'head' and 'tail'
+ * count the items dequeued and enqueued so far: an item keeps its position
+ * until it is dequeued, even when the buffer grows, and nothing is ever moved
+ * within the buffer.
+ */
 template <typename T>
 struct YamlQueue
 {
-  T* start = nullptr;
-  T* end   = nullptr;
-  T* head  = nullptr;
-  T* tail  = nullptr;
+  T* start        = nullptr;
+  size_t capacity = 0;
+  size_t head     = 0;
+  size_t tail     = 0;
 
   bool Init(YamlParser& parser, size_t size);
   void Del(YamlParser& parser);
   bool Empty();
+  T& At(size_t position);
   bool Enqueue(YamlParser& parser, T value);
+  // Adds 'count' items that are left as they are, to be set with At.
+  bool Reserve(YamlParser& parser, size_t count);
   T Dequeue();
-  bool Insert(YamlParser& parser, size_t index, T value);
   bool Extend(YamlParser& parser);
 };
 
+struct YamlArenaBlock
+{
+  YamlArenaBlock* next = nullptr;
+  size_t size          = 0;
+  size_t used          = 0;
+};
+
+struct YamlArenaMark
+{
+  YamlArenaBlock* block = nullptr;
+  size_t serial         = 0;
+};
+
+/*
+ * A bump allocator over a list of blocks, oldest first.  Blocks are released
+ * in bulk up to a mark and kept for reuse.
+ */
+struct YamlArena
+{
+  YamlArenaBlock* head  = nullptr;
+  YamlArenaBlock* tail  = nullptr;
+  YamlArenaBlock* spare = nullptr;
+  uint8_t* last         = nullptr; // The last allocation, which can grow in place.
+  size_t serial         = 0;       // The number of allocations so far.
+  size_t block_size     = 0;
+
+  void* Malloc(YamlParser& parser, size_t size);
+  void* Realloc(YamlParser& parser, void* ptr, size_t old_size, size_t new_size);
+  YamlArenaMark Mark();
+  void Release(YamlParser& parser, const YamlArenaMark& mark);
+  void Recycle(YamlParser& parser, YamlArenaBlock* block);
+  void Del(YamlParser& parser);
+};
+
+/*
+ * The allocation functions of a parser.  LoadAll and LoadBatch call them from
+ * several threads at once, so they must be thread-safe there.
+ */
 struct YamlFns
 {
   YamlMallocFn Malloc   = nullptr;
   YamlReallocFn Realloc = nullptr;
   YamlFreeFn Free       = nullptr;
   YamlStrdupFn Strdup   = nullptr;
+
+  // If non-zero, the values of tokens and events (scalars, anchors, tags and
+  // directives) are carved out of blocks of this many bytes. They are not
+  // freed by YamlEvent::Delete, but all at once: the values of a document stay
+  // valid until the parser returns the next DOCUMENT-START or STREAM-END event.
+  size_t ArenaBlockSize = 0;
 };
 
 struct YamlParser
@@ -491,14 +854,105 @@ struct YamlParser
   YamlFreeFn Free       = nullptr;
   YamlStrdupFn Strdup   = nullptr;
 
+  // Reads the input where it lies, so it must outlive the parser.
   YamlParser(const YamlFns& Fns, const unsigned char* input, size_t size);
+  // Memory-maps the file at 'path'. UTF-8 input is scanned straight from the
+  // mapping and validated as the scanner asks for characters rather than a
+  // raw buffer at a time, so an invalid octet is reported later than with the
+  // other constructors. A syntax error before it is then reported first, as a
+  // scanner or parser error instead of a reader error. Check 'error' after
+  // construction: it is set if the file could not be opened or mapped.
+  YamlParser(const YamlFns& Fns, const char* path);
+  // Takes the input in pieces from Feed, for input that arrives over time.
+  // Parse and Scan return an event or a token of type None when they need more
+  // input; everything up to the last '---' or '...' line fed so far is parsed,
+  // and the rest once Finish is called. UTF-16 is only parsed after Finish.
+  explicit YamlParser(const YamlFns& Fns);
+  // Reads the input through 'handler', for input that is too large to map or
+  // that comes from a pipe. The reader keeps up to 'raw_buffer_size' octets of
+  // raw input (16 KB for 0) and three times that decoded, however long the
+  // input is. A raw buffer of less than 4 octets sets 'error'.
+  YamlParser(const YamlFns& Fns, yaml_read_handler_t* handler, void* data,
+             size_t raw_buffer_size = 0);
   ~YamlParser();
 
+  // Starts over on new input in memory, as if the parser had been made for
+  // it, but keeps the buffers and stacks it has grown. Whatever the parser was
+  // made for, it reads from memory after a Reset. The settings below stay as
+  // they are; values in the arena are released.
+  bool Reset(const unsigned char* input, size_t size);
+  // Starts over on a file, mapped as by the constructor for a path.
+  bool Reset(const char* path);
+
   bool StateMachine(YamlEvent& parserEvent);
   EYamlError error = EYamlError::None;
   bool ExtendString(YamlString& string);
   bool JoinString(YamlString& a, YamlString& b);
+  void* ValueMalloc(size_t size);
+  void* ValueRealloc(void* ptr, size_t old_size, size_t new_size);
+  void ValueFree(void* ptr);
   bool Parse(YamlEvent& event);
+  // Parses the events up to the end of the stream and hands each to the
+  // handler, a YamlHandler, in place of Parse. The parser calls the handler
+  // as it parses, without building an event, and deletes the values of an
+  // event when the call for it returns. Input that is fed in pieces returns
+  // true when it needs the next piece.
+  template <typename Handler>
+  bool ParseWith(Handler& handler);
+  // Gets the next token, in place of Parse. Delete the token with
+  // YamlToken::Delete. In arena mode the values of a document stay valid until
+  // the next DOCUMENT-START or STREAM-END token.
+  bool Scan(YamlToken& token);
+  // Appends a piece of the input of a parser that was made without any. The
+  // piece is copied.
+  bool Feed(const unsigned char* chunk, size_t size);
+  // Marks the end of the input that is fed in pieces.
+  bool Finish();
+  // Consumes the next node and everything nested in it, where Parse would
+  // return the event that starts a node (after a mapping key, for instance).
+  // No events are built, and scalars and anchors inside skipped collections
+  // are scanned past without copying them.
+  bool SkipNode();
+  // Composes the next document of the stream. At the end of the stream the
+  // document has no nodes. Delete the document with YamlDocument::Delete.
+  bool Load(YamlDocument& document);
+  // Composes all documents of the stream, in place of Parse and Load. The
+  // input is split at the '---' lines at column 0 and the pieces are composed
+  // on up to 'threads' threads at once (0 for one per core); the pieces that
+  // get no thread are composed on the calling one. In arena mode the
+  // documents stay valid until the parser is deleted. On an error it returns
+  // false with the documents before the error, as many as a run of Load would
+  // have composed; delete the list either way. Takes a parser made on a
+  // buffer or a file; any other parser fails with a reader error.
+  bool LoadAll(YamlDocumentList& documents, unsigned threads = 0);
+  // Composes all documents of many independent inputs, each with a parser of
+  // its own, on a pool of threads that take the inputs in turn and take over
+  // those of busy threads when they run out. A parser is reused for all the
+  // inputs a thread takes. The handler gets the result of every input. If not
+  // all the threads can be started, the inputs are shared among those that
+  // were and the calling thread. Returns false if there is no memory for the
+  // pool or a result could not be handed over.
+  static bool LoadBatch(const YamlFns& Fns, const YamlBatchInput* inputs, size_t count,
+                        const YamlBatchOptions& options, yaml_batch_handler_t* handler,
+                        void* data);
+  // Finds where each document of the stream starts in one pass over the
+  // input, in place of Parse and Load. Works on UTF-8; UTF-16 input is indexed
+  // as a single document. Takes a parser made on a buffer or a file, like
+  // LoadAll. Lines that start with '%' are taken for directives only before
+  // the first document or after a '...' line, as YAML asks for. Directives
+  // that follow a document without a '...' are not applied by StartAt.
+  bool BuildIndex(YamlDocumentIndex& index);
+  // Starts parsing at a document of an index that was built on the same input,
+  // with the directives written before it already applied. Call it before the
+  // first Parse, on a parser made on a buffer or a file, like BuildIndex.
+  bool StartAt(const YamlDocumentIndex& index, const YamlDocumentEntry& entry);
+  // Fills in the line and the column of a mark that lazy_marks left out. The
+  // first call indexes the lines of the input. Other marks are left as they
+  // are.
+  bool ResolveMark(YamlMark& mark);
+  // Gets the tag with an ID from an event or a node of this parser, or null if
+  // it gave out no such ID.
+  const uint8_t* GetTag(int id);
 
   struct string_t
   {
@@ -509,42 +963,118 @@ struct YamlParser
 
   string_t input;
   const char* problem = nullptr;
+  // The source that the read handler reads from.
+  void* read_handler_data = nullptr;
+
+  // Set before the first Parse to return plain and quoted scalars that need
+  // no unescaping or folding as borrowed views into the input instead of
+  // copies. Only input that is scanned in place can be borrowed from: UTF-8
+  // in a buffer is then scanned in place as a mapped file is, and invalid
+  // octets are reported as late as they are there.
+  bool borrow_scalars = false;
+  // Set before the first Parse to take anchors and aliases that are decimal
+  // numbers, such as the file IDs of Unity ('&170076734'), as numbers instead
+  // of copying them. A number has no leading zero and fits in 64 bits; other
+  // anchors are copied as usual.
+  bool numeric_anchors = false;
+  // Set before the first Parse to have the marks of tokens, events and nodes
+  // hold only the octet offset into the input in 'index', for UTF-8 input in
+  // memory: a buffer or a mapped file. Input read through a handler or fed in
+  // pieces keeps full marks. Use ResolveMark for the line and the column; the
+  // marks of an error are resolved when it is set. The end of a stream that
+  // does not end in a break then lies on its last line instead of the line
+  // after it.
+  bool lazy_marks = false;
+  // Set before the first Parse to call the read handler on a thread of its
+  // own, which reads up to four raw buffers ahead of the scanner. Only parsers
+  // that read through a handler read ahead, and the handler may then use
+  // nothing of the parser but 'read_handler_data'. If the thread cannot be
+  // started, this is cleared and the handler is called from Parse instead.
+  bool async_reader = false;
 
 private:
   void SkipToken();
   YamlToken* PeekToken();
 
-  // Parser
-  bool ParseStreamStart(YamlEvent& event);
-  bool ParseDocumentStart(YamlEvent& event, bool isImplicit);
-  bool ParseDocumentContent(YamlEvent& event);
-  bool ParseDocumentEnd(YamlEvent& event);
-  bool ParseNode(YamlEvent& event, bool isBlock, bool isIndentless);
-  bool ParseBlockSequenceEntry(YamlEvent& event, bool isFirst);
-  bool ParseIndentlessSequenceEntry(YamlEvent& event);
-  bool ParseBlockMappingKey(YamlEvent& event, bool isFirst);
-  bool ParseBlockMappingValue(YamlEvent& event);
-  bool ParseFlowSequenceEntry(YamlEvent& event, bool isFirst);
-  bool ParseFlowSequenceEntryMappingKey(YamlEvent& event);
-  bool ParseFlowSequenceEntryMappingValue(YamlEvent& event);
-  bool ParseFlowSequenceEntryMappingEnd(YamlEvent& event);
-  bool ParseFlowMappingKey(YamlEvent& event, bool isFirst);
-  bool ParseFlowMappingValue(YamlEvent& event, bool isEmpty);
+  // Parser. The states hand each event to 'events': an EventSink, which
+  // builds it for Parse, a HandlerEvents, which calls the handler of
+  // ParseWith, or a SkipEvents, which counts the collections of SkipNode.
+  struct EventSink;
+  struct SkipEvents;
+  template <typename Handler>
+  struct HandlerEvents;
+  template <typename Events>
+  bool StateMachine(Events& events);
+  template <typename Events>
+  bool ParseStreamStart(Events& events);
+  template <typename Events>
+  bool ParseDocumentStart(Events& events, bool isImplicit);
+  template <typename Events>
+  bool ParseDocumentContent(Events& events);
+  template <typename Events>
+  bool ParseDocumentEnd(Events& events);
+  template <typename Events>
+  bool ParseNode(Events& events, bool isBlock, bool isIndentless);
+  template <typename Events>
+  bool ParseBlockSequenceEntry(Events& events, bool isFirst);
+  template <typename Events>
+  bool ParseIndentlessSequenceEntry(Events& events);
+  template <typename Events>
+  bool ParseBlockMappingKey(Events& events, bool isFirst);
+  template <typename Events>
+  bool ParseBlockMappingValue(Events& events);
+  template <typename Events>
+  bool ParseFlowSequenceEntry(Events& events, bool isFirst);
+  template <typename Events>
+  bool ParseFlowSequenceEntryMappingKey(Events& events);
+  template <typename Events>
+  bool ParseFlowSequenceEntryMappingValue(Events& events);
+  template <typename Events>
+  bool ParseFlowSequenceEntryMappingEnd(Events& events);
+  template <typename Events>
+  bool ParseFlowMappingKey(Events& events, bool isFirst);
+  template <typename Events>
+  bool ParseFlowMappingValue(Events& events, bool isEmpty);
+  bool ResolveTag(uint8_t*& tag_handle, uint8_t*& tag_suffix, YamlMark start_mark,
+                  YamlMark tag_mark, uint8_t*& tag, int& tag_id);
+  uint8_t* EmptyValue();
+  void DeleteDirectives(YamlVersionDirective* version_directive,
+                        YamlTagDirective* tag_directives_start,
+                        YamlTagDirective* tag_directives_end);
 
   // Reader
   bool SetReaderError(const char* problem, size_t offset, int value);
   bool DetermineEncoding();
   bool UpdateRawBuffer();
+  bool StartAsyncReader();
+  void StopAsyncReader();
+  bool ReadAsync(unsigned char* buffer, size_t size, size_t* size_read);
+  bool DecodeCharacter(const unsigned char* pointer, size_t raw_unread, unsigned int& value,
+                       unsigned int& width, bool& incomplete);
   bool UpdateBuffer(size_t length);
+  bool UpdateBufferInPlace(size_t length);
+  bool LeaveInPlace();
+  bool MapFile(const char* path);
+  void UnmapFile();
 
   // Scanner
+  void ResolveErrorMarks();
   bool SetScannerError(const char* context, YamlMark context_mark, const char* problem);
   bool FetchMoreTokens();
   bool FetchNextToken();
   bool Cache(size_t length);
+  size_t Offset();
+  size_t Column();
+  bool LazyMarks();
+  YamlMark Mark();
   void Skip();
   void SkipLine();
   bool Read(YamlString& string);
+  bool ReadRun(YamlString& string, size_t length);
+  void SkipRun(size_t length);
+  bool Unborrow(YamlString& string, const uint8_t* start, size_t length);
+  bool ClearScratch();
+  uint8_t* CopyScratch();
   bool ReadLine(YamlString& string);
 
   bool StaleSimpleKeys();
@@ -552,6 +1082,7 @@ private:
   bool RemoveSimpleKey();
   bool IncreaseFlowLevel();
   bool DecreaseFlowLevel();
+  bool OpensMapping(ptrdiff_t column) const;
   bool RollIndent(ptrdiff_t column, ptrdiff_t number, EYamlTokenType type, YamlMark mark);
   bool UnrollIndent(ptrdiff_t column);
 
@@ -588,9 +1119,36 @@ private:
   bool ScanFlowScalar(YamlToken& token, bool single);
   bool ScanPlainScalar(YamlToken& token);
 
-  bool Scan(YamlToken& token);
-
-  bool ProcessEmptyScalar(YamlEvent& event, YamlMark mark);
+  bool SaveDocumentMark();
+  void ReleaseDocumentValues(bool stream_end);
+
+  bool IndexLines();
+
+  // Composer
+  bool SetComposerError(const char* problem, YamlMark problem_mark);
+  bool SetComposerErrorContext(const char* context, YamlMark context_mark, const char* problem,
+                               YamlMark problem_mark);
+  bool LoadDocument(YamlEvent& event);
+  bool LoadNodes();
+  bool RegisterAnchor(int index, uint8_t* anchor, bool numeric_anchor, uint64_t anchor_number);
+  bool LoadNodeAdd(int index);
+  bool LoadAlias(YamlEvent& event);
+  bool LoadScalar(YamlEvent& event);
+  bool LoadSequence(YamlEvent& event);
+  bool LoadSequenceEnd(YamlEvent& event);
+  bool LoadMapping(YamlEvent& event);
+  bool LoadMappingEnd(YamlEvent& event);
+  bool PushNode(YamlNode& node, uint8_t* anchor, bool numeric_anchor, uint64_t anchor_number);
+  bool FinishDocument();
+  void ClearComposer();
+  bool ParseHeader(bool& document);
+  bool IndexTagDirectives(YamlDocumentIndex& index, const YamlParser& parser);
+  void LoadChunk(YamlLoadChunk& chunk);
+  static void LoadBatchWorker(YamlBatchRun& run, unsigned worker);
+  void DeliverBatchResult(YamlBatchRun& run, YamlBatchResult& result);
+
+  template <typename Events>
+  bool ProcessEmptyScalar(Events& events, YamlMark mark);
   bool ProcessDirectives(YamlVersionDirective** version_directive_ref,
                          YamlTagDirective** tag_directives_start_ref,
                          YamlTagDirective** tag_directives_end_ref);
@@ -607,15 +1165,27 @@ private:
   YamlMark context_mark;
 
   yaml_read_handler_t* read_handler = nullptr;
-  void* read_handler_data           = nullptr;
-
-  bool eof = false;
+  // The thread that reads ahead for async_reader, once it is started.
+  YamlAsyncReader* async = nullptr;
+
+  bool eof      = false;
+  bool in_place = false;
+  bool mapped   = false;
+  bool push     = false;
+  // Set when the scanner has run up to the end of the input fed so far.
+  bool starved = false;
+  YamlPushInput pushed;
   YamlBuffer buffer;
   size_t unread = 0;
   YamlRawBuffer raw_buffer;
+  // The owned buffer that Reset kept while 'buffer' points into the input.
+  YamlBuffer kept_buffer;
   EYamlEncoding encoding = EYamlEncoding::Any;
   size_t offset          = 0;
+  // The column of 'mark' is not kept up; it is the distance from 'line_start',
+  // the index of the first character of the line.
   YamlMark mark;
+  size_t line_start = 0;
   bool stream_start_produced = false;
   bool stream_end_produced   = false;
   int flow_level             = 0;
@@ -631,17 +1201,1128 @@ private:
   bool simple_key_allowed = false;
 
   YamlStack<YamlSimpleKey> simple_keys;
+  // The level in 'simple_keys' of the oldest key that may be possible; none
+  // below it is.  The keys that are possible start and take their slots in
+  // the order of their levels, so only this one can be stale first or own the
+  // slot at the head of the queue.
+  size_t oldest_simple_key = 0;
   YamlStack<EYamlParserState> states;
 
   EYamlParserState state = EYamlParserState::StreamStart;
 
   YamlStack<YamlMark> marks;
   YamlStack<YamlTagDirective> tag_directives;
-  YamlStack<YamlAlias> aliases;
+  YamlAliasMap aliases;
+  // Kept from one input to the next by Reset.
+  YamlTagTable tags;
 
   YamlDocument* document = nullptr;
+
+  // The composer builds a document here and then copies it out, so these are
+  // reused from one document to the next.
+  YamlStack<YamlNode> composer_nodes;
+  YamlStack<int> composer_items;
+  YamlStack<YamlNodePair> composer_pairs;
+  YamlStack<int> composer_children;
+  YamlStack<YamlComposerFrame> composer_frames;
+
+  YamlArena arena;
+  // Where the values of each document scanned ahead of the parser start.
+  YamlQueue<YamlArenaMark> document_marks;
+  bool in_directives = false;
+  // Set on the parsers of LoadAll, whose documents outlive the next one.
+  bool keep_values = false;
+  // Set during SkipNode. The scanner counts the collections it opens while
+  // skipping and discards the scalars inside them, folding them into
+  // 'scratch' without copying a value out.
+  bool skipping  = false;
+  int skip_depth = 0;
+  YamlScalarScratch scratch;
+  // Where the lines of the input start, in octets, once ResolveMark needs it.
+  YamlStack<size_t> line_starts;
 };
 
+/*
+ * The events of ParseWith, handed on to the handler.  The values of each are
+ * deleted when the handler returns, as YamlEvent::Delete would.
+ */
+template <typename Handler>
+struct YamlParser::HandlerEvents
+{
+  YamlParser& parser;
+  Handler& handler;
+
+  void OnStreamStart(const YamlEvent::stream_start_t& stream_start, const YamlMark& start_mark,
+                     const YamlMark& end_mark)
+  {
+    this->handler.OnStreamStart(stream_start, start_mark, end_mark);
+  }
+
+  void OnStreamEnd(const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnStreamEnd(start_mark, end_mark);
+  }
+
+  void OnDocumentStart(const YamlEvent::document_start_t& document_start,
+                       const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnDocumentStart(document_start, start_mark, end_mark);
+    this->parser.DeleteDirectives(document_start.version_directive,
+                                  document_start.tag_directives.start,
+                                  document_start.tag_directives.end);
+  }
+
+  void OnDocumentEnd(const YamlEvent::document_end_t& document_end, const YamlMark& start_mark,
+                     const YamlMark& end_mark)
+  {
+    this->handler.OnDocumentEnd(document_end, start_mark, end_mark);
+  }
+
+  void OnAlias(const YamlEvent::alias_t& alias, const YamlMark& start_mark,
+               const YamlMark& end_mark)
+  {
+    this->handler.OnAlias(alias, start_mark, end_mark);
+    this->parser.ValueFree(alias.anchor);
+  }
+
+  void OnScalar(const YamlEvent::scalar_t& scalar, const YamlMark& start_mark,
+                const YamlMark& end_mark)
+  {
+    this->handler.OnScalar(scalar, start_mark, end_mark);
+    this->parser.ValueFree(scalar.anchor);
+    if (!scalar.borrowed) this->parser.ValueFree(scalar.value);
+  }
+
+  void OnSequenceStart(const YamlEvent::sequence_start_t& sequence_start,
+                       const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnSequenceStart(sequence_start, start_mark, end_mark);
+    this->parser.ValueFree(sequence_start.anchor);
+  }
+
+  void OnSequenceEnd(const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnSequenceEnd(start_mark, end_mark);
+  }
+
+  void OnMappingStart(const YamlEvent::mapping_start_t& mapping_start,
+                      const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnMappingStart(mapping_start, start_mark, end_mark);
+    this->parser.ValueFree(mapping_start.anchor);
+  }
+
+  void OnMappingEnd(const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->handler.OnMappingEnd(start_mark, end_mark);
+  }
+};
+
+template <typename Handler>
+bool YamlParser::ParseWith(Handler& handler)
+{
+  HandlerEvents<Handler> events = {*this, handler};
+
+  // No events after the end of the stream.
+  while (!this->stream_end_produced && this->state != EYamlParserState::End)
+  {
+    if (this->error != EYamlError::None) return false;
+    if (this->StateMachine(events)) continue;
+
+    // Come back when more input is fed, as Parse does with an empty event.
+    if (!this->starved) return false;
+    this->starved = false;
+    return true;
+  }
+
+  return this->error == EYamlError::None;
+}
+
+// The states of the parser live here rather than in yaml.cpp, so that the
+// handler of ParseWith is called from them wherever it is instantiated.
+
+/*
+ * State dispatcher.
+ */
+template <typename Events>
+bool YamlParser::StateMachine(Events& events)
+{
+  switch (this->state)
+  {
+  case EYamlParserState::StreamStart:
+    return this->ParseStreamStart(events);
+  case EYamlParserState::ImplicitDocumentStart:
+    return this->ParseDocumentStart(events, true);
+  case EYamlParserState::DocumentStart:
+    return this->ParseDocumentStart(events, false);
+  case EYamlParserState::DocumentContent:
+    return this->ParseDocumentContent(events);
+  case EYamlParserState::DocumentEnd:
+    return this->ParseDocumentEnd(events);
+  case EYamlParserState::BlockNode:
+    return this->ParseNode(events, true, false);
+  case EYamlParserState::BlockNodeOrIndentlessSequence:
+    return this->ParseNode(events, true, true);
+  case EYamlParserState::FlowNode:
+    return this->ParseNode(events, false, false);
+  case EYamlParserState::BlockSequenceFirstEntry:
+    return this->ParseBlockSequenceEntry(events, true);
+  case EYamlParserState::BlockSequenceEntry:
+    return this->ParseBlockSequenceEntry(events, false);
+  case EYamlParserState::IndentlessSequenceEntry:
+    return this->ParseIndentlessSequenceEntry(events);
+  case EYamlParserState::BlockMappingFirstKey:
+    return this->ParseBlockMappingKey(events, true);
+  case EYamlParserState::BlockMappingKey:
+    return this->ParseBlockMappingKey(events, false);
+  case EYamlParserState::BlockMappingValue:
+    return this->ParseBlockMappingValue(events);
+  case EYamlParserState::FlowSequenceFirstEntry:
+    return this->ParseFlowSequenceEntry(events, true);
+  case EYamlParserState::FlowSequenceEntry:
+    return this->ParseFlowSequenceEntry(events, false);
+  case EYamlParserState::FlowSequenceEntryMappingKey:
+    return this->ParseFlowSequenceEntryMappingKey(events);
+  case EYamlParserState::FlowSequenceEntryMappingValue:
+    return this->ParseFlowSequenceEntryMappingValue(events);
+  case EYamlParserState::FlowSequenceEntryMappingEnd:
+    return this->ParseFlowSequenceEntryMappingEnd(events);
+  case EYamlParserState::FlowMappingFirstKey:
+    return this->ParseFlowMappingKey(events, true);
+  case EYamlParserState::FlowMappingKey:
+    return this->ParseFlowMappingKey(events, false);
+  case EYamlParserState::FlowMappingValue:
+    return this->ParseFlowMappingValue(events, false);
+  case EYamlParserState::FlowMappingEmptyValue:
+    return this->ParseFlowMappingValue(events, true);
+  case EYamlParserState::End:
+    break;
+  default:
+    break;
+  }
+
+  events.OnStreamEnd(YamlMark(), YamlMark());
+  return true;
+}
+
+/*
+ * Parse the production:
+ * stream   ::= STREAM-START implicit_document? explicit_document* STREAM-END
+ *              ************
+ */
+template <typename Events>
+bool YamlParser::ParseStreamStart(Events& events)
+{
+  YamlToken* token = this->PeekToken();
+
+  if (!token)
+  {
+    return false;
+  }
+
+  if (token->type != EYamlTokenType::StreamStart)
+  {
+    return this->SetParserError("did not find expected <stream-start>", token->start_mark);
+    return false;
+  }
+
+  this->state = EYamlParserState::ImplicitDocumentStart;
+
+  YamlEvent::stream_start_t stream_start;
+  stream_start.encoding = std::get<YamlToken::stream_start_t>(token->data).encoding;
+  events.OnStreamStart(stream_start, token->start_mark, token->start_mark);
+  this->SkipToken();
+
+  return true;
+}
+
+/*
+ * Parse the productions:
+ * implicit_document    ::= block_node DOCUMENT-END*
+ *                          *
+ * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
+ *                          *************************
+ */
+template <typename Events>
+bool YamlParser::ParseDocumentStart(Events& events, bool isImplicit)
+{
+  YamlToken* token;
+  YamlVersionDirective* version_directive = nullptr;
+  struct
+  {
+    YamlTagDirective* start;
+    YamlTagDirective* end;
+  } tag_directives = {nullptr, nullptr};
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  /* Parse extra document end indicators. */
+
+  if (!isImplicit)
+  {
+    while (token->type == EYamlTokenType::DocumentEnd)
+    {
+      this->SkipToken();
+      token = this->PeekToken();
+      if (!token) return 0;
+    }
+  }
+
+  /* Parse an implicit document. */
+
+  if (isImplicit && token->type != EYamlTokenType::VersionDirective &&
+      token->type != EYamlTokenType::TagDirective && token->type != EYamlTokenType::DocumentStart &&
+      token->type != EYamlTokenType::StreamEnd)
+  {
+    if (!this->ProcessDirectives(nullptr, nullptr, nullptr)) return 0;
+    if (!this->states.Push(*this, EYamlParserState::DocumentEnd)) return 0;
+    this->state = EYamlParserState::BlockNode;
+    YamlEvent::document_start_t document_start;
+    document_start.implicit = true;
+    events.OnDocumentStart(document_start, token->start_mark, token->start_mark);
+    return 1;
+  }
+
+  /* Parse an explicit document. */
+
+  else if (token->type != EYamlTokenType::StreamEnd)
+  {
+    YamlMark start_mark, end_mark;
+    start_mark = token->start_mark;
+    if (!this->ProcessDirectives(&version_directive, &tag_directives.start, &tag_directives.end))
+      return 0;
+    token = this->PeekToken();
+    if (!token) goto error;
+    if (token->type != EYamlTokenType::DocumentStart)
+    {
+      this->SetParserError("did not find expected <document start>", token->start_mark);
+      goto error;
+    }
+    if (!this->states.Push(*this, EYamlParserState::DocumentEnd)) goto error;
+    this->state = EYamlParserState::DocumentContent;
+    end_mark    = token->end_mark;
+    this->ReleaseDocumentValues(false);
+    YamlEvent::document_start_t document_start;
+    document_start.version_directive    = version_directive;
+    document_start.tag_directives.start = tag_directives.start;
+    document_start.tag_directives.end   = tag_directives.end;
+    events.OnDocumentStart(document_start, start_mark, end_mark);
+    this->SkipToken();
+    version_directive    = nullptr;
+    tag_directives.start = tag_directives.end = nullptr;
+    return 1;
+  }
+
+  /* Parse the stream end. */
+
+  else
+  {
+    this->state = EYamlParserState::End;
+    this->ReleaseDocumentValues(true);
+    events.OnStreamEnd(token->start_mark, token->end_mark);
+    this->SkipToken();
+    return 1;
+  }
+
+error:
+  this->DeleteDirectives(version_directive, tag_directives.start, tag_directives.end);
+  return 0;
+}
+
+/*
+ * Parse the productions:
+ * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
+ *                                                    ***********
+ */
+template <typename Events>
+bool YamlParser::ParseDocumentContent(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::VersionDirective ||
+      token->type == EYamlTokenType::TagDirective || token->type == EYamlTokenType::DocumentStart ||
+      token->type == EYamlTokenType::DocumentEnd || token->type == EYamlTokenType::StreamEnd)
+  {
+    this->state = this->states.Pop();
+    return this->ProcessEmptyScalar(events, token->start_mark);
+  }
+  else
+  {
+    return this->ParseNode(events, 1, 0);
+  }
+}
+
+/*
+ * Parse the productions:
+ * implicit_document    ::= block_node DOCUMENT-END*
+ *                                     *************
+ * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
+ *                                                                *************
+ */
+template <typename Events>
+bool YamlParser::ParseDocumentEnd(Events& events)
+{
+  YamlToken* token;
+  YamlMark start_mark, end_mark;
+  int implicit = 1;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  start_mark = end_mark = token->start_mark;
+
+  if (token->type == EYamlTokenType::DocumentEnd)
+  {
+    end_mark = token->end_mark;
+    this->SkipToken();
+    implicit = 0;
+  }
+
+  // Note: libyaml originally clears the tag directives stack here,
+  // but that is incompatible with Unity's YAML (1.1) files.
+  // It has been moved to the stream end.
+
+  this->state = EYamlParserState::DocumentStart;
+  YamlEvent::document_end_t document_end;
+  document_end.implicit = implicit;
+  events.OnDocumentEnd(document_end, start_mark, end_mark);
+
+  return 1;
+}
+
+/*
+ * Parse the productions:
+ * block_node_or_indentless_sequence    ::=
+ *                          ALIAS
+ *                          *****
+ *                          | properties (block_content | indentless_block_sequence)?
+ *                            **********  *
+ *                          | block_content | indentless_block_sequence
+ *                            *
+ * block_node           ::= ALIAS
+ *                          *****
+ *                          | properties block_content?
+ *                            ********** *
+ *                          | block_content
+ *                            *
+ * flow_node            ::= ALIAS
+ *                          *****
+ *                          | properties flow_content?
+ *                            ********** *
+ *                          | flow_content
+ *                            *
+ * properties           ::= TAG ANCHOR? | ANCHOR TAG?
+ *                          *************************
+ * block_content        ::= block_collection | flow_collection | SCALAR
+ *                                                               ******
+ * flow_content         ::= flow_collection | SCALAR
+ *                                            ******
+ */
+template <typename Events>
+bool YamlParser::ParseNode(Events& events, bool isBlock, bool isIndentless)
+{
+  YamlToken* token;
+  uint8_t* anchor        = nullptr;
+  bool numeric_anchor    = false;
+  uint64_t anchor_number = 0;
+  uint8_t* tag_handle    = nullptr;
+  uint8_t* tag_suffix    = nullptr;
+  uint8_t* tag           = nullptr;
+  int tag_id             = 0;
+  YamlMark start_mark, end_mark, tag_mark;
+  int implicit;
+  EYamlSequenceStyle sequence_style = EYamlSequenceStyle::Any;
+  EYamlMappingStyle mapping_style   = EYamlMappingStyle::Any;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::Alias)
+  {
+    YamlToken::alias_t& value = std::get<YamlToken::alias_t>(token->data);
+    YamlEvent::alias_t alias;
+    alias.anchor = value.value;
+    if (!value.value)
+    {
+      alias.numeric_anchor = true;
+      alias.anchor_number  = value.number;
+    }
+    this->state = this->states.Pop();
+    events.OnAlias(alias, token->start_mark, token->end_mark);
+    this->SkipToken();
+    return 1;
+  }
+
+  else
+  {
+    start_mark = end_mark = token->start_mark;
+
+    if (token->type == EYamlTokenType::Anchor)
+    {
+      anchor         = std::get<YamlToken::anchor_t>(token->data).value;
+      numeric_anchor = !anchor;
+      anchor_number  = std::get<YamlToken::anchor_t>(token->data).number;
+      start_mark     = token->start_mark;
+      end_mark   = token->end_mark;
+      this->SkipToken();
+      token = this->PeekToken();
+      if (!token) goto error;
+      if (token->type == EYamlTokenType::Tag)
+      {
+        tag_handle = std::get<YamlToken::tag_t>(token->data).handle;
+        tag_suffix = std::get<YamlToken::tag_t>(token->data).suffix;
+        tag_mark   = token->start_mark;
+        end_mark   = token->end_mark;
+        this->SkipToken();
+        token = this->PeekToken();
+        if (!token) goto error;
+      }
+    }
+    else if (token->type == EYamlTokenType::Tag)
+    {
+      tag_handle = std::get<YamlToken::tag_t>(token->data).handle;
+      tag_suffix = std::get<YamlToken::tag_t>(token->data).suffix;
+      start_mark = tag_mark = token->start_mark;
+      end_mark              = token->end_mark;
+      this->SkipToken();
+      token = this->PeekToken();
+      if (!token) goto error;
+      if (token->type == EYamlTokenType::Anchor)
+      {
+        anchor         = std::get<YamlToken::anchor_t>(token->data).value;
+        numeric_anchor = !anchor;
+        anchor_number  = std::get<YamlToken::anchor_t>(token->data).number;
+        end_mark       = token->end_mark;
+        this->SkipToken();
+        token = this->PeekToken();
+        if (!token) goto error;
+      }
+    }
+
+    if (tag_handle &&
+        !this->ResolveTag(tag_handle, tag_suffix, start_mark, tag_mark, tag, tag_id))
+      goto error;
+
+    implicit = (!tag || !*tag);
+    if (isIndentless && token->type == EYamlTokenType::BlockEntry)
+    {
+      end_mark       = token->end_mark;
+      this->state    = EYamlParserState::IndentlessSequenceEntry;
+      sequence_style = EYamlSequenceStyle::Block;
+    }
+    else
+    {
+      if (token->type == EYamlTokenType::Scalar)
+      {
+        YamlToken::scalar_t& value = std::get<YamlToken::scalar_t>(token->data);
+        YamlEvent::scalar_t scalar;
+        scalar.anchor   = anchor;
+        scalar.tag      = tag;
+        scalar.value    = value.value;
+        scalar.length   = value.length;
+        scalar.style    = value.style;
+        scalar.borrowed = value.borrowed;
+        scalar.tag_id   = tag_id;
+        end_mark        = token->end_mark;
+        if ((value.style == EYamlScalarStyle::Plain && !tag) ||
+            (tag && strcmp((char*)tag, "!") == 0))
+        {
+          scalar.plain_implicit = true;
+        }
+        else if (!tag)
+        {
+          scalar.quoted_implicit = true;
+        }
+        if (numeric_anchor)
+        {
+          scalar.numeric_anchor = true;
+          scalar.anchor_number  = anchor_number;
+        }
+        this->state = this->states.Pop();
+        events.OnScalar(scalar, start_mark, end_mark);
+        this->SkipToken();
+      }
+      else if (token->type == EYamlTokenType::FlowSequenceStart)
+      {
+        end_mark       = token->end_mark;
+        this->state    = EYamlParserState::FlowSequenceFirstEntry;
+        sequence_style = EYamlSequenceStyle::Flow;
+      }
+      else if (token->type == EYamlTokenType::FlowMappingStart)
+      {
+        end_mark      = token->end_mark;
+        this->state   = EYamlParserState::FlowMappingFirstKey;
+        mapping_style = EYamlMappingStyle::Flow;
+      }
+      else if (isBlock && token->type == EYamlTokenType::BlockSequenceStart)
+      {
+        end_mark       = token->end_mark;
+        this->state    = EYamlParserState::BlockSequenceFirstEntry;
+        sequence_style = EYamlSequenceStyle::Block;
+      }
+      else if (isBlock && token->type == EYamlTokenType::BlockMappingStart)
+      {
+        end_mark      = token->end_mark;
+        this->state   = EYamlParserState::BlockMappingFirstKey;
+        mapping_style = EYamlMappingStyle::Block;
+      }
+      else if (anchor || numeric_anchor || tag)
+      {
+        YamlEvent::scalar_t scalar;
+        scalar.value = this->EmptyValue();
+        if (!scalar.value) goto error;
+        scalar.anchor         = anchor;
+        scalar.tag            = tag;
+        scalar.plain_implicit = implicit;
+        scalar.style          = EYamlScalarStyle::Plain;
+        scalar.borrowed       = this->borrow_scalars;
+        scalar.tag_id         = tag_id;
+        if (numeric_anchor)
+        {
+          scalar.numeric_anchor = true;
+          scalar.anchor_number  = anchor_number;
+        }
+        this->state = this->states.Pop();
+        events.OnScalar(scalar, start_mark, end_mark);
+      }
+      else
+      {
+        this->SetParserErrorContext(
+            (isBlock ? "while parsing a block node" : "while parsing a flow node"), start_mark,
+            "did not find expected node content", token->start_mark);
+        goto error;
+      }
+    }
+
+    // Start the collection with the style that was found above.
+    if (sequence_style != EYamlSequenceStyle::Any)
+    {
+      YamlEvent::sequence_start_t sequence_start;
+      sequence_start.anchor   = anchor;
+      sequence_start.tag      = tag;
+      sequence_start.implicit = implicit;
+      sequence_start.style    = sequence_style;
+      sequence_start.tag_id   = tag_id;
+      if (numeric_anchor)
+      {
+        sequence_start.numeric_anchor = true;
+        sequence_start.anchor_number  = anchor_number;
+      }
+      events.OnSequenceStart(sequence_start, start_mark, end_mark);
+    }
+    else if (mapping_style != EYamlMappingStyle::Any)
+    {
+      YamlEvent::mapping_start_t mapping_start;
+      mapping_start.anchor   = anchor;
+      mapping_start.tag      = tag;
+      mapping_start.implicit = implicit;
+      mapping_start.style    = mapping_style;
+      mapping_start.tag_id   = tag_id;
+      if (numeric_anchor)
+      {
+        mapping_start.numeric_anchor = true;
+        mapping_start.anchor_number  = anchor_number;
+      }
+      events.OnMappingStart(mapping_start, start_mark, end_mark);
+    }
+  }
+
+  return 1;
+
+error:
+  this->ValueFree(anchor);
+  this->ValueFree(tag_handle);
+  this->ValueFree(tag_suffix);
+
+  return false;
+}
+
+/*
+ * Parse the productions:
+ * block_sequence ::= BLOCK-SEQUENCE-START (BLOCK-ENTRY block_node?)* BLOCK-END
+ *                    ********************  *********** *             *********
+ */
+template <typename Events>
+bool YamlParser::ParseBlockSequenceEntry(Events& events, bool isFirst)
+{
+  YamlToken* token;
+
+  if (isFirst)
+  {
+    token = this->PeekToken();
+    if (!this->marks.Push(*this, token->start_mark)) return 0;
+    this->SkipToken();
+  }
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::BlockEntry)
+  {
+    YamlMark mark = token->end_mark;
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) return 0;
+    if (token->type != EYamlTokenType::BlockEntry && token->type != EYamlTokenType::BlockEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::BlockSequenceEntry)) return 0;
+      return this->ParseNode(events, 1, 0);
+    }
+    else
+    {
+      this->state = EYamlParserState::BlockSequenceEntry;
+      return this->ProcessEmptyScalar(events, mark);
+    }
+  }
+
+  else if (token->type == EYamlTokenType::BlockEnd)
+  {
+    this->state = this->states.Pop();
+    (void)this->marks.Pop();
+    events.OnSequenceEnd(token->start_mark, token->end_mark);
+    this->SkipToken();
+    return 1;
+  }
+
+  else
+  {
+    return this->SetParserErrorContext("while parsing a block collection", this->marks.Pop(),
+                                       "did not find expected '-' indicator", token->start_mark);
+  }
+}
+
+/*
+ * Parse the productions:
+ * indentless_sequence  ::= (BLOCK-ENTRY block_node?)+
+ *                           *********** *
+ */
+template <typename Events>
+bool YamlParser::ParseIndentlessSequenceEntry(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::BlockEntry)
+  {
+    YamlMark mark = token->end_mark;
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) return 0;
+    if (token->type != EYamlTokenType::BlockEntry && token->type != EYamlTokenType::Key &&
+        token->type != EYamlTokenType::Value && token->type != EYamlTokenType::BlockEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::IndentlessSequenceEntry)) return 0;
+      return this->ParseNode(events, 1, 0);
+    }
+    else
+    {
+      this->state = EYamlParserState::IndentlessSequenceEntry;
+      return this->ProcessEmptyScalar(events, mark);
+    }
+  }
+
+  else
+  {
+    this->state = this->states.Pop();
+    events.OnSequenceEnd(token->start_mark, token->start_mark);
+    return 1;
+  }
+}
+
+/*
+ * Parse the productions:
+ * block_mapping        ::= BLOCK-MAPPING_START
+ *                          *******************
+ *                          ((KEY block_node_or_indentless_sequence?)?
+ *                            *** *
+ *                          (VALUE block_node_or_indentless_sequence?)?)*
+ *
+ *                          BLOCK-END
+ *                          *********
+ */
+template <typename Events>
+bool YamlParser::ParseBlockMappingKey(Events& events, bool isFirst)
+{
+  YamlToken* token;
+
+  if (isFirst)
+  {
+    token = this->PeekToken();
+    if (!this->marks.Push(*this, token->start_mark)) return 0;
+    this->SkipToken();
+  }
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::Key)
+  {
+    YamlMark mark = token->end_mark;
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) return 0;
+    if (token->type != EYamlTokenType::Key && token->type != EYamlTokenType::Value &&
+        token->type != EYamlTokenType::BlockEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::BlockMappingValue)) return 0;
+      return this->ParseNode(events, 1, 1);
+    }
+    else
+    {
+      this->state = EYamlParserState::BlockMappingValue;
+      return this->ProcessEmptyScalar(events, mark);
+    }
+  }
+
+  else if (token->type == EYamlTokenType::BlockEnd)
+  {
+    this->state = this->states.Pop();
+    (void)this->marks.Pop();
+    events.OnMappingEnd(token->start_mark, token->end_mark);
+    this->SkipToken();
+    return 1;
+  }
+
+  else
+  {
+    return this->SetParserErrorContext("while parsing a block mapping", this->marks.Pop(),
+                                       "did not find expected key", token->start_mark);
+  }
+}
+
+/*
+ * Parse the productions:
+ * block_mapping        ::= BLOCK-MAPPING_START
+ *
+ *                          ((KEY block_node_or_indentless_sequence?)?
+ *
+ *                          (VALUE block_node_or_indentless_sequence?)?)*
+ *                           ***** *
+ *                          BLOCK-END
+ *
+ */
+template <typename Events>
+bool YamlParser::ParseBlockMappingValue(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::Value)
+  {
+    YamlMark mark = token->end_mark;
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) return 0;
+    if (token->type != EYamlTokenType::Key && token->type != EYamlTokenType::Value &&
+        token->type != EYamlTokenType::BlockEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::BlockMappingKey)) return 0;
+      return this->ParseNode(events, 1, 1);
+    }
+    else
+    {
+      this->state = EYamlParserState::BlockMappingKey;
+      return this->ProcessEmptyScalar(events, mark);
+    }
+  }
+
+  else
+  {
+    this->state = EYamlParserState::BlockMappingKey;
+    return this->ProcessEmptyScalar(events, token->start_mark);
+  }
+}
+
+/*
+ * Parse the productions:
+ * flow_sequence        ::= FLOW-SEQUENCE-START
+ *                          *******************
+ *                          (flow_sequence_entry FLOW-ENTRY)*
+ *                           *                   **********
+ *                          flow_sequence_entry?
+ *                          *
+ *                          FLOW-SEQUENCE-END
+ *                          *****************
+ * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                          *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowSequenceEntry(Events& events, bool isFirst)
+{
+  YamlToken* token;
+
+  if (isFirst)
+  {
+    token = this->PeekToken();
+    if (!this->marks.Push(*this, token->start_mark)) return 0;
+    this->SkipToken();
+  }
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type != EYamlTokenType::FlowSequenceEnd)
+  {
+    if (!isFirst)
+    {
+      if (token->type == EYamlTokenType::FlowEntry)
+      {
+        this->SkipToken();
+        token = this->PeekToken();
+        if (!token) return 0;
+      }
+      else
+      {
+        return this->SetParserErrorContext("while parsing a flow sequence", this->marks.Pop(),
+                                           "did not find expected ',' or ']'", token->start_mark);
+      }
+    }
+
+    if (token->type == EYamlTokenType::Key)
+    {
+      this->state = EYamlParserState::FlowSequenceEntryMappingKey;
+      YamlEvent::mapping_start_t mapping_start;
+      mapping_start.implicit = 1;
+      mapping_start.style    = EYamlMappingStyle::Flow;
+      events.OnMappingStart(mapping_start, token->start_mark, token->end_mark);
+      this->SkipToken();
+      return 1;
+    }
+
+    else if (token->type != EYamlTokenType::FlowSequenceEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntry)) return 0;
+      return this->ParseNode(events, 0, 0);
+    }
+  }
+
+  this->state = this->states.Pop();
+  (void)this->marks.Pop();
+  events.OnSequenceEnd(token->start_mark, token->end_mark);
+  this->SkipToken();
+  return 1;
+}
+
+/*
+ * Parse the productions:
+ * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                                      *** *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowSequenceEntryMappingKey(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type != EYamlTokenType::Value && token->type != EYamlTokenType::FlowEntry &&
+      token->type != EYamlTokenType::FlowSequenceEnd)
+  {
+    if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntryMappingValue)) return 0;
+    return this->ParseNode(events, 0, 0);
+  }
+  else
+  {
+    YamlMark mark = token->end_mark;
+    this->SkipToken();
+    this->state = EYamlParserState::FlowSequenceEntryMappingValue;
+    return this->ProcessEmptyScalar(events, mark);
+  }
+}
+
+/*
+ * Parse the productions:
+ * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                                                      ***** *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowSequenceEntryMappingValue(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type == EYamlTokenType::Value)
+  {
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) return 0;
+    if (token->type != EYamlTokenType::FlowEntry && token->type != EYamlTokenType::FlowSequenceEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntryMappingEnd)) return 0;
+      return this->ParseNode(events, 0, 0);
+    }
+  }
+  this->state = EYamlParserState::FlowSequenceEntryMappingEnd;
+  return this->ProcessEmptyScalar(events, token->start_mark);
+}
+
+/*
+ * Parse the productions:
+ * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                                                                      *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowSequenceEntryMappingEnd(Events& events)
+{
+  YamlToken* token;
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  this->state = EYamlParserState::FlowSequenceEntry;
+
+  events.OnMappingEnd(token->start_mark, token->start_mark);
+  return 1;
+}
+
+/*
+ * Parse the productions:
+ * flow_mapping         ::= FLOW-MAPPING-START
+ *                          ******************
+ *                          (flow_mapping_entry FLOW-ENTRY)*
+ *                           *                  **********
+ *                          flow_mapping_entry?
+ *                          ******************
+ *                          FLOW-MAPPING-END
+ *                          ****************
+ * flow_mapping_entry   ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                          *           *** *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowMappingKey(Events& events, bool isFirst)
+{
+  YamlToken* token;
+
+  if (isFirst)
+  {
+    token = this->PeekToken();
+    if (!this->marks.Push(*this, token->start_mark)) return 0;
+    this->SkipToken();
+  }
+
+  token = this->PeekToken();
+  if (!token) return 0;
+
+  if (token->type != EYamlTokenType::FlowMappingEnd)
+  {
+    if (!isFirst)
+    {
+      if (token->type == EYamlTokenType::FlowEntry)
+      {
+        this->SkipToken();
+        token = this->PeekToken();
+        if (!token) return 0;
+      }
+      else
+      {
+        return this->SetParserErrorContext("while parsing a flow mapping", this->marks.Pop(),
+                                           "did not find expected ',' or '}'", token->start_mark);
+      }
+    }
+
+    if (token->type == EYamlTokenType::Key)
+    {
+      this->SkipToken();
+      token = this->PeekToken();
+      if (!token) return 0;
+      if (token->type != EYamlTokenType::Value && token->type != EYamlTokenType::FlowEntry &&
+          token->type != EYamlTokenType::FlowMappingEnd)
+      {
+        if (!this->states.Push(*this, EYamlParserState::FlowMappingValue)) return 0;
+        return this->ParseNode(events, 0, 0);
+      }
+      else
+      {
+        this->state = EYamlParserState::FlowMappingValue;
+        return this->ProcessEmptyScalar(events, token->start_mark);
+      }
+    }
+    else if (token->type != EYamlTokenType::FlowMappingEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::FlowMappingEmptyValue)) return 0;
+      return this->ParseNode(events, 0, 0);
+    }
+  }
+
+  this->state = this->states.Pop();
+  (void)this->marks.Pop();
+  events.OnMappingEnd(token->start_mark, token->end_mark);
+  this->SkipToken();
+  return 1;
+}
+
+/*
+ * Parse the productions:
+ * flow_mapping_entry   ::= flow_node | KEY flow_node? (VALUE flow_node?)?
+ *                                   *                  ***** *
+ */
+template <typename Events>
+bool YamlParser::ParseFlowMappingValue(Events& events, bool isEmpty)
+{
+  YamlToken* token = this->PeekToken();
+  if (!token)
+  {
+    return false;
+  }
+
+  if (isEmpty)
+  {
+    this->state = EYamlParserState::FlowMappingKey;
+    return this->ProcessEmptyScalar(events, token->start_mark);
+  }
+
+  if (token->type == EYamlTokenType::Value)
+  {
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token)
+    {
+      return false;
+    }
+    if (token->type != EYamlTokenType::FlowEntry && token->type != EYamlTokenType::FlowMappingEnd)
+    {
+      if (!this->states.Push(*this, EYamlParserState::FlowMappingKey))
+      {
+        return false;
+      }
+      return this->ParseNode(events, false, false);
+    }
+  }
+
+  this->state = EYamlParserState::FlowMappingKey;
+  return this->ProcessEmptyScalar(events, token->start_mark);
+}
+
+/*
+ * Generate an empty scalar event.
+ */
+template <typename Events>
+bool YamlParser::ProcessEmptyScalar(Events& events, YamlMark mark)
+{
+  YamlEvent::scalar_t scalar;
+
+  scalar.value = this->EmptyValue();
+  if (!scalar.value) return false;
+  scalar.plain_implicit = true;
+  scalar.style          = EYamlScalarStyle::Plain;
+  scalar.borrowed       = this->borrow_scalars;
+
+  events.OnScalar(scalar, mark, mark);
+
+  return true;
+}
+
 } // namespace mj
 
 #endif // MJ_YAML_H
@@ -3,12 +3,38 @@
 #include <limits.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace mj;
 
 #define INITIAL_STACK_SIZE 16
 #define INITIAL_QUEUE_SIZE 16
 #define INITIAL_STRING_SIZE 16
+
+/*
+ * The alignment of arena allocations.
+ */
+#define ARENA_ALIGNMENT 8
 /*
  * The size of the input raw buffer.
  */
@@ -21,6 +47,623 @@ using namespace mj;
  */
 #define INPUT_BUFFER_SIZE (INPUT_RAW_BUFFER_SIZE * 3)
 
+/*
+ * The most characters the scanner asks the reader to cache at once: the 20
+ * digits of a numeric anchor and the character after them.  When the reader
+ * decodes a raw buffer, up to one less than that is still unread in front of
+ * it, at most four octets each.
+ */
+#define MAX_CACHE_LENGTH 21
+
+/*
+ * The smallest raw buffer of a parser that reads through a handler.  The
+ * encoding is told from the first three octets.
+ */
+#define MIN_RAW_BUFFER_SIZE 4
+
+/*
+ * The file read handlers read whole multiples of this many octets where the
+ * raw buffer has room for them, so that reads stay on page boundaries.
+ */
+#define INPUT_READ_ALIGNMENT 4096
+
+/*
+ * The number of octets at the end of in-place input that are decoded into
+ * the buffer instead.  It must cover the scanner's look-ahead.
+ */
+#define INPUT_IN_PLACE_TAIL_SIZE 16
+
+/*
+ * The number of raw buffers that the async reader fills ahead of the scanner.
+ */
+#define ASYNC_READER_CHUNKS 4
+
+/*
+ * The value of empty scalars when scalars are borrowed.
+ */
+static uint8_t yaml_empty_value[1] = {0};
+
+// SIMD
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define YAML_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define YAML_TARGET_SSE2
+#define YAML_TARGET_AVX2
+#else
+#define YAML_TARGET_SSE2 __attribute__((target("sse2")))
+#define YAML_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+/*
+ * Find the widest instruction set the kernels below may use on this machine.
+ */
+static EYamlSimdLevel yaml_detect_simd_level()
+{
+#if defined(YAML_SIMD_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+  __cpuid(info, 1);
+  bool sse2    = (info[3] & (1 << 26)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx     = (info[2] & (1 << 28)) != 0;
+  if (!sse2) return EYamlSimdLevel::Scalar;
+  // The OS must save the YMM registers for AVX2 to be usable.
+  if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+  {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1 << 5)) return EYamlSimdLevel::Avx2;
+  }
+  return EYamlSimdLevel::Sse2;
+#elif defined(YAML_SIMD_X86)
+  if (__builtin_cpu_supports("avx2")) return EYamlSimdLevel::Avx2;
+  if (__builtin_cpu_supports("sse2")) return EYamlSimdLevel::Sse2;
+  return EYamlSimdLevel::Scalar;
+#else
+  return EYamlSimdLevel::Scalar;
+#endif
+}
+
+static EYamlSimdLevel& yaml_simd_level_in_use()
+{
+  static EYamlSimdLevel level = yaml_detect_simd_level();
+  return level;
+}
+
+static EYamlSimdLevel yaml_simd_level()
+{
+  return yaml_simd_level_in_use();
+}
+
+EYamlSimdLevel mj::yaml_get_simd_level()
+{
+  return yaml_simd_level();
+}
+
+void mj::yaml_set_simd_level(EYamlSimdLevel level)
+{
+  EYamlSimdLevel detected = yaml_detect_simd_level();
+
+  yaml_simd_level_in_use() = level < detected ? level : detected;
+}
+
+/*
+ * The index of the lowest set bit.  The mask must not be zero.
+ */
+static inline unsigned int yaml_lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+/*
+ * Check if an octet is a complete character that is allowed in the stream
+ * and needs no decoding: #x9, #xA, #xD or [#x20-#x7E].
+ */
+static inline bool yaml_is_printable_ascii(uint8_t octet)
+{
+  return (octet >= 0x20 && octet <= 0x7E) || octet == '\t' || octet == '\n' || octet == '\r';
+}
+
+static size_t yaml_printable_ascii_run_scalar(const uint8_t* pointer, size_t size)
+{
+  size_t k = 0;
+  while (k < size && yaml_is_printable_ascii(pointer[k])) k++;
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_printable_ascii_run_sse2(const uint8_t* pointer, size_t size)
+{
+  const __m128i space = _mm_set1_epi8(0x1F);
+  const __m128i del   = _mm_set1_epi8(0x7F);
+  const __m128i tab   = _mm_set1_epi8('\t');
+  const __m128i lf    = _mm_set1_epi8('\n');
+  const __m128i cr    = _mm_set1_epi8('\r');
+  size_t k            = 0;
+
+  for (; k + 16 <= size; k += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pointer + k));
+    // Octets from #x80 up are negative as signed bytes, so they fail here too.
+    __m128i ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, del), _mm_cmpgt_epi8(v, space));
+    ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(ok) ^ 0xFFFF;
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_printable_ascii_run_scalar(pointer + k, size - k);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_printable_ascii_run_avx2(const uint8_t* pointer, size_t size)
+{
+  const __m256i space = _mm256_set1_epi8(0x1F);
+  const __m256i del   = _mm256_set1_epi8(0x7F);
+  const __m256i tab   = _mm256_set1_epi8('\t');
+  const __m256i lf    = _mm256_set1_epi8('\n');
+  const __m256i cr    = _mm256_set1_epi8('\r');
+  size_t k            = 0;
+
+  for (; k + 32 <= size; k += 32)
+  {
+    __m256i v  = _mm256_loadu_si256((const __m256i*)(pointer + k));
+    __m256i ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del), _mm256_cmpgt_epi8(v, space));
+    ok         = _mm256_or_si256(
+        ok, _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr))));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ok);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_printable_ascii_run_sse2(pointer + k, size - k);
+}
+#endif
+
+/*
+ * Count the octets at the start of a span that are printable ASCII.  They
+ * are valid UTF-8 and decode to themselves, so they can be taken in bulk.
+ */
+static size_t yaml_printable_ascii_run(const uint8_t* pointer, size_t size)
+{
+  switch (yaml_simd_level())
+  {
+#ifdef YAML_SIMD_X86
+  case EYamlSimdLevel::Avx2: return yaml_printable_ascii_run_avx2(pointer, size);
+  case EYamlSimdLevel::Sse2: return yaml_printable_ascii_run_sse2(pointer, size);
+#endif
+  case EYamlSimdLevel::Decode: return 0;
+  default: break;
+  }
+  return yaml_printable_ascii_run_scalar(pointer, size);
+}
+
+/*
+ * Count the octets at the start of a span that cannot end a plain scalar or
+ * need a closer look: anything but blanks, breaks, NUL, ':' and non-ASCII
+ * octets, and in the flow context also ',?[]{}'.  Other control characters
+ * never reach the scanner.
+ */
+static inline bool yaml_is_plain_stop(uint8_t octet, bool flow)
+{
+  return octet <= ' ' || octet >= 0x80 || octet == ':' ||
+         (flow && (octet == ',' || octet == '?' || (octet | 0x20) == '{' || (octet | 0x20) == '}'));
+}
+
+static size_t yaml_plain_scalar_run_scalar(const uint8_t* pointer, size_t size, bool flow)
+{
+  size_t k = 0;
+  while (k < size && !yaml_is_plain_stop(pointer[k], flow)) k++;
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_plain_scalar_run_sse2(const uint8_t* pointer, size_t size,
+                                                          bool flow)
+{
+  const __m128i blank = _mm_set1_epi8(' ' + 1);
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(flow ? ',' : ':');
+  const __m128i quest = _mm_set1_epi8(flow ? '?' : ':');
+  const __m128i open  = _mm_set1_epi8(flow ? '{' : ':');
+  const __m128i close = _mm_set1_epi8(flow ? '}' : ':');
+  const __m128i lower = _mm_set1_epi8(0x20);
+  size_t k            = 0;
+
+  for (; k + 16 <= size; k += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pointer + k));
+    // Octets from #x80 up are negative as signed bytes and count as blanks.
+    __m128i stop = _mm_or_si128(_mm_cmpgt_epi8(blank, v), _mm_cmpeq_epi8(v, colon));
+    // '[' and ']' are '{' and '}' with bit 5 cleared.
+    __m128i folded = _mm_or_si128(v, lower);
+    stop           = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                                                     _mm_cmpeq_epi8(v, quest)));
+    stop           = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                                                     _mm_cmpeq_epi8(folded, close)));
+    uint32_t mask  = (uint32_t)_mm_movemask_epi8(stop);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_plain_scalar_run_scalar(pointer + k, size - k, flow);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_plain_scalar_run_avx2(const uint8_t* pointer, size_t size,
+                                                          bool flow)
+{
+  const __m256i blank = _mm256_set1_epi8(' ' + 1);
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(flow ? ',' : ':');
+  const __m256i quest = _mm256_set1_epi8(flow ? '?' : ':');
+  const __m256i open  = _mm256_set1_epi8(flow ? '{' : ':');
+  const __m256i close = _mm256_set1_epi8(flow ? '}' : ':');
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  size_t k            = 0;
+
+  for (; k + 32 <= size; k += 32)
+  {
+    __m256i v      = _mm256_loadu_si256((const __m256i*)(pointer + k));
+    __m256i stop   = _mm256_or_si256(_mm256_cmpgt_epi8(blank, v), _mm256_cmpeq_epi8(v, colon));
+    __m256i folded = _mm256_or_si256(v, lower);
+    stop           = _mm256_or_si256(stop, _mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                                                           _mm256_cmpeq_epi8(v, quest)));
+    stop           = _mm256_or_si256(stop, _mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                                                           _mm256_cmpeq_epi8(folded, close)));
+    uint32_t mask  = (uint32_t)_mm256_movemask_epi8(stop);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_plain_scalar_run_sse2(pointer + k, size - k, flow);
+}
+#endif
+
+static size_t yaml_plain_scalar_run(const uint8_t* pointer, size_t size, bool flow)
+{
+#ifdef YAML_SIMD_X86
+  switch (yaml_simd_level())
+  {
+  case EYamlSimdLevel::Avx2: return yaml_plain_scalar_run_avx2(pointer, size, flow);
+  case EYamlSimdLevel::Sse2: return yaml_plain_scalar_run_sse2(pointer, size, flow);
+  default: break;
+  }
+#endif
+  return yaml_plain_scalar_run_scalar(pointer, size, flow);
+}
+
+/*
+ * Count the spaces at the start of a span, and the tabs too if 'tabs' is set.
+ */
+static size_t yaml_blank_run_scalar(const uint8_t* pointer, size_t size, bool tabs)
+{
+  size_t k = 0;
+  while (k < size && (pointer[k] == ' ' || (tabs && pointer[k] == '\t'))) k++;
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_blank_run_sse2(const uint8_t* pointer, size_t size, bool tabs)
+{
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab   = _mm_set1_epi8(tabs ? '\t' : ' ');
+  size_t k            = 0;
+
+  for (; k + 16 <= size; k += 16)
+  {
+    __m128i v     = _mm_loadu_si128((const __m128i*)(pointer + k));
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(blank) ^ 0xFFFF;
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_blank_run_scalar(pointer + k, size - k, tabs);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_blank_run_avx2(const uint8_t* pointer, size_t size, bool tabs)
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab   = _mm256_set1_epi8(tabs ? '\t' : ' ');
+  size_t k            = 0;
+
+  for (; k + 32 <= size; k += 32)
+  {
+    __m256i v     = _mm256_loadu_si256((const __m256i*)(pointer + k));
+    __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(blank);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_blank_run_sse2(pointer + k, size - k, tabs);
+}
+#endif
+
+static size_t yaml_blank_run(const uint8_t* pointer, size_t size, bool tabs)
+{
+#ifdef YAML_SIMD_X86
+  switch (yaml_simd_level())
+  {
+  case EYamlSimdLevel::Avx2: return yaml_blank_run_avx2(pointer, size, tabs);
+  case EYamlSimdLevel::Sse2: return yaml_blank_run_sse2(pointer, size, tabs);
+  default: break;
+  }
+#endif
+  return yaml_blank_run_scalar(pointer, size, tabs);
+}
+
+/*
+ * Count the octets at the start of a comment that are single-octet characters
+ * other than breaks and NUL.
+ */
+static inline bool yaml_is_comment_ascii(uint8_t octet)
+{
+  return octet != '\0' && octet < 0x80 && octet != '\n' && octet != '\r';
+}
+
+static size_t yaml_comment_run_scalar(const uint8_t* pointer, size_t size)
+{
+  size_t k = 0;
+  while (k < size && yaml_is_comment_ascii(pointer[k])) k++;
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_comment_run_sse2(const uint8_t* pointer, size_t size)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lf   = _mm_set1_epi8('\n');
+  const __m128i cr   = _mm_set1_epi8('\r');
+  size_t k           = 0;
+
+  for (; k + 16 <= size; k += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pointer + k));
+    // Octets from #x80 up are negative as signed bytes, so they fail here too.
+    __m128i ok    = _mm_cmpgt_epi8(v, zero);
+    __m128i brk   = _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_andnot_si128(brk, ok)) ^ 0xFFFF;
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_comment_run_scalar(pointer + k, size - k);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_comment_run_avx2(const uint8_t* pointer, size_t size)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i lf   = _mm256_set1_epi8('\n');
+  const __m256i cr   = _mm256_set1_epi8('\r');
+  size_t k           = 0;
+
+  for (; k + 32 <= size; k += 32)
+  {
+    __m256i v     = _mm256_loadu_si256((const __m256i*)(pointer + k));
+    __m256i ok    = _mm256_cmpgt_epi8(v, zero);
+    __m256i brk   = _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(brk, ok));
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_comment_run_sse2(pointer + k, size - k);
+}
+#endif
+
+static size_t yaml_comment_run(const uint8_t* pointer, size_t size)
+{
+#ifdef YAML_SIMD_X86
+  switch (yaml_simd_level())
+  {
+  case EYamlSimdLevel::Avx2: return yaml_comment_run_avx2(pointer, size);
+  case EYamlSimdLevel::Sse2: return yaml_comment_run_sse2(pointer, size);
+  default: break;
+  }
+#endif
+  return yaml_comment_run_scalar(pointer, size);
+}
+
+/*
+ * Count the octets before the next one that can start a break: CR, LF, or
+ * the lead octet of NEL (#xC2) or of LS and PS (#xE2).
+ */
+static inline bool yaml_is_line_octet(uint8_t octet)
+{
+  return octet != '\n' && octet != '\r' && octet != 0xC2 && octet != 0xE2;
+}
+
+static size_t yaml_line_run_scalar(const uint8_t* pointer, size_t size)
+{
+  size_t k = 0;
+  while (k < size && yaml_is_line_octet(pointer[k])) k++;
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_line_run_sse2(const uint8_t* pointer, size_t size)
+{
+  const __m128i lf  = _mm_set1_epi8('\n');
+  const __m128i cr  = _mm_set1_epi8('\r');
+  const __m128i nel = _mm_set1_epi8((char)0xC2);
+  const __m128i ls  = _mm_set1_epi8((char)0xE2);
+  size_t k          = 0;
+
+  for (; k + 16 <= size; k += 16)
+  {
+    __m128i v     = _mm_loadu_si128((const __m128i*)(pointer + k));
+    __m128i brk   = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, nel), _mm_cmpeq_epi8(v, ls)));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(brk);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_line_run_scalar(pointer + k, size - k);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_line_run_avx2(const uint8_t* pointer, size_t size)
+{
+  const __m256i lf  = _mm256_set1_epi8('\n');
+  const __m256i cr  = _mm256_set1_epi8('\r');
+  const __m256i nel = _mm256_set1_epi8((char)0xC2);
+  const __m256i ls  = _mm256_set1_epi8((char)0xE2);
+  size_t k          = 0;
+
+  for (; k + 32 <= size; k += 32)
+  {
+    __m256i v   = _mm256_loadu_si256((const __m256i*)(pointer + k));
+    __m256i brk = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, nel), _mm256_cmpeq_epi8(v, ls)));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(brk);
+    if (mask) return k + yaml_lowest_bit(mask);
+  }
+
+  return k + yaml_line_run_sse2(pointer + k, size - k);
+}
+#endif
+
+static size_t yaml_line_run(const uint8_t* pointer, size_t size)
+{
+#ifdef YAML_SIMD_X86
+  switch (yaml_simd_level())
+  {
+  case EYamlSimdLevel::Avx2: return yaml_line_run_avx2(pointer, size);
+  case EYamlSimdLevel::Sse2: return yaml_line_run_sse2(pointer, size);
+  default: break;
+  }
+#endif
+  return yaml_line_run_scalar(pointer, size);
+}
+
+/*
+ * Transcode the UTF-16 code units at the start of a span that are allowed
+ * characters on their own: anything in the BMP but surrogates and characters
+ * that are not allowed in the stream.  Returns the number of code units taken
+ * and moves 'output' past the UTF-8 octets written for them.
+ */
+static size_t yaml_utf16_run_scalar(const uint8_t* pointer, size_t units, bool big_endian,
+                                    uint8_t*& output)
+{
+  const int low  = big_endian ? 1 : 0;
+  const int high = big_endian ? 0 : 1;
+  size_t k       = 0;
+
+  for (; k < units; k++)
+  {
+    unsigned int value = pointer[2 * k + low] + (pointer[2 * k + high] << 8);
+
+    if (value <= 0x7F)
+    {
+      if (!yaml_is_printable_ascii((uint8_t)value)) break;
+      *(output++) = value;
+    }
+    else if (value <= 0x7FF)
+    {
+      if (value < 0xA0 && value != 0x85) break;
+      *(output++) = 0xC0 + (value >> 6);
+      *(output++) = 0x80 + (value & 0x3F);
+    }
+    else
+    {
+      if ((value >= 0xD800 && value <= 0xDFFF) || value > 0xFFFD) break;
+      *(output++) = 0xE0 + (value >> 12);
+      *(output++) = 0x80 + ((value >> 6) & 0x3F);
+      *(output++) = 0x80 + (value & 0x3F);
+    }
+  }
+
+  return k;
+}
+
+#ifdef YAML_SIMD_X86
+static YAML_TARGET_SSE2 size_t yaml_utf16_run_sse2(const uint8_t* pointer, size_t units,
+                                                   bool big_endian, uint8_t*& output)
+{
+  const __m128i space = _mm_set1_epi16(0x1F);
+  const __m128i del   = _mm_set1_epi16(0x7F);
+  const __m128i tab   = _mm_set1_epi16('\t');
+  const __m128i lf    = _mm_set1_epi16('\n');
+  const __m128i cr    = _mm_set1_epi16('\r');
+  size_t k            = 0;
+
+  for (; k + 8 <= units; k += 8)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pointer + 2 * k));
+    if (big_endian) v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    // Units from #x8000 up are negative as signed words, so they fail here too.
+    __m128i ok  = _mm_and_si128(_mm_cmpgt_epi16(v, space), _mm_cmplt_epi16(v, del));
+    __m128i brk = _mm_or_si128(_mm_cmpeq_epi16(v, lf), _mm_cmpeq_epi16(v, cr));
+    ok          = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi16(v, tab), brk));
+
+    // Printable ASCII narrows to octets; a block with anything else is taken
+    // unit by unit.
+    if (_mm_movemask_epi8(ok) != 0xFFFF)
+    {
+      size_t run = yaml_utf16_run_scalar(pointer + 2 * k, 8, big_endian, output);
+      if (run < 8) return k + run;
+      continue;
+    }
+    _mm_storel_epi64((__m128i*)output, _mm_packus_epi16(v, v));
+    output += 8;
+  }
+
+  return k + yaml_utf16_run_scalar(pointer + 2 * k, units - k, big_endian, output);
+}
+
+static YAML_TARGET_AVX2 size_t yaml_utf16_run_avx2(const uint8_t* pointer, size_t units,
+                                                   bool big_endian, uint8_t*& output)
+{
+  const __m256i space = _mm256_set1_epi16(0x1F);
+  const __m256i del   = _mm256_set1_epi16(0x7F);
+  const __m256i tab   = _mm256_set1_epi16('\t');
+  const __m256i lf    = _mm256_set1_epi16('\n');
+  const __m256i cr    = _mm256_set1_epi16('\r');
+  size_t k            = 0;
+
+  for (; k + 16 <= units; k += 16)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(pointer + 2 * k));
+    if (big_endian) v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi16(v, space), _mm256_cmpgt_epi16(del, v));
+    ok         = _mm256_or_si256(
+        ok, _mm256_or_si256(_mm256_cmpeq_epi16(v, tab),
+                            _mm256_or_si256(_mm256_cmpeq_epi16(v, lf), _mm256_cmpeq_epi16(v, cr))));
+
+    if ((uint32_t)_mm256_movemask_epi8(ok) != 0xFFFFFFFF)
+    {
+      size_t run = yaml_utf16_run_scalar(pointer + 2 * k, 16, big_endian, output);
+      if (run < 16) return k + run;
+      continue;
+    }
+    _mm_storeu_si128((__m128i*)output, _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                                        _mm256_extracti128_si256(v, 1)));
+    output += 16;
+  }
+
+  return k + yaml_utf16_run_sse2(pointer + 2 * k, units - k, big_endian, output);
+}
+#endif
+
+static size_t yaml_utf16_run(const uint8_t* pointer, size_t units, bool big_endian,
+                             uint8_t*& output)
+{
+  switch (yaml_simd_level())
+  {
+#ifdef YAML_SIMD_X86
+  case EYamlSimdLevel::Avx2: return yaml_utf16_run_avx2(pointer, units, big_endian, output);
+  case EYamlSimdLevel::Sse2: return yaml_utf16_run_sse2(pointer, units, big_endian, output);
+#endif
+  case EYamlSimdLevel::Decode: return 0;
+  default: break;
+  }
+  return yaml_utf16_run_scalar(pointer, units, big_endian, output);
+}
+
 // YamlString
 
 void YamlToken::Delete(YamlParser& parser)
@@ -28,25 +671,28 @@ void YamlToken::Delete(YamlParser& parser)
   switch (this->type)
   {
   case EYamlTokenType::TagDirective:
-    parser.Free(std::get<tag_directive_t>(this->data).handle);
-    parser.Free(std::get<tag_directive_t>(this->data).prefix);
+    parser.ValueFree(std::get<tag_directive_t>(this->data).handle);
+    parser.ValueFree(std::get<tag_directive_t>(this->data).prefix);
     break;
 
   case EYamlTokenType::Alias:
-    parser.Free(std::get<alias_t>(this->data).value);
+    parser.ValueFree(std::get<alias_t>(this->data).value);
     break;
 
   case EYamlTokenType::Anchor:
-    parser.Free(std::get<anchor_t>(this->data).value);
+    parser.ValueFree(std::get<anchor_t>(this->data).value);
     break;
 
   case EYamlTokenType::Tag:
-    parser.Free(std::get<tag_t>(this->data).handle);
-    parser.Free(std::get<tag_t>(this->data).suffix);
+    parser.ValueFree(std::get<tag_t>(this->data).handle);
+    parser.ValueFree(std::get<tag_t>(this->data).suffix);
     break;
 
   case EYamlTokenType::Scalar:
-    parser.Free(std::get<scalar_t>(this->data).value);
+    if (!std::get<scalar_t>(this->data).borrowed)
+    {
+      parser.ValueFree(std::get<scalar_t>(this->data).value);
+    }
     break;
 
   default:
@@ -71,7 +717,25 @@ bool YamlString::Init(YamlParser& parser, size_t size)
   {
     this->pointer = this->start;
     this->end     = this->start + (size);
-    memset(this->start, 0, (size));
+    *this->start  = '\0';
+    return true;
+  }
+  else
+  {
+    parser.error = EYamlError::Memory;
+    return false;
+  }
+}
+
+bool YamlString::InitValue(YamlParser& parser, size_t size)
+{
+  this->start = (uint8_t*)parser.ValueMalloc(size);
+  if (this->start)
+  {
+    this->pointer  = this->start;
+    this->end      = this->start + (size);
+    this->is_value = true;
+    *this->start   = '\0';
     return true;
   }
   else
@@ -83,10 +747,27 @@ bool YamlString::Init(YamlParser& parser, size_t size)
 
 void YamlString::Del(YamlParser& parser)
 {
-  parser.Free(this->start);
+  if (this->is_value)
+  {
+    parser.ValueFree(this->start);
+  }
+  else
+  {
+    parser.Free(this->start);
+  }
   *this = YamlString();
 }
 
+// YamlScalarScratch
+
+void YamlScalarScratch::Del(YamlParser& parser)
+{
+  this->string.Del(parser);
+  this->leading_break.Del(parser);
+  this->trailing_breaks.Del(parser);
+  this->whitespaces.Del(parser);
+}
+
 // YamlBuffer
 bool YamlBuffer::Init(YamlParser& parser, size_t size)
 {
@@ -111,22 +792,23 @@ void YamlBuffer::Del(YamlParser& parser)
   this->start   = nullptr;
   this->pointer = nullptr;
   this->end     = nullptr;
+  this->last    = nullptr;
 }
 
 // YamlParser
 
 bool YamlParser::ExtendString(YamlString& string)
 {
+  size_t size = string.end - string.start;
   uint8_t* new_start =
-      (uint8_t*)this->Realloc((void*)string.start, (string.end - string.start) * 2);
+      (uint8_t*)(string.is_value ? this->ValueRealloc((void*)string.start, size, size * 2)
+                                 : this->Realloc((void*)string.start, size * 2));
 
   if (!new_start)
   {
     return false;
   }
 
-  memset(new_start + (string.end - string.start), 0, string.end - string.start);
-
   string.pointer = new_start + (string.pointer - string.start);
   string.end     = new_start + (string.end - string.start) * 2;
   string.start   = new_start;
@@ -155,14 +837,34 @@ bool YamlParser::JoinString(YamlString& a, YamlString& b)
   return true;
 }
 
-bool YamlString::Extend(YamlParser& parser)
+/*
+ * Allocate the value of a token or an event.  In arena mode, values are only
+ * released a document at a time.
+ */
+void* YamlParser::ValueMalloc(size_t size)
 {
-  if ((this->pointer + 5 < this->end) || parser.ExtendString(*this))
-  {
-    return true;
-  }
-  else
-  {
+  return this->arena.block_size ? this->arena.Malloc(*this, size) : this->Malloc(size);
+}
+
+void* YamlParser::ValueRealloc(void* ptr, size_t old_size, size_t new_size)
+{
+  return this->arena.block_size ? this->arena.Realloc(*this, ptr, old_size, new_size)
+                                : this->Realloc(ptr, new_size);
+}
+
+void YamlParser::ValueFree(void* ptr)
+{
+  if (!this->arena.block_size) this->Free(ptr);
+}
+
+bool YamlString::Extend(YamlParser& parser)
+{
+  if ((this->pointer + 5 < this->end) || parser.ExtendString(*this))
+  {
+    return true;
+  }
+  else
+  {
     parser.error = EYamlError::Memory;
     return false;
   }
@@ -171,7 +873,7 @@ bool YamlString::Extend(YamlParser& parser)
 void YamlString::Clear()
 {
   this->pointer = this->start;
-  memset(this->start, 0, this->end - this->start);
+  *this->start  = '\0';
 }
 
 bool YamlString::Join(YamlParser& parser, YamlString& string_b)
@@ -188,6 +890,106 @@ bool YamlString::Join(YamlParser& parser, YamlString& string_b)
   }
 }
 
+// Character classes
+
+/*
+ * The classes an octet may belong to, as bits of yaml_char_classes.
+ */
+#define YAML_CHAR_NUL 0x0001        // NUL.
+#define YAML_CHAR_SPACE 0x0002      // ' '.
+#define YAML_CHAR_BLANK 0x0004      // ' ' and '\t'.
+#define YAML_CHAR_BREAK 0x0008      // '\r' and '\n'.
+#define YAML_CHAR_BREAK_LEAD 0x0010 // The first octet of NEL, LS and PS.
+#define YAML_CHAR_FLOW 0x0020       // The flow indicators ',[]{}'.
+#define YAML_CHAR_INDICATOR 0x0040  // The indicators that may not start a plain scalar.
+#define YAML_CHAR_ALPHA 0x0080      // '0'-'9', 'A'-'Z', 'a'-'z', '_' and '-'.
+#define YAML_CHAR_URI 0x0100        // The characters of a tag URI.
+#define YAML_CHAR_HEX 0x0200        // '0'-'9', 'A'-'F' and 'a'-'f'.
+#define YAML_CHAR_DIGIT 0x0400      // '0'-'9'.
+
+struct YamlCharClasses
+{
+  uint16_t bits[256];
+};
+
+static constexpr bool yaml_char_in(int octet, const char* set)
+{
+  for (; *set; set++)
+  {
+    if ((uint8_t)*set == octet) return true;
+  }
+  return false;
+}
+
+static constexpr YamlCharClasses yaml_make_char_classes()
+{
+  YamlCharClasses classes = {};
+
+  for (int octet = 0; octet < 256; octet++)
+  {
+    bool digit    = octet >= '0' && octet <= '9';
+    bool alpha    = digit || (octet >= 'A' && octet <= 'Z') || (octet >= 'a' && octet <= 'z') ||
+                    octet == '_' || octet == '-';
+    uint16_t bits = 0;
+
+    if (octet == '\0') bits |= YAML_CHAR_NUL;
+    if (octet == ' ') bits |= YAML_CHAR_SPACE;
+    if (octet == ' ' || octet == '\t') bits |= YAML_CHAR_BLANK;
+    if (octet == '\r' || octet == '\n') bits |= YAML_CHAR_BREAK;
+    if (octet == 0xC2 || octet == 0xE2) bits |= YAML_CHAR_BREAK_LEAD;
+    if (yaml_char_in(octet, ",[]{}")) bits |= YAML_CHAR_FLOW;
+    if (yaml_char_in(octet, "-?:,[]{}#&*!|>'\"%@`")) bits |= YAML_CHAR_INDICATOR;
+    if (alpha) bits |= YAML_CHAR_ALPHA;
+    if (alpha || yaml_char_in(octet, ";/?:@&=+$,.!~*'()[]%")) bits |= YAML_CHAR_URI;
+    if (digit || (octet >= 'A' && octet <= 'F') || (octet >= 'a' && octet <= 'f'))
+    {
+      bits |= YAML_CHAR_HEX;
+    }
+    if (digit) bits |= YAML_CHAR_DIGIT;
+
+    classes.bits[octet] = bits;
+  }
+
+  return classes;
+}
+
+static constexpr YamlCharClasses yaml_char_classes = yaml_make_char_classes();
+
+static_assert(yaml_char_classes.bits[0] == YAML_CHAR_NUL, "NUL");
+static_assert(yaml_char_classes.bits[' '] == (YAML_CHAR_SPACE | YAML_CHAR_BLANK), "space");
+static_assert(yaml_char_classes.bits['\t'] == YAML_CHAR_BLANK, "tab");
+static_assert(yaml_char_classes.bits['\n'] == YAML_CHAR_BREAK, "LF");
+static_assert(yaml_char_classes.bits[0xE2] == YAML_CHAR_BREAK_LEAD, "LS and PS");
+static_assert(yaml_char_classes.bits['['] ==
+                  (YAML_CHAR_FLOW | YAML_CHAR_INDICATOR | YAML_CHAR_URI),
+              "'['");
+static_assert(yaml_char_classes.bits['-'] ==
+                  (YAML_CHAR_INDICATOR | YAML_CHAR_ALPHA | YAML_CHAR_URI),
+              "'-'");
+static_assert(yaml_char_classes.bits['f'] == (YAML_CHAR_ALPHA | YAML_CHAR_URI | YAML_CHAR_HEX),
+              "'f'");
+static_assert(yaml_char_classes.bits['7'] ==
+                  (YAML_CHAR_ALPHA | YAML_CHAR_URI | YAML_CHAR_HEX | YAML_CHAR_DIGIT),
+              "'7'");
+static_assert(yaml_char_classes.bits['~'] == YAML_CHAR_URI, "'~'");
+static_assert(yaml_char_classes.bits['.'] == YAML_CHAR_URI, "'.'");
+static_assert(yaml_char_classes.bits[0x80] == 0, "continuation octet");
+
+static inline uint16_t yaml_char_class(uint8_t octet)
+{
+  return yaml_char_classes.bits[octet];
+}
+
+/*
+ * Check for NEL (#x85), LS (#x2028) or PS (#x2029), given that the first
+ * octet is one of their lead octets.
+ */
+static inline bool yaml_is_multibyte_break(const uint8_t* pointer)
+{
+  return (pointer[0] == 0xC2 && pointer[1] == 0x85) ||
+         (pointer[0] == 0xE2 && pointer[1] == 0x80 && (pointer[2] == 0xA8 || pointer[2] == 0xA9));
+}
+
 /*
  * String check operations.
  */
@@ -205,10 +1007,33 @@ bool YamlString::CheckAt(char octet, size_t offset)
  */
 bool YamlString::IsAlphaAt(size_t offset)
 {
-  return ((this->pointer[offset] >= (uint8_t)'0' && this->pointer[offset] <= (uint8_t)'9') ||
-          (this->pointer[offset] >= (uint8_t)'A' && this->pointer[offset] <= (uint8_t)'Z') ||
-          (this->pointer[offset] >= (uint8_t)'a' && this->pointer[offset] <= (uint8_t)'z') ||
-          this->pointer[offset] == '_' || this->pointer[offset] == '-');
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_ALPHA) != 0;
+}
+
+/*
+ * Check if the character at the specified position may appear in a tag URI.
+ */
+bool YamlString::IsUriAt(size_t offset)
+{
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_URI) != 0;
+}
+
+/*
+ * Check if the character at the specified position is one of the flow
+ * indicators ',', '[', ']', '{' and '}'.
+ */
+bool YamlString::IsFlowIndicatorAt(size_t offset)
+{
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_FLOW) != 0;
+}
+
+/*
+ * Check if the character at the specified position is an indicator that may
+ * not start a plain scalar.
+ */
+bool YamlString::IsIndicatorAt(size_t offset)
+{
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_INDICATOR) != 0;
 }
 
 /*
@@ -216,7 +1041,7 @@ bool YamlString::IsAlphaAt(size_t offset)
  */
 bool YamlString::IsDigitAt(size_t offset)
 {
-  return ((this->pointer[offset] >= (uint8_t)'0' && this->pointer[offset] <= (uint8_t)'9'));
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_DIGIT) != 0;
 }
 
 /*
@@ -232,9 +1057,7 @@ uint8_t YamlString::AsDigitAt(size_t offset)
  */
 bool YamlString::IsHexAt(size_t offset)
 {
-  return ((this->pointer[offset] >= (uint8_t)'0' && this->pointer[offset] <= (uint8_t)'9') ||
-          (this->pointer[offset] >= (uint8_t)'A' && this->pointer[offset] <= (uint8_t)'F') ||
-          (this->pointer[offset] >= (uint8_t)'a' && this->pointer[offset] <= (uint8_t)'f'));
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_HEX) != 0;
 }
 
 /*
@@ -315,7 +1138,7 @@ bool YamlString::IsTabAt(size_t offset)
  */
 bool YamlString::IsBlankAt(size_t offset)
 {
-  return (IsSpaceAt(offset) || IsTabAt(offset));
+  return (yaml_char_class(this->pointer[offset]) & YAML_CHAR_BLANK) != 0;
 }
 
 /*
@@ -323,13 +1146,10 @@ bool YamlString::IsBlankAt(size_t offset)
  */
 bool YamlString::IsBreakAt(size_t offset)
 {
-  return (CheckAt('\r', offset)                                       // CR (#xD)
-          || CheckAt('\n', offset)                                    // LF (#xA)
-          || (CheckAt('\xC2', offset) && CheckAt('\x85', offset + 1)) // NEL (#x85)
-          || (CheckAt('\xE2', offset) && CheckAt('\x80', offset + 1) &&
-              CheckAt('\xA8', offset + 2)) // LS (#x2028)
-          || (CheckAt('\xE2', offset) && CheckAt('\x80', offset + 1) &&
-              CheckAt('\xA9', offset + 2))) /* PS (#x2029) */;
+  uint16_t bits = yaml_char_class(this->pointer[offset]);
+
+  if (bits & YAML_CHAR_BREAK) return true; // CR (#xD) or LF (#xA)
+  return (bits & YAML_CHAR_BREAK_LEAD) && yaml_is_multibyte_break(this->pointer + offset);
 }
 
 bool YamlString::IsCrlfAt(size_t offset)
@@ -342,7 +1162,10 @@ bool YamlString::IsCrlfAt(size_t offset)
  */
 bool YamlString::IsBreakOrNulAt(size_t offset)
 {
-  return (IsBreakAt(offset) || IsNulAt(offset));
+  uint16_t bits = yaml_char_class(this->pointer[offset]);
+
+  if (bits & (YAML_CHAR_BREAK | YAML_CHAR_NUL)) return true;
+  return (bits & YAML_CHAR_BREAK_LEAD) && yaml_is_multibyte_break(this->pointer + offset);
 }
 
 /*
@@ -350,7 +1173,10 @@ bool YamlString::IsBreakOrNulAt(size_t offset)
  */
 bool YamlString::IsSpaceOrNulAt(size_t offset)
 {
-  return (IsSpaceAt(offset) || IsBreakOrNulAt(offset));
+  uint16_t bits = yaml_char_class(this->pointer[offset]);
+
+  if (bits & (YAML_CHAR_SPACE | YAML_CHAR_BREAK | YAML_CHAR_NUL)) return true;
+  return (bits & YAML_CHAR_BREAK_LEAD) && yaml_is_multibyte_break(this->pointer + offset);
 }
 
 /*
@@ -358,7 +1184,10 @@ bool YamlString::IsSpaceOrNulAt(size_t offset)
  */
 bool YamlString::IsBlankOrNulAt(size_t offset)
 {
-  return (IsBlankAt(offset) || IsBreakOrNulAt(offset));
+  uint16_t bits = yaml_char_class(this->pointer[offset]);
+
+  if (bits & (YAML_CHAR_BLANK | YAML_CHAR_BREAK | YAML_CHAR_NUL)) return true;
+  return (bits & YAML_CHAR_BREAK_LEAD) && yaml_is_multibyte_break(this->pointer + offset);
 }
 
 /*
@@ -405,6 +1234,142 @@ bool YamlString::COPY(YamlString& string_b)
                                 : 0);
 }
 
+// YamlArena
+
+void* YamlArena::Malloc(YamlParser& parser, size_t size)
+{
+  YamlArenaBlock* block = this->tail;
+  size_t start          = 0;
+
+  if (block)
+  {
+    start = (block->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  }
+
+  // Start a new block if the allocation does not fit.  Oversized allocations
+  // get a block of their own.
+  if (!block || start + size > block->size)
+  {
+    if (this->spare && size <= this->spare->size)
+    {
+      block       = this->spare;
+      this->spare = block->next;
+    }
+    else
+    {
+      size_t block_size = size > this->block_size ? size : this->block_size;
+      block = (YamlArenaBlock*)parser.Malloc(sizeof(YamlArenaBlock) + block_size);
+      if (!block) return nullptr;
+      block->size = block_size;
+    }
+
+    block->next = nullptr;
+    block->used = 0;
+    if (this->tail)
+    {
+      this->tail->next = block;
+    }
+    else
+    {
+      this->head = block;
+    }
+    this->tail = block;
+    start      = 0;
+  }
+
+  this->last  = (uint8_t*)(block + 1) + start;
+  block->used = start + size;
+  this->serial++;
+
+  return this->last;
+}
+
+void* YamlArena::Realloc(YamlParser& parser, void* ptr, size_t old_size, size_t new_size)
+{
+  void* new_ptr;
+
+  // The last allocation can grow in place.
+  if (ptr && ptr == this->last)
+  {
+    size_t start = this->last - (uint8_t*)(this->tail + 1);
+    if (start + new_size <= this->tail->size)
+    {
+      this->tail->used = start + new_size;
+      this->serial++;
+      return ptr;
+    }
+  }
+
+  new_ptr = this->Malloc(parser, new_size);
+  if (new_ptr && ptr)
+  {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  }
+
+  return new_ptr;
+}
+
+YamlArenaMark YamlArena::Mark()
+{
+  YamlArenaMark mark;
+  mark.block  = this->tail;
+  mark.serial = this->serial;
+  return mark;
+}
+
+/*
+ * Release the blocks that were filled before the mark.  If nothing has been
+ * allocated since the mark, the block being filled is emptied as well.
+ */
+void YamlArena::Release(YamlParser& parser, const YamlArenaMark& mark)
+{
+  if (!mark.block) return;
+
+  while (this->head != mark.block)
+  {
+    YamlArenaBlock* block = this->head;
+    this->head            = block->next;
+    this->Recycle(parser, block);
+  }
+
+  if (this->serial == mark.serial)
+  {
+    this->tail->used = 0;
+    this->last       = nullptr;
+  }
+}
+
+void YamlArena::Recycle(YamlParser& parser, YamlArenaBlock* block)
+{
+  if (block->size == this->block_size)
+  {
+    block->next = this->spare;
+    this->spare = block;
+  }
+  else
+  {
+    parser.Free(block);
+  }
+}
+
+void YamlArena::Del(YamlParser& parser)
+{
+  while (this->head)
+  {
+    YamlArenaBlock* block = this->head;
+    this->head            = block->next;
+    parser.Free(block);
+  }
+  while (this->spare)
+  {
+    YamlArenaBlock* block = this->spare;
+    this->spare           = block->next;
+    parser.Free(block);
+  }
+  this->tail = nullptr;
+  this->last = nullptr;
+}
+
 // YamlStack
 
 template <typename T>
@@ -442,7 +1407,7 @@ bool YamlStack<T>::Empty()
 template <typename T>
 bool YamlStack<T>::Limit(YamlParser& parser, size_t size)
 {
-  if ((this->top - this->start) < size)
+  if ((size_t)(this->top - this->start) < size)
   {
     return true;
   }
@@ -509,9 +1474,9 @@ bool YamlQueue<T>::Init(YamlParser& parser, size_t size)
   this->start = (T*)parser.Malloc(size * sizeof(T));
   if (this->start)
   {
-    this->head = this->start;
-    this->tail = this->start;
-    this->end  = this->start + size;
+    this->capacity = size;
+    this->head     = 0;
+    this->tail     = 0;
     return true;
   }
   else
@@ -525,10 +1490,10 @@ template <typename T>
 void YamlQueue<T>::Del(YamlParser& parser)
 {
   parser.Free(this->start);
-  this->start = nullptr;
-  this->head  = nullptr;
-  this->tail  = nullptr;
-  this->end   = nullptr;
+  this->start    = nullptr;
+  this->capacity = 0;
+  this->head     = 0;
+  this->tail     = 0;
 }
 
 template <typename T>
@@ -537,12 +1502,18 @@ bool YamlQueue<T>::Empty()
   return (this->head == this->tail);
 }
 
+template <typename T>
+T& YamlQueue<T>::At(size_t position)
+{
+  return this->start[position & (this->capacity - 1)];
+}
+
 template <typename T>
 bool YamlQueue<T>::Enqueue(YamlParser& parser, T value)
 {
-  if (this->tail != this->end || this->Extend(parser))
+  if (this->tail - this->head != this->capacity || this->Extend(parser))
   {
-    *(this->tail++) = value;
+    this->At(this->tail++) = value;
     return true;
   }
   else
@@ -553,65 +1524,60 @@ bool YamlQueue<T>::Enqueue(YamlParser& parser, T value)
 }
 
 template <typename T>
-T YamlQueue<T>::Dequeue()
+bool YamlQueue<T>::Reserve(YamlParser& parser, size_t count)
 {
-  return *(this->head++);
+  while (this->tail - this->head + count > this->capacity)
+  {
+    if (!this->Extend(parser))
+    {
+      parser.error = EYamlError::Memory;
+      return false;
+    }
+  }
+  this->tail += count;
+  return true;
 }
 
 template <typename T>
-bool YamlQueue<T>::YamlQueue::Insert(YamlParser& parser, size_t index, T value)
+T YamlQueue<T>::Dequeue()
 {
-  if (this->tail != this->end || this->Extend(parser))
-  {
-    memmove(this->head + index + 1, this->head + index,
-            (this->tail - this->head - index) * sizeof(T));
-    *(this->head + index) = value;
-    this->tail++;
-    return true;
-  }
-  else
-  {
-    parser.error = EYamlError::Memory;
-    return false;
-  }
+  return this->At(this->head++);
 }
 
 /*
- * Extend or move a queue.
+ * Double the capacity of a queue.  The items are copied to where their
+ * positions fall in the new buffer.
  */
 template <typename T>
 bool YamlQueue<T>::Extend(YamlParser& parser)
 {
-  // Check if we need to resize the queue.
-  if (this->start == this->head && this->tail == this->end)
-  {
-    T* new_start = (T*)parser.Realloc(this->start, ((char*)this->end - (char*)this->start) * 2);
-
-    if (!new_start)
-    {
-      return false;
-    }
+  size_t capacity = this->capacity ? this->capacity * 2 : INITIAL_QUEUE_SIZE;
+  T* new_start    = (T*)parser.Malloc(capacity * sizeof(T));
+  size_t position;
 
-    this->head  = new_start + (this->head - this->start);
-    this->tail  = new_start + (this->tail - this->start);
-    this->end   = new_start + (this->end - this->start) * 2;
-    this->start = new_start;
+  if (!new_start)
+  {
+    return false;
   }
 
-  // Check if we need to move the queue at the beginning of the buffer.
-  if (this->tail == this->end)
+  for (position = this->head; position != this->tail; position++)
   {
-    if (this->head != this->tail)
-    {
-      memmove(this->start, this->head, (char*)this->tail - (char*)this->head);
-    }
-    this->tail = this->tail - this->head + this->start;
-    this->head = this->start;
+    memcpy((void*)(new_start + (position & (capacity - 1))), (void*)&this->At(position),
+           sizeof(T));
   }
 
+  parser.Free(this->start);
+  this->start    = new_start;
+  this->capacity = capacity;
+
   return true;
 }
 
+// The states of the parser are defined in yaml.hpp, so that ParseWith can be
+// instantiated anywhere, and they push and pop these.
+template struct YamlStack<EYamlParserState>;
+template struct YamlStack<YamlMark>;
+
 // YamlToken
 
 YamlToken YamlToken::Init(EYamlTokenType type, const YamlMark& start_mark, const YamlMark& end_mark)
@@ -638,22 +1604,25 @@ YamlToken YamlToken::InitStreamEnd(const YamlMark& start_mark, const YamlMark& e
   return YamlToken::Init(EYamlTokenType::StreamEnd, start_mark, end_mark);
 }
 
-YamlToken YamlToken::InitAlias(uint8_t* value, const YamlMark& start_mark, const YamlMark& end_mark)
+YamlToken YamlToken::InitAlias(uint8_t* value, const YamlMark& start_mark, const YamlMark& end_mark,
+                               uint64_t number)
 {
   YamlToken token = YamlToken::Init(EYamlTokenType::Alias, start_mark, end_mark);
   alias_t alias;
-  alias.value = value;
-  token.data  = alias;
+  alias.value  = value;
+  alias.number = number;
+  token.data   = alias;
   return token;
 }
 
 YamlToken YamlToken::InitAnchor(uint8_t* value, const YamlMark& start_mark,
-                                const YamlMark& end_mark)
+                                const YamlMark& end_mark, uint64_t number)
 {
   YamlToken token = YamlToken::Init(EYamlTokenType::Anchor, start_mark, end_mark);
   anchor_t anchor;
-  anchor.value = value;
-  token.data   = anchor;
+  anchor.value  = value;
+  anchor.number = number;
+  token.data    = anchor;
   return token;
 }
 
@@ -669,14 +1638,16 @@ YamlToken YamlToken::InitTag(uint8_t* handle, uint8_t* suffix, const YamlMark& s
 }
 
 YamlToken YamlToken::InitScalar(uint8_t* value, size_t length, EYamlScalarStyle style,
-                                const YamlMark& start_mark, const YamlMark& end_mark)
+                                const YamlMark& start_mark, const YamlMark& end_mark,
+                                bool borrowed)
 {
   YamlToken token = YamlToken::Init(EYamlTokenType::Scalar, start_mark, end_mark);
   scalar_t scalar;
-  scalar.value  = value;
-  scalar.length = length;
-  scalar.style  = style;
-  token.data    = scalar;
+  scalar.value    = value;
+  scalar.length   = length;
+  scalar.style    = style;
+  scalar.borrowed = borrowed;
+  token.data      = scalar;
   return token;
 }
 
@@ -758,6 +1729,9 @@ bool YamlParser::DetermineEncoding()
   return true;
 }
 
+static int yaml_string_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                                    size_t* size_read);
+
 /*
  * Update the raw buffer.
  */
@@ -783,9 +1757,19 @@ bool YamlParser::UpdateRawBuffer()
   this->raw_buffer.last -= this->raw_buffer.pointer - this->raw_buffer.start;
   this->raw_buffer.pointer = this->raw_buffer.start;
 
-  // Call the read handler to fill the buffer.
-  if (!this->read_handler(*this, this->raw_buffer.last,
-                          this->raw_buffer.end - this->raw_buffer.last, &size_read))
+  // Start the reader thread before the first read. Input in memory is not
+  // worth a thread.
+  if (this->async_reader && !this->async && this->read_handler != yaml_string_read_handler)
+  {
+    if (!this->StartAsyncReader()) return false;
+  }
+
+  // Call the read handler to fill the buffer, or take what the reader thread
+  // has read.
+  if (this->async ? !this->ReadAsync(this->raw_buffer.last,
+                                     this->raw_buffer.end - this->raw_buffer.last, &size_read)
+                  : !this->read_handler(*this, this->raw_buffer.last,
+                                        this->raw_buffer.end - this->raw_buffer.last, &size_read))
   {
     return this->SetReaderError("input error", this->offset, -1);
   }
@@ -798,6 +1782,200 @@ bool YamlParser::UpdateRawBuffer()
   return true;
 }
 
+/*
+ * Decode the character at the start of a span of raw input and check that it
+ * is allowed in a YAML stream.  If the span ends in the middle of the
+ * character and more input may follow, set 'incomplete' instead.
+ */
+bool YamlParser::DecodeCharacter(const unsigned char* pointer, size_t raw_unread,
+                                 unsigned int& value, unsigned int& width, bool& incomplete)
+{
+  unsigned int value2 = 0;
+  unsigned char octet;
+  int low, high;
+
+  switch (this->encoding)
+  {
+  case EYamlEncoding::Utf8:
+    /*
+     * Decode a UTF-8 character.  Check RFC 3629
+     * (http://www.ietf.org/rfc/rfc3629.txt) for more details.
+     *
+     * The following table (taken from the RFC) is used for
+     * decoding.
+     *
+     *    Char. number range |        UTF-8 octet sequence
+     *      (hexadecimal)    |              (binary)
+     *   --------------------+------------------------------------
+     *   0000 0000-0000 007F | 0xxxxxxx
+     *   0000 0080-0000 07FF | 110xxxxx 10xxxxxx
+     *   0000 0800-0000 FFFF | 1110xxxx 10xxxxxx 10xxxxxx
+     *   0001 0000-0010 FFFF | 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
+     *
+     * Additionally, the characters in the range 0xD800-0xDFFF
+     * are prohibited as they are reserved for use with UTF-16
+     * surrogate pairs.
+     */
+    octet = pointer[0];
+    width = (octet & 0x80) == 0x00
+                ? 1
+                : (octet & 0xE0) == 0xC0
+                      ? 2
+                      : (octet & 0xF0) == 0xE0 ? 3 : (octet & 0xF8) == 0xF0 ? 4 : 0;
+
+    // Check if the leading octet is valid.
+    if (!width)
+    {
+      return this->SetReaderError("invalid leading UTF-8 octet", this->offset, octet);
+    }
+
+    // Check if the raw buffer contains an incomplete character.
+    if (width > raw_unread)
+    {
+      if (this->eof)
+      {
+        return this->SetReaderError("incomplete UTF-8 octet sequence", this->offset, -1);
+      }
+      incomplete = true;
+      return true;
+    }
+
+    // Decode the leading octet.
+    value = (octet & 0x80) == 0x00
+                ? octet & 0x7F
+                : (octet & 0xE0) == 0xC0
+                      ? octet & 0x1F
+                      : (octet & 0xF0) == 0xE0 ? octet & 0x0F
+                                               : (octet & 0xF8) == 0xF0 ? octet & 0x07 : 0;
+
+    // Check and decode the trailing octets.
+    for (size_t k = 1; k < width; k++)
+    {
+      octet = pointer[k];
+
+      // Check if the octet is valid.
+      if ((octet & 0xC0) != 0x80)
+      {
+        return this->SetReaderError("invalid trailing UTF-8 octet", this->offset + k, octet);
+      }
+
+      // Decode the octet.
+      value = (value << 6) + (octet & 0x3F);
+    }
+
+    // Check the length of the sequence against the value.
+    if (!((width == 1) || (width == 2 && value >= 0x80) || (width == 3 && value >= 0x800) ||
+          (width == 4 && value >= 0x10000)))
+      return this->SetReaderError("invalid length of a UTF-8 sequence", this->offset, -1);
+
+    // Check the range of the value.
+    if ((value >= 0xD800 && value <= 0xDFFF) || value > 0x10FFFF)
+      return this->SetReaderError("invalid Unicode character", this->offset, value);
+
+    break;
+
+  case EYamlEncoding::Utf16Le:
+  case EYamlEncoding::Utf16Be:
+
+    low  = (this->encoding == EYamlEncoding::Utf16Le ? 0 : 1);
+    high = (this->encoding == EYamlEncoding::Utf16Le ? 1 : 0);
+
+    /*
+     * The UTF-16 encoding is not as simple as one might
+     * naively think.  Check RFC 2781
+     * (http://www.ietf.org/rfc/rfc2781.txt).
+     *
+     * Normally, two subsequent bytes describe a Unicode
+     * character.  However a special technique (called a
+     * surrogate pair) is used for specifying character
+     * values larger than 0xFFFF.
+     *
+     * A surrogate pair consists of two pseudo-characters:
+     *      high surrogate area (0xD800-0xDBFF)
+     *      low surrogate area (0xDC00-0xDFFF)
+     *
+     * The following formulas are used for decoding
+     * and encoding characters using surrogate pairs:
+     *
+     *  U  = U' + 0x10000   (0x01 00 00 <= U <= 0x10 FF FF)
+     *  U' = yyyyyyyyyyxxxxxxxxxx   (0 <= U' <= 0x0F FF FF)
+     *  W1 = 110110yyyyyyyyyy
+     *  W2 = 110111xxxxxxxxxx
+     *
+     * where U is the character value, W1 is the high surrogate
+     * area, W2 is the low surrogate area.
+     */
+
+    // Check for incomplete UTF-16 character.
+    if (raw_unread < 2)
+    {
+      if (this->eof)
+      {
+        return this->SetReaderError("incomplete UTF-16 character", this->offset, -1);
+      }
+      incomplete = true;
+      return true;
+    }
+
+    // Get the character.
+    value = pointer[low] + (pointer[high] << 8);
+
+    // Check for unexpected low surrogate area.
+    if ((value & 0xFC00) == 0xDC00)
+      return this->SetReaderError("unexpected low surrogate area", this->offset, value);
+
+    // Check for a high surrogate area.
+    if ((value & 0xFC00) == 0xD800)
+    {
+      width = 4;
+
+      // Check for incomplete surrogate pair.
+      if (raw_unread < 4)
+      {
+        if (this->eof)
+        {
+          return this->SetReaderError("incomplete UTF-16 surrogate pair", this->offset, -1);
+        }
+        incomplete = true;
+        return true;
+      }
+
+      // Get the next character.
+      value2 = pointer[low + 2] + (pointer[high + 2] << 8);
+
+      // Check for a low surrogate area.
+      if ((value2 & 0xFC00) != 0xDC00)
+        return this->SetReaderError("expected low surrogate area", this->offset + 2, value2);
+
+      // Generate the value of the surrogate pair.
+      value = 0x10000 + ((value & 0x3FF) << 10) + (value2 & 0x3FF);
+    }
+
+    else
+    {
+      width = 2;
+    }
+
+    break;
+
+  default:
+    assert(1); // Impossible.
+  }
+
+  /*
+   * Check if the character is in the allowed range:
+   *      #x9 | #xA | #xD | [#x20-#x7E]               (8 bit)
+   *      | #x85 | [#xA0-#xD7FF] | [#xE000-#xFFFD]    (16 bit)
+   *      | [#x10000-#x10FFFF]                        (32 bit)
+   */
+  if (!(value == 0x09 || value == 0x0A || value == 0x0D || (value >= 0x20 && value <= 0x7E) ||
+        (value == 0x85) || (value >= 0xA0 && value <= 0xD7FF) ||
+        (value >= 0xE000 && value <= 0xFFFD) || (value >= 0x10000 && value <= 0x10FFFF)))
+    return this->SetReaderError("control characters are not allowed", this->offset, value);
+
+  return true;
+}
+
 bool YamlParser::UpdateBuffer(size_t length)
 {
   bool first = true;
@@ -805,6 +1983,9 @@ bool YamlParser::UpdateBuffer(size_t length)
   // Read handler must be set.
   assert(this->read_handler);
 
+  // In-place input is validated where it lies.
+  if (this->in_place) return this->UpdateBufferInPlace(length);
+
   // If the EOF flag is set and the raw buffer is empty, do nothing.
   if (this->eof && this->raw_buffer.pointer == this->raw_buffer.last) return true;
 
@@ -849,196 +2030,45 @@ bool YamlParser::UpdateBuffer(size_t length)
     // Decode the raw buffer.
     while (this->raw_buffer.pointer != this->raw_buffer.last)
     {
-      unsigned int value = 0, value2 = 0;
-      bool incomplete = false;
-      unsigned char octet;
+      unsigned int value = 0;
       unsigned int width = 0;
-      int low, high;
-      size_t raw_unread = this->raw_buffer.last - this->raw_buffer.pointer;
+      bool incomplete    = false;
 
-      // Decode the next character.
-      switch (this->encoding)
+      // Copy printable ASCII in bulk; anything else goes through the decoder.
+      if (this->encoding == EYamlEncoding::Utf8)
       {
-      case EYamlEncoding::Utf8:
-        /*
-         * Decode a UTF-8 character.  Check RFC 3629
-         * (http://www.ietf.org/rfc/rfc3629.txt) for more details.
-         *
-         * The following table (taken from the RFC) is used for
-         * decoding.
-         *
-         *    Char. number range |        UTF-8 octet sequence
-         *      (hexadecimal)    |              (binary)
-         *   --------------------+------------------------------------
-         *   0000 0000-0000 007F | 0xxxxxxx
-         *   0000 0080-0000 07FF | 110xxxxx 10xxxxxx
-         *   0000 0800-0000 FFFF | 1110xxxx 10xxxxxx 10xxxxxx
-         *   0001 0000-0010 FFFF | 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-         *
-         * Additionally, the characters in the range 0xD800-0xDFFF
-         * are prohibited as they are reserved for use with UTF-16
-         * surrogate pairs.
-         */
-        octet = this->raw_buffer.pointer[0];
-        width = (octet & 0x80) == 0x00
-                    ? 1
-                    : (octet & 0xE0) == 0xC0
-                          ? 2
-                          : (octet & 0xF0) == 0xE0 ? 3 : (octet & 0xF8) == 0xF0 ? 4 : 0;
-
-        // Check if the leading octet is valid.
-        if (!width)
-        {
-          return this->SetReaderError("invalid leading UTF-8 octet", this->offset, octet);
-        }
-
-        // Check if the raw buffer contains an incomplete character.
-        if (width > raw_unread)
-        {
-          if (this->eof)
-          {
-            return this->SetReaderError("incomplete UTF-8 octet sequence", this->offset, -1);
-          }
-          incomplete = true;
-          break;
-        }
-
-        // Decode the leading octet.
-        value = (octet & 0x80) == 0x00
-                    ? octet & 0x7F
-                    : (octet & 0xE0) == 0xC0
-                          ? octet & 0x1F
-                          : (octet & 0xF0) == 0xE0 ? octet & 0x0F
-                                                   : (octet & 0xF8) == 0xF0 ? octet & 0x07 : 0;
-
-        // Check and decode the trailing octets.
-        for (size_t k = 1; k < width; k++)
-        {
-          octet = this->raw_buffer.pointer[k];
-
-          // Check if the octet is valid.
-          if ((octet & 0xC0) != 0x80)
-          {
-            return this->SetReaderError("invalid trailing UTF-8 octet", this->offset + k, octet);
-          }
-
-          // Decode the octet.
-          value = (value << 6) + (octet & 0x3F);
-        }
-
-        // Check the length of the sequence against the value.
-        if (!((width == 1) || (width == 2 && value >= 0x80) || (width == 3 && value >= 0x800) ||
-              (width == 4 && value >= 0x10000)))
-          return this->SetReaderError("invalid length of a UTF-8 sequence", this->offset, -1);
-
-        // Check the range of the value.
-        if ((value >= 0xD800 && value <= 0xDFFF) || value > 0x10FFFF)
-          return this->SetReaderError("invalid Unicode character", this->offset, value);
-
-        break;
-
-      case EYamlEncoding::Utf16Le:
-      case EYamlEncoding::Utf16Be:
-
-        low  = (this->encoding == EYamlEncoding::Utf16Le ? 0 : 1);
-        high = (this->encoding == EYamlEncoding::Utf16Le ? 1 : 0);
-
-        /*
-         * The UTF-16 encoding is not as simple as one might
-         * naively think.  Check RFC 2781
-         * (http://www.ietf.org/rfc/rfc2781.txt).
-         *
-         * Normally, two subsequent bytes describe a Unicode
-         * character.  However a special technique (called a
-         * surrogate pair) is used for specifying character
-         * values larger than 0xFFFF.
-         *
-         * A surrogate pair consists of two pseudo-characters:
-         *      high surrogate area (0xD800-0xDBFF)
-         *      low surrogate area (0xDC00-0xDFFF)
-         *
-         * The following formulas are used for decoding
-         * and encoding characters using surrogate pairs:
-         *
-         *  U  = U' + 0x10000   (0x01 00 00 <= U <= 0x10 FF FF)
-         *  U' = yyyyyyyyyyxxxxxxxxxx   (0 <= U' <= 0x0F FF FF)
-         *  W1 = 110110yyyyyyyyyy
-         *  W2 = 110111xxxxxxxxxx
-         *
-         * where U is the character value, W1 is the high surrogate
-         * area, W2 is the low surrogate area.
-         */
-
-        // Check for incomplete UTF-16 character.
-        if (raw_unread < 2)
-        {
-          if (this->eof)
-          {
-            return this->SetReaderError("incomplete UTF-16 character", this->offset, -1);
-          }
-          incomplete = true;
-          break;
-        }
-
-        // Get the character.
-        value = this->raw_buffer.pointer[low] + (this->raw_buffer.pointer[high] << 8);
-
-        // Check for unexpected low surrogate area.
-        if ((value & 0xFC00) == 0xDC00)
-          return this->SetReaderError("unexpected low surrogate area", this->offset, value);
-
-        // Check for a high surrogate area.
-        if ((value & 0xFC00) == 0xD800)
-        {
-          width = 4;
-
-          // Check for incomplete surrogate pair.
-          if (raw_unread < 4)
-          {
-            if (this->eof)
-            {
-              return this->SetReaderError("incomplete UTF-16 surrogate pair", this->offset, -1);
-            }
-            incomplete = true;
-            break;
-          }
-
-          // Get the next character.
-          value2 = this->raw_buffer.pointer[low + 2] + (this->raw_buffer.pointer[high + 2] << 8);
-
-          // Check for a low surrogate area.
-          if ((value2 & 0xFC00) != 0xDC00)
-            return this->SetReaderError("expected low surrogate area", this->offset + 2, value2);
-
-          // Generate the value of the surrogate pair.
-          value = 0x10000 + ((value & 0x3FF) << 10) + (value2 & 0x3FF);
-        }
-
-        else
-        {
-          width = 2;
-        }
-
-        break;
+        size_t run = yaml_printable_ascii_run(this->raw_buffer.pointer,
+                                              this->raw_buffer.last - this->raw_buffer.pointer);
+        memcpy(this->buffer.last, this->raw_buffer.pointer, run);
+        this->raw_buffer.pointer += run;
+        this->buffer.last += run;
+        this->offset += run;
+        this->unread += run;
+        if (this->raw_buffer.pointer == this->raw_buffer.last) break;
+      }
+      // Transcode UTF-16 outside the surrogate areas in bulk as well.
+      else
+      {
+        size_t run = yaml_utf16_run(this->raw_buffer.pointer,
+                                    (this->raw_buffer.last - this->raw_buffer.pointer) / 2,
+                                    this->encoding == EYamlEncoding::Utf16Be, this->buffer.last);
+        this->raw_buffer.pointer += 2 * run;
+        this->offset += 2 * run;
+        this->unread += run;
+        if (this->raw_buffer.pointer == this->raw_buffer.last) break;
+      }
 
-      default:
-        assert(1); // Impossible.
+      // Decode the next character.
+      if (!this->DecodeCharacter(this->raw_buffer.pointer,
+                                 this->raw_buffer.last - this->raw_buffer.pointer, value, width,
+                                 incomplete))
+      {
+        return false;
       }
 
       // Check if the raw buffer contains enough bytes to form a character.
       if (incomplete) break;
 
-      /*
-       * Check if the character is in the allowed range:
-       *      #x9 | #xA | #xD | [#x20-#x7E]               (8 bit)
-       *      | #x85 | [#xA0-#xD7FF] | [#xE000-#xFFFD]    (16 bit)
-       *      | [#x10000-#x10FFFF]                        (32 bit)
-       */
-      if (!(value == 0x09 || value == 0x0A || value == 0x0D || (value >= 0x20 && value <= 0x7E) ||
-            (value == 0x85) || (value >= 0xA0 && value <= 0xD7FF) ||
-            (value >= 0xE000 && value <= 0xFFFD) || (value >= 0x10000 && value <= 0x10FFFF)))
-        return this->SetReaderError("control characters are not allowed", this->offset, value);
-
       // Move the raw pointers.
       this->raw_buffer.pointer += width;
       this->offset += width;
@@ -1092,10 +2122,144 @@ bool YamlParser::UpdateBuffer(size_t length)
   return true;
 }
 
+/*
+ * Validate more characters of UTF-8 input that is read in place: a mapped
+ * file, or a buffer that scalars are borrowed from.
+ *
+ * The buffer points straight into the input, so the characters are checked
+ * but never copied.  The last few octets of the input are left to the regular
+ * reader: the scanner looks a little past the characters it has cached, and
+ * that must not run off the end of a mapping.  Nothing is validated before
+ * the scanner asks for it, so an invalid octet past a syntax error is never
+ * reported.
+ */
+bool YamlParser::UpdateBufferInPlace(size_t length)
+{
+  size_t tail = this->input.end - this->input.current;
+  if (tail > INPUT_IN_PLACE_TAIL_SIZE) tail = INPUT_IN_PLACE_TAIL_SIZE;
+  const unsigned char* limit = this->input.end - tail;
+
+  // Return if the buffer contains enough characters.
+  if (this->unread >= length) return true;
+
+  // Determine the input encoding if it is not known yet.
+  if (this->encoding == EYamlEncoding::Any)
+  {
+    if (this->input.end - this->input.current >= 2 &&
+        (!memcmp(this->input.current, BOM_UTF16LE, 2) ||
+         !memcmp(this->input.current, BOM_UTF16BE, 2)))
+    {
+      // UTF-16 has to be transcoded, so hand everything to the regular reader.
+      return this->LeaveInPlace() && this->UpdateBuffer(length);
+    }
+
+    // A buffer of the caller is only scanned in place to borrow scalars from
+    // it.  Otherwise the regular reader validates a raw buffer ahead, so that
+    // invalid UTF-8 is reported as early as it always was.
+    if (!this->borrow_scalars && !this->mapped)
+    {
+      return this->LeaveInPlace() && this->UpdateBuffer(length);
+    }
+
+    this->encoding = EYamlEncoding::Utf8;
+    if (this->input.end - this->input.current >= 3 && !memcmp(this->input.current, BOM_UTF8, 3))
+    {
+      this->input.current += 3;
+      this->offset += 3;
+    }
+
+    this->buffer.start   = (uint8_t*)this->input.current;
+    this->buffer.pointer = (uint8_t*)this->input.current;
+    this->buffer.last    = (uint8_t*)this->input.current;
+    this->buffer.end     = (uint8_t*)this->input.end;
+  }
+
+  // Validate characters until the buffer has enough of them.  This goes a
+  // raw buffer's worth at a time, so the regular reader does not read ahead
+  // any further.
+  while (this->unread < length)
+  {
+    // Let the regular reader take over the tail of the input.
+    if (this->input.current >= limit)
+    {
+      return this->LeaveInPlace() && this->UpdateBuffer(length);
+    }
+
+    const unsigned char* chunk = limit;
+    if ((size_t)(limit - this->input.current) > INPUT_RAW_BUFFER_SIZE)
+    {
+      chunk = this->input.current + INPUT_RAW_BUFFER_SIZE;
+    }
+
+    while (this->input.current < chunk)
+    {
+      unsigned int value = 0;
+      unsigned int width = 0;
+      bool incomplete    = false;
+
+      // Take printable ASCII in bulk; anything else goes through the decoder.
+      size_t run = yaml_printable_ascii_run(this->input.current, chunk - this->input.current);
+      this->input.current += run;
+      this->offset += run;
+      this->buffer.last += run;
+      this->unread += run;
+      if (this->input.current == chunk) break;
+
+      // A character that straddles the chunk end still lies before the tail.
+      if (!this->DecodeCharacter(this->input.current, this->input.end - this->input.current,
+                                 value, width, incomplete))
+      {
+        return false;
+      }
+
+      this->input.current += width;
+      this->offset += width;
+      this->buffer.last += width;
+      this->unread++;
+    }
+  }
+
+  if (this->offset >= MAX_FILE_SIZE)
+  {
+    return this->SetReaderError("input is too long", this->offset, -1);
+  }
+
+  return true;
+}
+
+/*
+ * Switch in-place input over to the regular reader.  The characters that have
+ * been validated but not consumed yet are copied into an owned buffer, and the
+ * string read handler continues from the first octet that was not validated.
+ * The buffers that Reset kept from an earlier input are used again.
+ */
+bool YamlParser::LeaveInPlace()
+{
+  const uint8_t* pointer = this->buffer.pointer;
+  size_t size            = this->buffer.last - this->buffer.pointer;
+
+  this->in_place = false;
+
+  this->buffer      = this->kept_buffer;
+  this->kept_buffer = YamlBuffer();
+  if (!this->raw_buffer.start && !this->raw_buffer.Init(*this, INPUT_RAW_BUFFER_SIZE)) return false;
+  if (!this->buffer.start && !this->buffer.Init(*this, INPUT_BUFFER_SIZE)) return false;
+
+  if (size)
+  {
+    memcpy(this->buffer.start, pointer, size);
+    this->buffer.last += size;
+  }
+
+  return true;
+}
+
 // YamlParser
 
 bool YamlParser::Cache(size_t length)
 {
+  assert(length <= MAX_CACHE_LENGTH);
+
   if (this->unread >= length)
   {
     return true;
@@ -1106,10 +2270,62 @@ bool YamlParser::Cache(size_t length)
   }
 }
 
+/*
+ * The reader only notes where the current line starts, so the column is
+ * worked out from that when the scanner needs it.
+ */
+size_t YamlParser::Column()
+{
+  return this->mark.index - this->line_start;
+}
+
+/*
+ * Get the octet offset of the current position in UTF-8 input.  UTF-8 is not
+ * transcoded, so the octets in the buffer are the input's, except for the NUL
+ * that the reader puts at the end.
+ */
+size_t YamlParser::Offset()
+{
+  size_t pending = this->buffer.last - this->buffer.pointer;
+  if (this->eof) pending--;
+
+  return this->offset - pending;
+}
+
+/*
+ * Whether the marks are lazy.  Only UTF-8 input that is in memory as a whole
+ * keeps the octets that ResolveMark counts the lines and the columns in.
+ */
+bool YamlParser::LazyMarks()
+{
+  return this->lazy_marks && this->encoding == EYamlEncoding::Utf8 && this->input.start &&
+         !this->push;
+}
+
+/*
+ * Get the mark of the current position for a token or an error.  Lazy marks
+ * of UTF-8 input are just the octet offset into the input; see ResolveMark.
+ */
+YamlMark YamlParser::Mark()
+{
+  YamlMark mark;
+
+  if (this->LazyMarks())
+  {
+    mark.index = this->Offset();
+    return mark;
+  }
+
+  mark.index  = this->mark.index;
+  mark.line   = this->mark.line;
+  mark.column = this->Column();
+
+  return mark;
+}
+
 void YamlParser::Skip()
 {
   this->mark.index++;
-  this->mark.column++;
   this->unread--;
   this->buffer.pointer += this->buffer.WidthAt();
 }
@@ -1118,16 +2334,17 @@ void YamlParser::SkipLine()
 {
   if (this->buffer.IsCrlfAt())
   {
-    this->mark.index += 2, this->mark.column = 0, this->mark.line++, this->unread -= 2;
+    this->mark.index += 2, this->mark.line++, this->unread -= 2;
+    this->line_start = this->mark.index;
     this->buffer.pointer += 2;
   }
   else if (this->buffer.IsBreakAt())
   {
     this->mark.index++;
-    this->mark.column = 0;
     this->mark.line++;
     this->unread--;
     this->buffer.pointer += this->buffer.WidthAt();
+    this->line_start = this->mark.index;
   }
 }
 
@@ -1136,9 +2353,102 @@ void YamlParser::SkipLine()
  */
 bool YamlParser::Read(YamlString& string)
 {
-  return (string.Extend(*this) ? (string.COPY(this->buffer), this->mark.index++,
-                                  this->mark.column++, this->unread--, 1)
-                               : 0);
+  return (string.Extend(*this)
+              ? (string.COPY(this->buffer), this->mark.index++, this->unread--, 1)
+              : 0);
+}
+
+/*
+ * Copy a run of single-octet characters to a string buffer and advance
+ * pointers.
+ */
+bool YamlParser::ReadRun(YamlString& string, size_t length)
+{
+  // Keep the string NUL-terminated, like JoinString does.
+  while ((size_t)(string.end - string.pointer) <= length)
+  {
+    if (!this->ExtendString(string))
+    {
+      this->error = EYamlError::Memory;
+      return false;
+    }
+  }
+
+  memcpy(string.pointer, this->buffer.pointer, length);
+  string.pointer += length;
+  this->SkipRun(length);
+
+  return true;
+}
+
+/*
+ * Advance pointers past a run of single-octet characters.
+ */
+void YamlParser::SkipRun(size_t length)
+{
+  this->buffer.pointer += length;
+  this->mark.index += length;
+  this->unread -= length;
+}
+
+/*
+ * Copy a scalar value that has been borrowed from the input so far to the
+ * scratch string, once the scanner meets something that the input does not
+ * spell out.
+ */
+bool YamlParser::Unborrow(YamlString& string, const uint8_t* start, size_t length)
+{
+  while (string.end - string.pointer <= (ptrdiff_t)length)
+  {
+    if (!this->ExtendString(string))
+    {
+      this->error = EYamlError::Memory;
+      return false;
+    }
+  }
+
+  memcpy(string.pointer, start, length);
+  string.pointer += length;
+
+  return true;
+}
+
+/*
+ * Empty the scratch strings for a new scalar.  They are allocated for the
+ * first one and only ever grow after that.
+ */
+bool YamlParser::ClearScratch()
+{
+  YamlString* strings[] = {&this->scratch.string, &this->scratch.leading_break,
+                           &this->scratch.trailing_breaks, &this->scratch.whitespaces};
+
+  for (YamlString* string : strings)
+  {
+    if (!string->start && !string->Init(*this, INITIAL_STRING_SIZE)) return false;
+    string->Clear();
+  }
+
+  return true;
+}
+
+/*
+ * Copy the scalar folded in the scratch string out as a value.
+ */
+uint8_t* YamlParser::CopyScratch()
+{
+  size_t length  = this->scratch.string.pointer - this->scratch.string.start;
+  uint8_t* value = (uint8_t*)this->ValueMalloc(length + 1);
+
+  if (!value)
+  {
+    this->error = EYamlError::Memory;
+    return nullptr;
+  }
+
+  memcpy(value, this->scratch.string.start, length);
+  value[length] = '\0';
+
+  return value;
 }
 
 /*
@@ -1150,18 +2460,18 @@ bool YamlParser::ReadLine(YamlString& string)
               ? (((this->buffer.CheckAt('\r', 0) && this->buffer.CheckAt('\n', 1))
                       ? // CR LF -> LF
                       (*((string).pointer++) = (uint8_t)'\n', this->buffer.pointer += 2,
-                       this->mark.index += 2, this->mark.column = 0, this->mark.line++,
-                       this->unread -= 2)
+                       this->mark.index += 2, this->line_start = this->mark.index,
+                       this->mark.line++, this->unread -= 2)
                       : (this->buffer.CheckAt('\r', 0) || this->buffer.CheckAt('\n', 0))
                             ? // CR|LF -> LF
                             (*((string).pointer++) = (uint8_t)'\n', this->buffer.pointer++,
-                             this->mark.index++, this->mark.column = 0, this->mark.line++,
-                             this->unread--)
+                             this->mark.index++, this->line_start = this->mark.index,
+                             this->mark.line++, this->unread--)
                             : (this->buffer.CheckAt('\xC2', 0) && this->buffer.CheckAt('\x85', 1))
                                   ? // NEL -> LF
                                   (*((string).pointer++) = (uint8_t)'\n', this->buffer.pointer += 2,
-                                   this->mark.index++, this->mark.column = 0, this->mark.line++,
-                                   this->unread--)
+                                   this->mark.index++, this->line_start = this->mark.index,
+                                   this->mark.line++, this->unread--)
                                   : (this->buffer.CheckAt('\xE2', 0) &&
                                      this->buffer.CheckAt('\x80', 1) &&
                                      (this->buffer.CheckAt('\xA8', 2) ||
@@ -1170,7 +2480,7 @@ bool YamlParser::ReadLine(YamlString& string)
                                         (*((string).pointer++) = *(this->buffer.pointer++),
                                          *((string).pointer++) = *(this->buffer.pointer++),
                                          *((string).pointer++) = *(this->buffer.pointer++),
-                                         this->mark.index++, this->mark.column = 0,
+                                         this->mark.index++, this->line_start = this->mark.index,
                                          this->mark.line++, this->unread--)
                                         : 0),
                  1)
@@ -1196,7 +2506,10 @@ bool YamlParser::Scan(YamlToken& token)
   {
     if (!this->FetchMoreTokens())
     {
-      return false;
+      // Leave the token empty until more input is fed.
+      if (!this->starved) return false;
+      this->starved = false;
+      return true;
     }
   }
 
@@ -1205,9 +2518,15 @@ bool YamlParser::Scan(YamlToken& token)
   this->token_available = false;
   this->tokens_parsed++;
 
+  if (token.type == EYamlTokenType::DocumentStart)
+  {
+    this->ReleaseDocumentValues(false);
+  }
+
   if (token.type == EYamlTokenType::StreamEnd)
   {
     this->stream_end_produced = true;
+    this->ReleaseDocumentValues(true);
 
     // Clear tag directives stack
     while (!this->tag_directives.Empty())
@@ -1221,6 +2540,52 @@ bool YamlParser::Scan(YamlToken& token)
   return true;
 }
 
+/*
+ * Remember where the values of a new document start in the arena.  The marks
+ * are queued because the scanner may run ahead of the parser.
+ */
+bool YamlParser::SaveDocumentMark()
+{
+  if (!this->arena.block_size || this->in_directives || this->keep_values) return true;
+
+  return this->document_marks.Enqueue(*this, this->arena.Mark());
+}
+
+/*
+ * Release the values of the documents before the one that is starting, or of
+ * all documents at the end of the stream.
+ */
+void YamlParser::ReleaseDocumentValues(bool stream_end)
+{
+  if (!this->arena.block_size || this->keep_values) return;
+
+  if (stream_end)
+  {
+    this->arena.Release(*this, this->arena.Mark());
+    this->document_marks.head = this->document_marks.tail;
+  }
+  else if (!this->document_marks.Empty())
+  {
+    this->arena.Release(*this, this->document_marks.Dequeue());
+  }
+}
+
+/*
+ * Fill in the lines and the columns of the marks of an error once, if the
+ * marks are lazy.  A mark that cannot be resolved for want of memory keeps
+ * only its offset, and the error stays the one that was set.
+ */
+void YamlParser::ResolveErrorMarks()
+{
+  EYamlError error = this->error;
+
+  if (!this->LazyMarks()) return;
+
+  this->ResolveMark(this->problem_mark);
+  this->ResolveMark(this->context_mark);
+  this->error = error;
+}
+
 /*
  * Set the scanner error and return false.
  */
@@ -1230,7 +2595,9 @@ bool YamlParser::SetScannerError(const char* context, YamlMark context_mark, con
   this->context      = context;
   this->context_mark = context_mark;
   this->problem      = problem;
-  this->problem_mark = this->mark;
+  this->problem_mark = this->Mark();
+
+  this->ResolveErrorMarks();
 
   return false;
 }
@@ -1249,27 +2616,36 @@ bool YamlParser::FetchMoreTokens()
     // Check if we really need to fetch more tokens.
     need_more_tokens = false;
 
-    if (this->tokens.head == this->tokens.tail)
+    if (this->tokens.Empty())
     {
       // Queue is empty.
       need_more_tokens = true;
     }
     else
     {
-      YamlSimpleKey* simple_key;
-
       // Check if any potential simple key may occupy the head position.
       if (!this->StaleSimpleKeys())
       {
         return false;
       }
 
-      for (simple_key = this->simple_keys.start; simple_key != this->simple_keys.top; simple_key++)
+      /*
+       * Only a slot kept for a simple key can be waiting on one, and only the
+       * oldest possible key can own the slot at the head.  Wait for the key
+       * while it is possible, and drop the slot once it is not.
+       */
+      if (this->tokens.At(this->tokens.head).type == EYamlTokenType::None)
       {
-        if (simple_key->possible && simple_key->token_number == this->tokens_parsed)
+        YamlSimpleKey* simple_key = this->simple_keys.start + this->oldest_simple_key;
+
+        if (simple_key != this->simple_keys.top && simple_key->token_number == this->tokens.head)
         {
           need_more_tokens = true;
-          break;
+        }
+        else
+        {
+          this->tokens.head++;
+          continue;
         }
       }
     }
@@ -1277,6 +2653,14 @@ bool YamlParser::FetchMoreTokens()
     // We are finished.
     if (!need_more_tokens) break;
 
+    // Input that is fed in pieces is only scanned up to the last document
+    // indicator line, where every token ends, until it is finished.
+    if (this->push && !this->pushed.finished && this->Offset() >= this->pushed.limit)
+    {
+      this->starved = true;
+      return false;
+    }
+
     // Fetch the next token.
     if (!this->FetchNextToken())
     {
@@ -1316,7 +2700,7 @@ bool YamlParser::FetchNextToken()
   }
 
   // Check the indentation level against the current column.
-  if (!this->UnrollIndent(this->mark.column))
+  if (!this->UnrollIndent(this->Column()))
   {
     return false;
   }
@@ -1334,15 +2718,15 @@ bool YamlParser::FetchNextToken()
   if (this->buffer.IsNulAt()) return this->FetchStreamEnd();
 
   // Is it a directive?
-  if (this->mark.column == 0 && this->buffer.CheckAt('%')) return this->FetchDirective();
+  if (this->Column() == 0 && this->buffer.CheckAt('%')) return this->FetchDirective();
 
   // Is it the document start indicator?
-  if (this->mark.column == 0 && this->buffer.CheckAt('-', 0) && this->buffer.CheckAt('-', 1) &&
+  if (this->Column() == 0 && this->buffer.CheckAt('-', 0) && this->buffer.CheckAt('-', 1) &&
       this->buffer.CheckAt('-', 2) && this->buffer.IsBlankOrNulAt(3))
     return this->FetchDocumentIndicator(EYamlTokenType::DocumentStart);
 
   // Is it the document end indicator?
-  if (this->mark.column == 0 && this->buffer.CheckAt('.', 0) && this->buffer.CheckAt('.', 1) &&
+  if (this->Column() == 0 && this->buffer.CheckAt('.', 0) && this->buffer.CheckAt('.', 1) &&
       this->buffer.CheckAt('.', 2) && this->buffer.IsBlankOrNulAt(3))
     return this->FetchDocumentIndicator(EYamlTokenType::DocumentEnd);
 
@@ -1415,13 +2799,7 @@ bool YamlParser::FetchNextToken()
    *
    * The last rule is more restrictive than the specification requires.
    */
-  if (!(this->buffer.IsBlankOrNulAt() || this->buffer.CheckAt('-') || this->buffer.CheckAt('?') ||
-        this->buffer.CheckAt(':') || this->buffer.CheckAt(',') || this->buffer.CheckAt('[') ||
-        this->buffer.CheckAt(']') || this->buffer.CheckAt('{') || this->buffer.CheckAt('}') ||
-        this->buffer.CheckAt('#') || this->buffer.CheckAt('&') || this->buffer.CheckAt('*') ||
-        this->buffer.CheckAt('!') || this->buffer.CheckAt('|') || this->buffer.CheckAt('>') ||
-        this->buffer.CheckAt('\'') || this->buffer.CheckAt('"') || this->buffer.CheckAt('%') ||
-        this->buffer.CheckAt('@') || this->buffer.CheckAt('`')) ||
+  if (!(this->buffer.IsBlankOrNulAt() || this->buffer.IsIndicatorAt()) ||
       (this->buffer.CheckAt('-') && !this->buffer.IsBlankAt(1)) ||
       (!this->flow_level && (this->buffer.CheckAt('?') || this->buffer.CheckAt(':')) &&
        !this->buffer.IsBlankOrNulAt(1)))
@@ -1430,39 +2808,47 @@ bool YamlParser::FetchNextToken()
   /*
    * If we don't determine the token type so far, it is an error.
    */
-  return this->SetScannerError("while scanning for the next token", this->mark,
+  return this->SetScannerError("while scanning for the next token", this->Mark(),
                                "found character that cannot start any token");
 }
 
 /*
  * Check the list of potential simple keys and remove the positions that
  * cannot contain simple keys anymore.
+ *
+ * The keys are checked from the oldest possible one, and the check stops at
+ * the first one that is still possible: the keys above it start after it.
+ * 'oldest_simple_key' only moves back when a key is saved or a level is
+ * removed, so this is constant work per token on average, however deep the
+ * flow collections are nested.
  */
 bool YamlParser::StaleSimpleKeys()
 {
-  YamlSimpleKey* simple_key;
+  YamlSimpleKey* simple_key = this->simple_keys.start + this->oldest_simple_key;
 
-  // Check for a potential simple key for each flow level.
-  for (simple_key = this->simple_keys.start; simple_key != this->simple_keys.top; simple_key++)
+  for (; simple_key != this->simple_keys.top; simple_key++, this->oldest_simple_key++)
   {
+    if (!simple_key->possible) continue;
+
     /*
      * The specification requires that a simple key
      *
      *  - is limited to a single line,
      *  - is shorter than 1024 characters.
      */
-    if (simple_key->possible && (simple_key->mark.line < this->mark.line ||
-                                 simple_key->mark.index + 1024 < this->mark.index))
+    if (simple_key->index >= this->line_start && simple_key->index + 1024 >= this->mark.index)
     {
-      // Check if the potential simple key to be removed is required.
-      if (simple_key->required)
-      {
-        return this->SetScannerError("while scanning a simple key", simple_key->mark,
-                                     "could not find expected ':'");
-      }
+      break;
+    }
 
-      simple_key->possible = false;
+    // Check if the potential simple key to be removed is required.
+    if (simple_key->required)
+    {
+      return this->SetScannerError("while scanning a simple key", simple_key->mark,
+                                   "could not find expected ':'");
     }
+
+    simple_key->possible = false;
   }
 
   return true;
@@ -1479,7 +2865,7 @@ bool YamlParser::SaveSimpleKey()
    * the block context and the current column coincides with the indentation
    * level.
    */
-  int required = (!this->flow_level && this->indent == (ptrdiff_t)this->mark.column);
+  int required = (!this->flow_level && this->indent == (ptrdiff_t)this->Column());
 
   /*
    * If the current position may start a simple key, save it.
@@ -1487,19 +2873,43 @@ bool YamlParser::SaveSimpleKey()
   if (this->simple_key_allowed)
   {
     YamlSimpleKey simple_key;
+    size_t slots;
+
     simple_key.possible     = true;
     simple_key.required     = required;
-    simple_key.token_number = this->tokens_parsed + (this->tokens.tail - this->tokens.head);
-    simple_key.mark         = this->mark;
+    simple_key.token_number = this->tokens.tail;
+    simple_key.index        = this->mark.index;
+    simple_key.column       = this->Column();
+    simple_key.mark         = this->Mark();
 
     if (!this->RemoveSimpleKey())
     {
       return false;
     }
 
-    *(this->simple_keys.top - 1) = simple_key;
-  }
-
+    /*
+     * Keep a slot in the queue for the KEY token, and one before it for the
+     * BLOCK-MAPPING-START token if the key would open a block mapping, so
+     * that FetchValue does not have to insert them.  The slots are dropped
+     * if no key is found.
+     */
+    slots = this->OpensMapping(simple_key.column) ? 2 : 1;
+    if (!this->tokens.Reserve(*this, slots))
+    {
+      return false;
+    }
+    for (size_t k = 0; k < slots; k++)
+    {
+      this->tokens.At(simple_key.token_number + k).type = EYamlTokenType::None;
+    }
+
+    *(this->simple_keys.top - 1) = simple_key;
+    if (this->oldest_simple_key > (size_t)this->flow_level)
+    {
+      this->oldest_simple_key = this->flow_level;
+    }
+  }
+
   return true;
 }
 
@@ -1531,7 +2941,7 @@ bool YamlParser::RemoveSimpleKey()
  */
 bool YamlParser::IncreaseFlowLevel()
 {
-  YamlSimpleKey empty_simple_key = {0, 0, 0, {0, 0, 0}};
+  YamlSimpleKey empty_simple_key = {0, 0, 0, 0, 0, {0, 0, 0}};
 
   // Reset the simple key on the next level.
   if (!this->simple_keys.Push(*this, empty_simple_key))
@@ -1560,11 +2970,24 @@ bool YamlParser::DecreaseFlowLevel()
   {
     this->flow_level--;
     (void)this->simple_keys.Pop();
+    if (this->oldest_simple_key > (size_t)this->flow_level + 1)
+    {
+      this->oldest_simple_key = this->flow_level + 1;
+    }
   }
 
   return true;
 }
 
+/*
+ * Check if a key at the given column would open a block mapping, that is if
+ * RollIndent would add a BLOCK-MAPPING-START token for it.
+ */
+bool YamlParser::OpensMapping(ptrdiff_t column) const
+{
+  return !this->flow_level && this->indent < column;
+}
+
 /*
  * Push the current indentation level to the stack and set the new level
  * the current column is greater than the indentation level.  In this case,
@@ -1598,7 +3021,8 @@ bool YamlParser::RollIndent(ptrdiff_t column, ptrdiff_t number, EYamlTokenType t
 
     this->indent = (int)column;
 
-    // Create a token and insert it into the queue.
+    // Create a token and append it to the queue, or put it in the slot that
+    // was kept for it.
     YamlToken token = YamlToken::Init(type, mark, mark);
 
     if (number == -1)
@@ -1608,9 +3032,16 @@ bool YamlParser::RollIndent(ptrdiff_t column, ptrdiff_t number, EYamlTokenType t
         return false;
       }
     }
-    else if (!this->tokens.Insert(*this, number - this->tokens_parsed, token))
+    else
     {
-      return false;
+      assert(this->tokens.At(number).type == EYamlTokenType::None);
+      this->tokens.At(number) = token;
+    }
+
+    // Count the collection if it is opened by a skipped node.
+    if (this->skipping)
+    {
+      this->skip_depth++;
     }
   }
 
@@ -1636,7 +3067,7 @@ bool YamlParser::UnrollIndent(ptrdiff_t column)
   while (this->indent > column)
   {
     // Create a token and append it to the queue.
-    YamlToken token = YamlToken::Init(EYamlTokenType::BlockEnd, this->mark, this->mark);
+    YamlToken token = YamlToken::Init(EYamlTokenType::BlockEnd, this->Mark(), this->Mark());
 
     if (!this->tokens.Enqueue(*this, token))
     {
@@ -1645,6 +3076,11 @@ bool YamlParser::UnrollIndent(ptrdiff_t column)
 
     // Pop the indentation level.
     this->indent = this->indents.Pop();
+
+    if (this->skip_depth > 0)
+    {
+      this->skip_depth--;
+    }
   };
 
   return true;
@@ -1655,7 +3091,7 @@ bool YamlParser::UnrollIndent(ptrdiff_t column)
  */
 bool YamlParser::FetchStreamStart()
 {
-  YamlSimpleKey simple_key = {0, 0, 0, {0, 0, 0}};
+  YamlSimpleKey simple_key = {0, 0, 0, 0, 0, {0, 0, 0}};
 
   // Set the initial indentation.
   this->indent = -1;
@@ -1673,7 +3109,7 @@ bool YamlParser::FetchStreamStart()
   this->stream_start_produced = true;
 
   // Create the STREAM-START token and append it to the queue.
-  YamlToken token = YamlToken::InitStreamStart(this->encoding, this->mark, this->mark);
+  YamlToken token = YamlToken::InitStreamStart(this->encoding, this->Mark(), this->Mark());
 
   if (!this->tokens.Enqueue(*this, token))
   {
@@ -1689,9 +3125,9 @@ bool YamlParser::FetchStreamStart()
 bool YamlParser::FetchStreamEnd()
 {
   // Force new line.
-  if (this->mark.column != 0)
+  if (this->Column() != 0)
   {
-    this->mark.column = 0;
+    this->line_start = this->mark.index;
     this->mark.line++;
   }
 
@@ -1710,7 +3146,7 @@ bool YamlParser::FetchStreamEnd()
   this->simple_key_allowed = false;
 
   // Create the STREAM-END token and append it to the queue.
-  YamlToken token = YamlToken::InitStreamEnd(this->mark, this->mark);
+  YamlToken token = YamlToken::InitStreamEnd(this->Mark(), this->Mark());
 
   if (!this->tokens.Enqueue(*this, token))
   {
@@ -1741,6 +3177,13 @@ bool YamlParser::FetchDirective()
 
   this->simple_key_allowed = false;
 
+  // The first directive starts a new document.
+  if (!this->SaveDocumentMark())
+  {
+    return false;
+  }
+  this->in_directives = true;
+
   // Create the YAML-DIRECTIVE or TAG-DIRECTIVE token.
   if (!this->ScanDirective(token))
   {
@@ -1778,14 +3221,21 @@ bool YamlParser::FetchDocumentIndicator(EYamlTokenType type)
 
   this->simple_key_allowed = false;
 
+  // A DOCUMENT-START that does not follow directives starts a new document.
+  if (type == EYamlTokenType::DocumentStart && !this->SaveDocumentMark())
+  {
+    return false;
+  }
+  this->in_directives = false;
+
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   this->Skip();
   this->Skip();
   this->Skip();
 
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the DOCUMENT-START or DOCUMENT-END token.
   YamlToken token = YamlToken::Init(type, start_mark, end_mark);
@@ -1818,13 +3268,19 @@ bool YamlParser::FetchFlowCollectionStart(EYamlTokenType type)
     return false;
   }
 
+  // Count the collection if it is opened by a skipped node.
+  if (this->skipping)
+  {
+    this->skip_depth++;
+  }
+
   // A simple key may follow the indicators '[' and '{'.
   this->simple_key_allowed = true;
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the FLOW-SEQUENCE-START of FLOW-MAPPING-START token.
   YamlToken token = YamlToken::Init(type, start_mark, end_mark);
@@ -1857,13 +3313,18 @@ bool YamlParser::FetchFlowCollectionEnd(EYamlTokenType type)
     return false;
   }
 
+  if (this->skip_depth > 0)
+  {
+    this->skip_depth--;
+  }
+
   // No simple keys after the indicators ']' and '}'.
   this->simple_key_allowed = false;
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the FLOW-SEQUENCE-END of FLOW-MAPPING-END token.
   YamlToken token = YamlToken::Init(type, start_mark, end_mark);
@@ -1894,9 +3355,9 @@ bool YamlParser::FetchFlowEntry()
   this->simple_key_allowed = true;
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the FLOW-ENTRY token and append it to the queue.
   YamlToken token = YamlToken::Init(EYamlTokenType::FlowEntry, start_mark, end_mark);
@@ -1922,12 +3383,12 @@ bool YamlParser::FetchBlockEntry()
     // Check if we are allowed to start a new entry.
     if (!this->simple_key_allowed)
     {
-      return this->SetScannerError(nullptr, this->mark,
+      return this->SetScannerError(nullptr, this->Mark(),
                                    "block sequence entries are not allowed in this context");
     }
 
     // Add the BLOCK-SEQUENCE-START token if needed.
-    if (!this->RollIndent(this->mark.column, -1, EYamlTokenType::BlockSequenceStart, this->mark))
+    if (!this->RollIndent(this->Column(), -1, EYamlTokenType::BlockSequenceStart, this->Mark()))
       return false;
   }
   else
@@ -1949,9 +3410,9 @@ bool YamlParser::FetchBlockEntry()
   this->simple_key_allowed = true;
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the BLOCK-ENTRY token and append it to the queue.
   YamlToken token = YamlToken::Init(EYamlTokenType::BlockEntry, start_mark, end_mark);
@@ -1977,12 +3438,12 @@ bool YamlParser::FetchKey()
     // Check if we are allowed to start a new key (not necessary simple).
     if (!this->simple_key_allowed)
     {
-      return this->SetScannerError(nullptr, this->mark,
+      return this->SetScannerError(nullptr, this->Mark(),
                                    "mapping keys are not allowed in this context");
     }
 
     // Add the BLOCK-MAPPING-START token if needed.
-    if (!this->RollIndent(this->mark.column, -1, EYamlTokenType::BlockMappingStart, this->mark))
+    if (!this->RollIndent(this->Column(), -1, EYamlTokenType::BlockMappingStart, this->Mark()))
     {
       return false;
     }
@@ -1998,9 +3459,9 @@ bool YamlParser::FetchKey()
   this->simple_key_allowed = (!this->flow_level);
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the KEY token and append it to the queue.
   YamlToken token = YamlToken::Init(EYamlTokenType::Key, start_mark, end_mark);
@@ -2024,19 +3485,24 @@ bool YamlParser::FetchValue()
   // Have we found a simple key?
   if (simple_key->possible)
   {
-    // Create the KEY token and insert it into the queue.
-    YamlToken token = YamlToken::Init(EYamlTokenType::Key, simple_key->mark, simple_key->mark);
-
-    if (!this->tokens.Insert(*this, simple_key->token_number - this->tokens_parsed, token))
-      return false;
+    // Put the KEY token in the slot that was kept for it, after the one for
+    // BLOCK-MAPPING-START if there is one.
+    size_t number = simple_key->token_number;
 
-    // In the block context, we may need to add the BLOCK-MAPPING-START token.
-    if (!this->RollIndent(simple_key->mark.column, simple_key->token_number,
-                          EYamlTokenType::BlockMappingStart, simple_key->mark))
+    if (this->OpensMapping(simple_key->column))
     {
-      return false;
+      // In the block context, we may need to add the BLOCK-MAPPING-START token.
+      if (!this->RollIndent(simple_key->column, number, EYamlTokenType::BlockMappingStart,
+                            simple_key->mark))
+      {
+        return false;
+      }
+      number++;
     }
 
+    this->tokens.At(number) =
+        YamlToken::Init(EYamlTokenType::Key, simple_key->mark, simple_key->mark);
+
     // Remove the simple key.
     simple_key->possible = false;
 
@@ -2053,12 +3519,12 @@ bool YamlParser::FetchValue()
       // Check if we are allowed to start a complex value.
       if (!this->simple_key_allowed)
       {
-        return this->SetScannerError(nullptr, this->mark,
+        return this->SetScannerError(nullptr, this->Mark(),
                                      "mapping values are not allowed in this context");
       }
 
       // Add the BLOCK-MAPPING-START token if needed.
-      if (!this->RollIndent(this->mark.column, -1, EYamlTokenType::BlockMappingStart, this->mark))
+      if (!this->RollIndent(this->Column(), -1, EYamlTokenType::BlockMappingStart, this->Mark()))
       {
         return false;
       }
@@ -2069,9 +3535,9 @@ bool YamlParser::FetchValue()
   }
 
   // Consume the token.
-  start_mark = this->mark;
+  start_mark = this->Mark();
   this->Skip();
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create the VALUE token and append it to the queue.
   YamlToken token = YamlToken::Init(EYamlTokenType::Value, start_mark, end_mark);
@@ -2243,6 +3709,9 @@ bool YamlParser::FetchPlainScalar()
  */
 bool YamlParser::ScanToNextToken()
 {
+  bool tabs;
+  size_t run;
+
   // Until the next token is not found.
   while (1)
   {
@@ -2252,7 +3721,7 @@ bool YamlParser::ScanToNextToken()
       return false;
     }
 
-    if (this->mark.column == 0 && this->buffer.IsBomAt())
+    if (this->Column() == 0 && this->buffer.IsBomAt())
     {
       this->Skip();
     }
@@ -2271,10 +3740,13 @@ bool YamlParser::ScanToNextToken()
       return false;
     }
 
-    while (this->buffer.CheckAt(' ') ||
-           ((this->flow_level || !this->simple_key_allowed) && this->buffer.CheckAt('\t')))
+    tabs = this->flow_level || !this->simple_key_allowed;
+
+    while (this->buffer.CheckAt(' ') || (tabs && this->buffer.CheckAt('\t')))
     {
-      this->Skip();
+      // Blanks are single octets, so the whole run in the buffer goes at once.
+      this->SkipRun(
+          yaml_blank_run(this->buffer.pointer, this->buffer.last - this->buffer.pointer, tabs));
       if (!this->Cache(1))
       {
         return false;
@@ -2286,7 +3758,17 @@ bool YamlParser::ScanToNextToken()
     {
       while (!this->buffer.IsBreakOrNulAt())
       {
-        this->Skip();
+        // Skip the run of single-octet characters in one step, and anything
+        // else one character at a time.
+        run = yaml_comment_run(this->buffer.pointer, this->buffer.last - this->buffer.pointer);
+        if (run)
+        {
+          this->SkipRun(run);
+        }
+        else
+        {
+          this->Skip();
+        }
         if (!this->Cache(1))
         {
           return false;
@@ -2336,7 +3818,7 @@ bool YamlParser::ScanDirective(YamlToken& token)
   uint8_t *handle = nullptr, *prefix = nullptr;
 
   // Eat '%'.
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   this->Skip();
 
@@ -2349,7 +3831,7 @@ bool YamlParser::ScanDirective(YamlToken& token)
     // Scan the VERSION directive value.
     if (!this->ScanVersionDirectiveValue(start_mark, &major, &minor)) goto error;
 
-    end_mark = this->mark;
+    end_mark = this->Mark();
 
     // Create a VERSION-DIRECTIVE token.
     token = YamlToken::InitVersionDirective(major, minor, start_mark, end_mark);
@@ -2361,7 +3843,7 @@ bool YamlParser::ScanDirective(YamlToken& token)
     // Scan the TAG directive value.
     if (!this->ScanTagDirectiveValue(start_mark, &handle, &prefix)) goto error;
 
-    end_mark = this->mark;
+    end_mark = this->Mark();
 
     // Create a TAG-DIRECTIVE token.
     token = YamlToken::InitTagDirective(handle, prefix, start_mark, end_mark);
@@ -2412,8 +3894,8 @@ bool YamlParser::ScanDirective(YamlToken& token)
   return true;
 
 error:
-  this->Free(prefix);
-  this->Free(handle);
+  this->ValueFree(prefix);
+  this->ValueFree(handle);
   this->Free(name);
   return false;
 }
@@ -2458,7 +3940,8 @@ bool YamlParser::ScanDirectiveName(YamlMark start_mark, uint8_t** name)
     goto error;
   }
 
-  *name = string.start;
+  *string.pointer = '\0';
+  *name           = string.start;
 
   return true;
 
@@ -2628,35 +4111,73 @@ bool YamlParser::ScanTagDirectiveValue(YamlMark start_mark, uint8_t** handle, ui
   return true;
 
 error:
-  this->Free(handle_value);
-  this->Free(prefix_value);
+  this->ValueFree(handle_value);
+  this->ValueFree(prefix_value);
   return false;
 }
 
 bool YamlParser::ScanAnchor(YamlToken& token, EYamlTokenType type)
 {
-  int length = 0;
+  int length      = 0;
+  uint64_t number = 0;
+  bool numeric    = false;
+  bool discarding = this->skipping && this->skip_depth > 0;
   YamlMark start_mark, end_mark;
   YamlString string;
 
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
-
   // Eat the indicator character.
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   this->Skip();
 
-  // Consume the value.
-  if (!this->Cache(1)) goto error;
+  // Look for a decimal number without a leading zero that fits in 64 bits,
+  // which is taken as it is instead of being copied.
+  if (this->numeric_anchors)
+  {
+    for (;;)
+    {
+      uint8_t digit;
+
+      if (!this->Cache(length + 1)) goto error;
+      if (!this->buffer.IsDigitAt(length)) break;
+      digit = this->buffer.AsDigitAt(length);
+      if ((length && !number) || number > (UINT64_MAX - digit) / 10) break;
+      number = number * 10 + digit;
+      length++;
+    }
+    numeric = length && !this->buffer.IsAlphaAt(length);
+  }
 
-  while (this->buffer.IsAlphaAt())
+  // Consume the value.
+  if (numeric)
   {
-    if (!this->Read(string)) goto error;
+    this->SkipRun(length);
+  }
+  else
+  {
+    length = 0;
+    number = 0;
+    if (!discarding && !string.InitValue(*this, INITIAL_STRING_SIZE)) goto error;
     if (!this->Cache(1)) goto error;
-    length++;
+
+    // The anchors inside a skipped node are not copied out.
+    while (this->buffer.IsAlphaAt())
+    {
+      if (discarding)
+      {
+        this->Skip();
+      }
+      else if (!this->Read(string))
+      {
+        goto error;
+      }
+      if (!this->Cache(1)) goto error;
+      length++;
+    }
+    if (!discarding) *string.pointer = '\0';
   }
 
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   /*
    * Check if length of the anchor is greater than 0 and it is followed by
@@ -2678,11 +4199,11 @@ bool YamlParser::ScanAnchor(YamlToken& token, EYamlTokenType type)
   // Create a token.
   if (type == EYamlTokenType::Anchor)
   {
-    token = YamlToken::InitAnchor(string.start, start_mark, end_mark);
+    token = YamlToken::InitAnchor(string.start, start_mark, end_mark, number);
   }
   else
   {
-    token = YamlToken::InitAlias(string.start, start_mark, end_mark);
+    token = YamlToken::InitAlias(string.start, start_mark, end_mark, number);
   }
 
   return true;
@@ -2701,7 +4222,7 @@ bool YamlParser::ScanTag(YamlToken& token)
   uint8_t* suffix = nullptr;
   YamlMark start_mark, end_mark;
 
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   // Check if the tag is in the canonical form.
   if (!this->Cache(2)) goto error;
@@ -2709,7 +4230,7 @@ bool YamlParser::ScanTag(YamlToken& token)
   if (this->buffer.CheckAt('<', 1))
   {
     // Set the handle to ''
-    handle = (decltype(handle))this->Malloc(1);
+    handle = (decltype(handle))this->ValueMalloc(1);
     if (!handle) goto error;
     handle[0] = '\0';
 
@@ -2748,8 +4269,8 @@ bool YamlParser::ScanTag(YamlToken& token)
       if (!this->ScanTagUri(0, handle, start_mark, &suffix)) goto error;
 
       // Set the handle to '!'.
-      this->Free(handle);
-      handle = (decltype(handle))this->Malloc(2);
+      this->ValueFree(handle);
+      handle = (decltype(handle))this->ValueMalloc(2);
       if (!handle) goto error;
       handle[0] = '!';
       handle[1] = '\0';
@@ -2777,7 +4298,7 @@ bool YamlParser::ScanTag(YamlToken& token)
     goto error;
   }
 
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create a token.
   token = YamlToken::InitTag(handle, suffix, start_mark, end_mark);
@@ -2785,8 +4306,8 @@ bool YamlParser::ScanTag(YamlToken& token)
   return true;
 
 error:
-  this->Free(handle);
-  this->Free(suffix);
+  this->ValueFree(handle);
+  this->ValueFree(suffix);
   return false;
 }
 
@@ -2797,7 +4318,7 @@ bool YamlParser::ScanTagHandle(bool directive, YamlMark start_mark, uint8_t** ha
 {
   YamlString string;
 
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
+  if (!string.InitValue(*this, INITIAL_STRING_SIZE)) goto error;
 
   // Check the initial '!' character.
   if (!this->Cache(1)) goto error;
@@ -2825,6 +4346,7 @@ bool YamlParser::ScanTagHandle(bool directive, YamlMark start_mark, uint8_t** ha
   if (this->buffer.CheckAt('!'))
   {
     if (!this->Read(string)) goto error;
+    *string.pointer = '\0';
   }
   else
   {
@@ -2833,6 +4355,7 @@ bool YamlParser::ScanTagHandle(bool directive, YamlMark start_mark, uint8_t** ha
      * directive, it's an error.  If it's a tag token, it must be a part of
      * URI.
      */
+    *string.pointer = '\0';
     if (directive && !(string.start[0] == '!' && string.start[1] == '\0'))
     {
       this->SetScannerError("while parsing a tag directive", start_mark,
@@ -2858,7 +4381,7 @@ bool YamlParser::ScanTagUri(bool directive, uint8_t* head, YamlMark start_mark,
   size_t length = head ? strlen((char*)head) : 0;
   YamlString string;
 
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
+  if (!string.InitValue(*this, INITIAL_STRING_SIZE)) goto error;
 
   // Resize the string to include the head.
   while ((size_t)(string.end - string.start) <= length)
@@ -2891,13 +4414,7 @@ bool YamlParser::ScanTagUri(bool directive, uint8_t* head, YamlMark start_mark,
    *      '=', '+', '$', ',', '.', '!', '~', '*', '\'', '(', ')', '[', ']',
    *      '%'.
    */
-  while (this->buffer.IsAlphaAt() || this->buffer.CheckAt(';') || this->buffer.CheckAt('/') ||
-         this->buffer.CheckAt('?') || this->buffer.CheckAt(':') || this->buffer.CheckAt('@') ||
-         this->buffer.CheckAt('&') || this->buffer.CheckAt('=') || this->buffer.CheckAt('+') ||
-         this->buffer.CheckAt('$') || this->buffer.CheckAt(',') || this->buffer.CheckAt('.') ||
-         this->buffer.CheckAt('!') || this->buffer.CheckAt('~') || this->buffer.CheckAt('*') ||
-         this->buffer.CheckAt('\'') || this->buffer.CheckAt('(') || this->buffer.CheckAt(')') ||
-         this->buffer.CheckAt('[') || this->buffer.CheckAt(']') || this->buffer.CheckAt('%'))
+  while (this->buffer.IsUriAt())
   {
     // Check if it is a URI-escape sequence.
     if (this->buffer.CheckAt('%'))
@@ -2925,7 +4442,8 @@ bool YamlParser::ScanTagUri(bool directive, uint8_t* head, YamlMark start_mark,
     goto error;
   }
 
-  *uri = string.start;
+  *string.pointer = '\0';
+  *uri            = string.start;
 
   return true;
 
@@ -3006,21 +4524,23 @@ bool YamlParser::ScanBlockScalar(YamlToken& token, bool literal)
 {
   YamlMark start_mark;
   YamlMark end_mark;
-  YamlString string;
-  YamlString leading_break;
-  YamlString trailing_breaks;
-  int chomping        = 0;
-  int increment       = 0;
-  int indent          = 0;
-  bool leading_blank  = 0;
-  bool trailing_blank = 0;
-
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!leading_break.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!trailing_breaks.Init(*this, INITIAL_STRING_SIZE)) goto error;
+  YamlString& string          = this->scratch.string;
+  YamlString& leading_break   = this->scratch.leading_break;
+  YamlString& trailing_breaks = this->scratch.trailing_breaks;
+  uint8_t* value              = nullptr;
+  int chomping                = 0;
+  int increment               = 0;
+  int indent                  = 0;
+  bool leading_blank          = 0;
+  bool trailing_blank         = 0;
+  bool discarding             = this->skipping && this->skip_depth > 0;
+
+  // A discarded scalar is cleared on every line, skips the content of its
+  // lines and is not copied out.
+  if (!this->ClearScratch()) goto error;
 
   // Eat the indicator '|' or '>'.
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   this->Skip();
 
@@ -3112,7 +4632,7 @@ bool YamlParser::ScanBlockScalar(YamlToken& token, bool literal)
     this->SkipLine();
   }
 
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Set the indentation level if it was specified.
   if (increment)
@@ -3126,12 +4646,14 @@ bool YamlParser::ScanBlockScalar(YamlToken& token, bool literal)
   // Scan the block scalar content.
   if (!this->Cache(1)) goto error;
 
-  while ((int)this->mark.column == indent && !(this->buffer.IsNulAt()))
+  while ((int)this->Column() == indent && !(this->buffer.IsNulAt()))
   {
     /*
      * We are at the beginning of a non-empty line.
      */
 
+    if (discarding) string.Clear();
+
     // Is it a trailing whitespace?
     trailing_blank = this->buffer.IsBlankAt();
 
@@ -3163,7 +4685,14 @@ bool YamlParser::ScanBlockScalar(YamlToken& token, bool literal)
     // Consume the current line.
     while (!this->buffer.IsBreakOrNulAt())
     {
-      if (!this->Read(string)) goto error;
+      if (discarding)
+      {
+        this->Skip();
+      }
+      else if (!this->Read(string))
+      {
+        goto error;
+      }
       if (!this->Cache(1)) goto error;
     }
 
@@ -3187,20 +4716,24 @@ bool YamlParser::ScanBlockScalar(YamlToken& token, bool literal)
   }
 
   // Create a token.
-  token = YamlToken::InitScalar(string.start, string.pointer - string.start,
-                                literal ? EYamlScalarStyle::Literal : EYamlScalarStyle::Folded,
-                                start_mark, end_mark);
-
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
+  if (discarding)
+  {
+    token = YamlToken::InitScalar(yaml_empty_value, 0,
+                                  literal ? EYamlScalarStyle::Literal : EYamlScalarStyle::Folded,
+                                  start_mark, end_mark, true);
+  }
+  else
+  {
+    value = this->CopyScratch();
+    if (!value) goto error;
+    token = YamlToken::InitScalar(value, string.pointer - string.start,
+                                  literal ? EYamlScalarStyle::Literal : EYamlScalarStyle::Folded,
+                                  start_mark, end_mark);
+  }
 
   return true;
 
 error:
-  string.Del(*this);
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
-
   return false;
 }
 
@@ -3213,7 +4746,7 @@ bool YamlParser::ScanBlockScalarBreaks(int* indent, YamlString* breaks, YamlMark
 {
   int max_indent = 0;
 
-  *end_mark = this->mark;
+  *end_mark = this->Mark();
 
   // Eat the indentation spaces and line breaks.
   while (1)
@@ -3224,7 +4757,7 @@ bool YamlParser::ScanBlockScalarBreaks(int* indent, YamlString* breaks, YamlMark
       return false;
     }
 
-    while ((!*indent || (int)this->mark.column < *indent) && this->buffer.IsSpaceAt())
+    while ((!*indent || (int)this->Column() < *indent) && this->buffer.IsSpaceAt())
     {
       this->Skip();
       if (!this->Cache(1))
@@ -3233,10 +4766,10 @@ bool YamlParser::ScanBlockScalarBreaks(int* indent, YamlString* breaks, YamlMark
       }
     }
 
-    if ((int)this->mark.column > max_indent) max_indent = (int)this->mark.column;
+    if ((int)this->Column() > max_indent) max_indent = (int)this->Column();
 
     // Check for a tab character messing the indentation.
-    if ((!*indent || (int)this->mark.column < *indent) && this->buffer.IsTabAt())
+    if ((!*indent || (int)this->Column() < *indent) && this->buffer.IsTabAt())
     {
       return this->SetScannerError("while scanning a block scalar", start_mark,
                                    "found a tab character where an indentation space is expected");
@@ -3254,7 +4787,7 @@ bool YamlParser::ScanBlockScalarBreaks(int* indent, YamlString* breaks, YamlMark
     {
       return false;
     }
-    *end_mark = this->mark;
+    *end_mark = this->Mark();
   }
 
   // Determine the indentation level if needed.
@@ -3275,29 +4808,37 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
 {
   YamlMark start_mark;
   YamlMark end_mark;
-  YamlString string;
-  YamlString leading_break;
-  YamlString trailing_breaks;
-  YamlString whitespaces;
+  YamlString& string          = this->scratch.string;
+  YamlString& leading_break   = this->scratch.leading_break;
+  YamlString& trailing_breaks = this->scratch.trailing_breaks;
+  YamlString& whitespaces     = this->scratch.whitespaces;
+  uint8_t* value              = nullptr;
   bool leading_blanks;
+  bool discarding         = this->skipping && this->skip_depth > 0;
+  bool borrowing          = (this->borrow_scalars && this->in_place) || discarding;
+  const uint8_t* borrowed = nullptr;
+  size_t borrowed_length  = 0;
 
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!leading_break.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!trailing_breaks.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!whitespaces.Init(*this, INITIAL_STRING_SIZE)) goto error;
+  // A discarded scalar is scanned like a borrowed one, but unescapes and folds
+  // into the scratch string, which is cleared on every line.
+  if (!this->ClearScratch()) goto error;
 
   // Eat the left quote.
-  start_mark = this->mark;
+  start_mark = this->Mark();
 
   this->Skip();
 
+  borrowed = this->buffer.pointer;
+
   // Consume the content of the quoted scalar.
   while (1)
   {
+    if (discarding) string.Clear();
+
     // Check that there are no document indicators at the beginning of the line.
     if (!this->Cache(4)) goto error;
 
-    if (this->mark.column == 0 &&
+    if (this->Column() == 0 &&
         ((this->buffer.CheckAt('-', 0) && this->buffer.CheckAt('-', 1) &&
           this->buffer.CheckAt('-', 2)) ||
          (this->buffer.CheckAt('.', 0) && this->buffer.CheckAt('.', 1) &&
@@ -3327,6 +4868,11 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
       // Check for an escaped single quote.
       if (single && this->buffer.CheckAt('\'', 0) && this->buffer.CheckAt('\'', 1))
       {
+        if (borrowing && !discarding)
+        {
+          if (!this->Unborrow(string, borrowed, borrowed_length)) goto error;
+          borrowing = false;
+        }
         if (!string.Extend(*this)) goto error;
         *(string.pointer++) = '\'';
         this->Skip();
@@ -3342,6 +4888,11 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
       // Check for an escaped line break.
       else if (!single && this->buffer.CheckAt('\\') && this->buffer.IsBreakAt(1))
       {
+        if (borrowing && !discarding)
+        {
+          if (!this->Unborrow(string, borrowed, borrowed_length)) goto error;
+          borrowing = false;
+        }
         if (!this->Cache(3)) goto error;
         this->Skip();
         this->SkipLine();
@@ -3354,6 +4905,11 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
       {
         size_t code_length = 0;
 
+        if (borrowing && !discarding)
+        {
+          if (!this->Unborrow(string, borrowed, borrowed_length)) goto error;
+          borrowing = false;
+        }
         if (!string.Extend(*this)) goto error;
 
         // Check the escape character.
@@ -3514,6 +5070,13 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
         }
       }
 
+      else if (borrowing)
+      {
+        // It is a non-escaped non-blank character, still in place in the input.
+        borrowed_length += this->buffer.WidthAt();
+        this->Skip();
+      }
+
       else
       {
         // It is a non-escaped non-blank character.
@@ -3571,6 +5134,12 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
     // Join the whitespaces or fold line breaks.
     if (leading_blanks)
     {
+      if (borrowing && !discarding)
+      {
+        if (!this->Unborrow(string, borrowed, borrowed_length)) goto error;
+        borrowing = false;
+      }
+
       // Do we need to fold line breaks?
       if (leading_break.start[0] == '\n')
       {
@@ -3594,6 +5163,11 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
         trailing_breaks.Clear();
       }
     }
+    else if (borrowing)
+    {
+      borrowed_length += whitespaces.pointer - whitespaces.start;
+      whitespaces.Clear();
+    }
     else
     {
       if (!string.Join(*this, whitespaces)) goto error;
@@ -3604,26 +5178,36 @@ bool YamlParser::ScanFlowScalar(YamlToken& token, bool single)
   // Eat the right quote.
   this->Skip();
 
-  end_mark = this->mark;
+  end_mark = this->Mark();
 
   // Create a token.
-  token = YamlToken::InitScalar(string.start, string.pointer - string.start,
-                                single ? EYamlScalarStyle::SingleQuoted
-                                       : EYamlScalarStyle::DoubleQuoted,
-                                start_mark, end_mark);
-
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
-  whitespaces.Del(*this);
+  if (discarding)
+  {
+    token = YamlToken::InitScalar(yaml_empty_value, 0,
+                                  single ? EYamlScalarStyle::SingleQuoted
+                                         : EYamlScalarStyle::DoubleQuoted,
+                                  start_mark, end_mark, true);
+  }
+  else if (borrowing)
+  {
+    token = YamlToken::InitScalar((uint8_t*)borrowed, borrowed_length,
+                                  single ? EYamlScalarStyle::SingleQuoted
+                                         : EYamlScalarStyle::DoubleQuoted,
+                                  start_mark, end_mark, true);
+  }
+  else
+  {
+    value = this->CopyScratch();
+    if (!value) goto error;
+    token = YamlToken::InitScalar(value, string.pointer - string.start,
+                                  single ? EYamlScalarStyle::SingleQuoted
+                                         : EYamlScalarStyle::DoubleQuoted,
+                                  start_mark, end_mark);
+  }
 
   return true;
 
 error:
-  string.Del(*this);
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
-  whitespaces.Del(*this);
-
   return false;
 }
 
@@ -3634,27 +5218,34 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
 {
   YamlMark start_mark;
   YamlMark end_mark;
-  YamlString string;
-  YamlString leading_break;
-  YamlString trailing_breaks;
-  YamlString whitespaces;
-  bool leading_blanks = false;
-  int indent          = this->indent + 1;
-
-  if (!string.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!leading_break.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!trailing_breaks.Init(*this, INITIAL_STRING_SIZE)) goto error;
-  if (!whitespaces.Init(*this, INITIAL_STRING_SIZE)) goto error;
-
-  start_mark = end_mark = this->mark;
+  YamlString& string          = this->scratch.string;
+  YamlString& leading_break   = this->scratch.leading_break;
+  YamlString& trailing_breaks = this->scratch.trailing_breaks;
+  YamlString& whitespaces     = this->scratch.whitespaces;
+  uint8_t* value              = nullptr;
+  bool leading_blanks         = false;
+  int indent                  = this->indent + 1;
+  size_t run                  = 0;
+  bool discarding             = this->skipping && this->skip_depth > 0;
+  bool borrowing              = (this->borrow_scalars && this->in_place) || discarding;
+  const uint8_t* borrowed     = this->buffer.pointer;
+  size_t borrowed_length      = 0;
+
+  // A discarded scalar is scanned like a borrowed one, but folds into the
+  // scratch string, which is cleared on every line.
+  if (!this->ClearScratch()) goto error;
+
+  start_mark = end_mark = this->Mark();
 
   // Consume the content of the plain scalar.
   while (1)
   {
+    if (discarding) string.Clear();
+
     // Check for a document indicator.
     if (!this->Cache(4)) goto error;
 
-    if (this->mark.column == 0 &&
+    if (this->Column() == 0 &&
         ((this->buffer.CheckAt('-', 0) && this->buffer.CheckAt('-', 1) &&
           this->buffer.CheckAt('-', 2)) ||
          (this->buffer.CheckAt('.', 0) && this->buffer.CheckAt('.', 1) &&
@@ -3673,9 +5264,7 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
        * See http://yaml.org/spec/1.1/#id907281 9.1.3. Plain
        */
       if (this->flow_level && this->buffer.CheckAt(':') &&
-          (this->buffer.CheckAt(',', 1) || this->buffer.CheckAt('?', 1) ||
-           this->buffer.CheckAt('[', 1) || this->buffer.CheckAt(']', 1) ||
-           this->buffer.CheckAt('{', 1) || this->buffer.CheckAt('}', 1)))
+          (this->buffer.IsFlowIndicatorAt(1) || this->buffer.CheckAt('?', 1)))
       {
         this->SetScannerError("while scanning a plain scalar", start_mark, "found unexpected ':'");
         goto error;
@@ -3683,9 +5272,7 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
 
       // Check for indicators that may end a plain scalar.
       if ((this->buffer.CheckAt(':') && this->buffer.IsBlankOrNulAt(1)) ||
-          (this->flow_level &&
-           (this->buffer.CheckAt(',') || this->buffer.CheckAt('?') || this->buffer.CheckAt('[') ||
-            this->buffer.CheckAt(']') || this->buffer.CheckAt('{') || this->buffer.CheckAt('}'))))
+          (this->flow_level && (this->buffer.IsFlowIndicatorAt() || this->buffer.CheckAt('?'))))
         break;
 
       // Check if we need to join whitespaces and breaks.
@@ -3693,6 +5280,12 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
       {
         if (leading_blanks)
         {
+          if (borrowing && !discarding)
+          {
+            if (!this->Unborrow(string, borrowed, borrowed_length)) goto error;
+            borrowing = false;
+          }
+
           // Do we need to fold line breaks?
           if (leading_break.start[0] == '\n')
           {
@@ -3718,6 +5311,11 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
 
           leading_blanks = false;
         }
+        else if (borrowing)
+        {
+          borrowed_length += whitespaces.pointer - whitespaces.start;
+          whitespaces.Clear();
+        }
         else
         {
           if (!string.Join(*this, whitespaces)) goto error;
@@ -3725,10 +5323,26 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
         }
       }
 
-      // Copy the character.
-      if (!this->Read(string)) goto error;
+      // Copy the character, together with the run of ordinary characters that
+      // starts with it.
+      run = yaml_plain_scalar_run(this->buffer.pointer, this->buffer.last - this->buffer.pointer,
+                                  this->flow_level != 0);
+      if (borrowing)
+      {
+        borrowed_length += run ? run : this->buffer.WidthAt();
+        if (run) this->SkipRun(run);
+        else this->Skip();
+      }
+      else if (run)
+      {
+        if (!this->ReadRun(string, run)) goto error;
+      }
+      else
+      {
+        if (!this->Read(string)) goto error;
+      }
 
-      end_mark = this->mark;
+      end_mark = this->Mark();
 
       if (!this->Cache(2)) goto error;
     }
@@ -3744,7 +5358,7 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
       if (this->buffer.IsBlankAt())
       {
         // Check for tab character that abuse indentation.
-        if (leading_blanks && (int)this->mark.column < indent && this->buffer.IsTabAt())
+        if (leading_blanks && (int)this->Column() < indent && this->buffer.IsTabAt())
         {
           this->SetScannerError("while scanning a plain scalar", start_mark,
                                 "found a tab character that violate indentation");
@@ -3781,12 +5395,27 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
     }
 
     // Check indentation level.
-    if (!this->flow_level && (int)this->mark.column < indent) break;
+    if (!this->flow_level && (int)this->Column() < indent) break;
   }
 
   // Create a token.
-  token = YamlToken::InitScalar(string.start, string.pointer - string.start,
-                                EYamlScalarStyle::Plain, start_mark, end_mark);
+  if (discarding)
+  {
+    token = YamlToken::InitScalar(yaml_empty_value, 0, EYamlScalarStyle::Plain, start_mark,
+                                  end_mark, true);
+  }
+  else if (borrowing)
+  {
+    token = YamlToken::InitScalar((uint8_t*)borrowed, borrowed_length, EYamlScalarStyle::Plain,
+                                  start_mark, end_mark, true);
+  }
+  else
+  {
+    value = this->CopyScratch();
+    if (!value) goto error;
+    token = YamlToken::InitScalar(value, string.pointer - string.start, EYamlScalarStyle::Plain,
+                                  start_mark, end_mark);
+  }
 
   // Note that we change the 'simple_key_allowed' flag.
   if (leading_blanks)
@@ -3794,18 +5423,9 @@ bool YamlParser::ScanPlainScalar(YamlToken& token)
     this->simple_key_allowed = true;
   }
 
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
-  whitespaces.Del(*this);
-
   return true;
 
 error:
-  string.Del(*this);
-  leading_break.Del(*this);
-  trailing_breaks.Del(*this);
-  whitespaces.Del(*this);
-
   return false;
 }
 
@@ -3813,20 +5433,20 @@ error:
 
 void YamlEvent::Init(EYamlEventType type, const YamlMark& start_mark, const YamlMark& end_mark)
 {
-  *this            = {};
   this->type       = type;
   this->start_mark = start_mark;
   this->end_mark   = end_mark;
+  this->data       = stream_start_t();
 }
 
+// The events with data construct it in place, without a copy of the variant.
+
 void YamlEvent::InitStreamStart(EYamlEncoding encoding, const YamlMark& start_mark,
                                 const YamlMark& end_mark)
 {
   this->Init(EYamlEventType::StreamStart, start_mark, end_mark);
 
-  stream_start_t stream_start;
-  stream_start.encoding = encoding;
-  this->data            = stream_start;
+  std::get_if<stream_start_t>(&this->data)->encoding = encoding;
 }
 
 void YamlEvent::InitStreamEnd(const YamlMark& start_mark, const YamlMark& end_mark)
@@ -3841,39 +5461,35 @@ void YamlEvent::InitDocumentStart(YamlVersionDirective* version_directive,
 {
   this->Init(EYamlEventType::DocumentStart, start_mark, end_mark);
 
-  document_start_t document_start;
+  document_start_t& document_start    = this->data.emplace<document_start_t>();
   document_start.version_directive    = version_directive;
   document_start.tag_directives.start = tag_directives_start;
   document_start.tag_directives.end   = tag_directives_end;
   document_start.implicit             = implicit;
-  this->data                          = document_start;
 }
 
 void YamlEvent::InitDocumentEnd(bool implicit, const YamlMark& start_mark, const YamlMark& end_mark)
 {
   this->Init(EYamlEventType::DocumentEnd, start_mark, end_mark);
 
-  document_end_t document_end;
-  document_end.implicit = implicit;
-  this->data            = document_end;
+  this->data.emplace<document_end_t>().implicit = implicit;
 }
 
 void YamlEvent::InitAlias(uint8_t* anchor, const YamlMark& start_mark, const YamlMark& end_mark)
 {
   this->Init(EYamlEventType::Alias, start_mark, end_mark);
 
-  alias_t alias;
-  alias.anchor = anchor;
-  this->data   = alias;
+  this->data.emplace<alias_t>().anchor = anchor;
 }
 
 void YamlEvent::InitScalar(uint8_t* anchor, uint8_t* tag, uint8_t* value, size_t length,
                            bool plain_implicit, bool quoted_implicit, EYamlScalarStyle style,
-                           const YamlMark& start_mark, const YamlMark& end_mark)
+                           const YamlMark& start_mark, const YamlMark& end_mark, bool borrowed,
+                           int tag_id)
 {
   this->Init(EYamlEventType::Scalar, start_mark, end_mark);
 
-  scalar_t scalar;
+  scalar_t& scalar       = this->data.emplace<scalar_t>();
   scalar.anchor          = anchor;
   scalar.tag             = tag;
   scalar.value           = value;
@@ -3881,21 +5497,22 @@ void YamlEvent::InitScalar(uint8_t* anchor, uint8_t* tag, uint8_t* value, size_t
   scalar.plain_implicit  = plain_implicit;
   scalar.quoted_implicit = quoted_implicit;
   scalar.style           = style;
-  this->data             = scalar;
+  scalar.borrowed        = borrowed;
+  scalar.tag_id          = tag_id;
 }
 
 void YamlEvent::InitSequenceStart(uint8_t* anchor, uint8_t* tag, bool implicit,
                                   EYamlSequenceStyle style, const YamlMark& start_mark,
-                                  const YamlMark& end_mark)
+                                  const YamlMark& end_mark, int tag_id)
 {
   this->Init(EYamlEventType::SequenceStart, start_mark, end_mark);
 
-  sequence_start_t sequence_start;
-  sequence_start.anchor   = anchor;
-  sequence_start.tag      = tag;
-  sequence_start.implicit = implicit;
-  sequence_start.style    = style;
-  this->data              = sequence_start;
+  sequence_start_t& sequence_start = this->data.emplace<sequence_start_t>();
+  sequence_start.anchor            = anchor;
+  sequence_start.tag               = tag;
+  sequence_start.implicit          = implicit;
+  sequence_start.style             = style;
+  sequence_start.tag_id            = tag_id;
 }
 
 void YamlEvent::InitSequenceEnd(const YamlMark& start_mark, const YamlMark& end_mark)
@@ -3905,16 +5522,16 @@ void YamlEvent::InitSequenceEnd(const YamlMark& start_mark, const YamlMark& end_
 
 void YamlEvent::InitMappingStart(uint8_t* anchor, uint8_t* tag, bool implicit,
                                  EYamlMappingStyle style, const YamlMark& start_mark,
-                                 const YamlMark& end_mark)
+                                 const YamlMark& end_mark, int tag_id)
 {
   this->Init(EYamlEventType::MappingStart, start_mark, end_mark);
 
-  mapping_start_t mapping_start;
-  mapping_start.anchor   = anchor;
-  mapping_start.tag      = tag;
-  mapping_start.implicit = implicit;
-  mapping_start.style    = style;
-  this->data             = mapping_start;
+  mapping_start_t& mapping_start = this->data.emplace<mapping_start_t>();
+  mapping_start.anchor           = anchor;
+  mapping_start.tag              = tag;
+  mapping_start.implicit         = implicit;
+  mapping_start.style            = style;
+  mapping_start.tag_id           = tag_id;
 }
 
 void YamlEvent::InitMappingEnd(const YamlMark& start_mark, const YamlMark& end_mark)
@@ -3922,41 +5539,70 @@ void YamlEvent::InitMappingEnd(const YamlMark& start_mark, const YamlMark& end_m
   this->Init(EYamlEventType::MappingEnd, start_mark, end_mark);
 }
 
+void YamlEvent::SetAnchorNumber(uint64_t number)
+{
+  switch (this->type)
+  {
+  case EYamlEventType::Alias:
+    std::get<alias_t>(this->data).numeric_anchor = true;
+    std::get<alias_t>(this->data).anchor_number  = number;
+    break;
+
+  case EYamlEventType::Scalar:
+    std::get<scalar_t>(this->data).numeric_anchor = true;
+    std::get<scalar_t>(this->data).anchor_number  = number;
+    break;
+
+  case EYamlEventType::SequenceStart:
+    std::get<sequence_start_t>(this->data).numeric_anchor = true;
+    std::get<sequence_start_t>(this->data).anchor_number  = number;
+    break;
+
+  case EYamlEventType::MappingStart:
+    std::get<mapping_start_t>(this->data).numeric_anchor = true;
+    std::get<mapping_start_t>(this->data).anchor_number  = number;
+    break;
+
+  default:
+    assert(0);
+  }
+}
+
 void YamlEvent::Delete(YamlParser& parser)
 {
   switch (this->type)
   {
   case EYamlEventType::DocumentStart:
-    parser.Free(std::get<document_start_t>(this->data).version_directive);
+    parser.ValueFree(std::get<document_start_t>(this->data).version_directive);
     for (YamlTagDirective* tag_directive =
              std::get<document_start_t>(this->data).tag_directives.start;
          tag_directive != std::get<document_start_t>(this->data).tag_directives.end;
          tag_directive++)
     {
-      parser.Free(tag_directive->handle);
-      parser.Free(tag_directive->prefix);
+      parser.ValueFree(tag_directive->handle);
+      parser.ValueFree(tag_directive->prefix);
     }
-    parser.Free(std::get<document_start_t>(this->data).tag_directives.start);
+    parser.ValueFree(std::get<document_start_t>(this->data).tag_directives.start);
     break;
 
   case EYamlEventType::Alias:
-    parser.Free(std::get<alias_t>(this->data).anchor);
+    parser.ValueFree(std::get<alias_t>(this->data).anchor);
     break;
 
   case EYamlEventType::Scalar:
-    parser.Free(std::get<scalar_t>(this->data).anchor);
-    parser.Free(std::get<scalar_t>(this->data).tag);
-    parser.Free(std::get<scalar_t>(this->data).value);
+    parser.ValueFree(std::get<scalar_t>(this->data).anchor);
+    if (!std::get<scalar_t>(this->data).borrowed)
+    {
+      parser.ValueFree(std::get<scalar_t>(this->data).value);
+    }
     break;
 
   case EYamlEventType::SequenceStart:
-    parser.Free(std::get<sequence_start_t>(this->data).anchor);
-    parser.Free(std::get<sequence_start_t>(this->data).tag);
+    parser.ValueFree(std::get<sequence_start_t>(this->data).anchor);
     break;
 
   case EYamlEventType::MappingStart:
-    parser.Free(std::get<mapping_start_t>(this->data).anchor);
-    parser.Free(std::get<mapping_start_t>(this->data).tag);
+    parser.ValueFree(std::get<mapping_start_t>(this->data).anchor);
     break;
 
   default:
@@ -3970,1107 +5616,797 @@ void YamlEvent::Delete(YamlParser& parser)
 
 YamlToken* YamlParser::PeekToken()
 {
-  return (this->token_available || this->FetchMoreTokens()) ? this->tokens.head : nullptr;
+  return (this->token_available || this->FetchMoreTokens()) ? &this->tokens.At(this->tokens.head)
+                                                             : nullptr;
 }
 
 void YamlParser::SkipToken()
 {
   this->token_available = false;
   this->tokens_parsed++;
-  this->stream_end_produced = (this->tokens.head->type == EYamlTokenType::StreamEnd);
+  this->stream_end_produced = (this->tokens.At(this->tokens.head).type ==
+                               EYamlTokenType::StreamEnd);
   this->tokens.head++;
 }
 
 /*
- * Parse the production:
- * stream   ::= STREAM-START implicit_document? explicit_document* STREAM-END
- *              ************
+ * The events of Parse, each built in the event of the caller, which takes
+ * over its values.
  */
-bool YamlParser::ParseStreamStart(YamlEvent& event)
+struct YamlParser::EventSink
 {
-  YamlToken* token = this->PeekToken();
+  YamlEvent& event;
 
-  if (!token)
+  template <typename T>
+  void Set(EYamlEventType type, const T& data, const YamlMark& start_mark,
+           const YamlMark& end_mark)
   {
-    return false;
+    this->event.type       = type;
+    this->event.start_mark = start_mark;
+    this->event.end_mark   = end_mark;
+    this->event.data.emplace<T>(data);
   }
 
-  if (token->type != EYamlTokenType::StreamStart)
+  void OnStreamStart(const YamlEvent::stream_start_t& stream_start, const YamlMark& start_mark,
+                     const YamlMark& end_mark)
   {
-    return this->SetParserError("did not find expected <stream-start>", token->start_mark);
-    return false;
+    this->Set(EYamlEventType::StreamStart, stream_start, start_mark, end_mark);
   }
 
-  this->state = EYamlParserState::ImplicitDocumentStart;
-
-  event.InitStreamStart(std::get<YamlToken::stream_start_t>(token->data).encoding,
-                        token->start_mark, token->start_mark);
-  this->SkipToken();
-
-  return true;
-}
-
-/*
- * Parse the productions:
- * implicit_document    ::= block_node DOCUMENT-END*
- *                          *
- * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
- *                          *************************
- */
-bool YamlParser::ParseDocumentStart(YamlEvent& event, bool isImplicit)
-{
-  YamlToken* token;
-  YamlVersionDirective* version_directive = nullptr;
-  struct
+  void OnStreamEnd(const YamlMark& start_mark, const YamlMark& end_mark)
   {
-    YamlTagDirective* start;
-    YamlTagDirective* end;
-  } tag_directives = {nullptr, nullptr};
-
-  token = this->PeekToken();
-  if (!token) return 0;
-
-  /* Parse extra document end indicators. */
+    this->Set(EYamlEventType::StreamEnd, YamlEvent::stream_start_t(), start_mark, end_mark);
+  }
 
-  if (!isImplicit)
+  void OnDocumentStart(const YamlEvent::document_start_t& document_start,
+                       const YamlMark& start_mark, const YamlMark& end_mark)
   {
-    while (token->type == EYamlTokenType::DocumentEnd)
-    {
-      this->SkipToken();
-      token = this->PeekToken();
-      if (!token) return 0;
-    }
+    this->Set(EYamlEventType::DocumentStart, document_start, start_mark, end_mark);
   }
 
-  /* Parse an implicit document. */
+  void OnDocumentEnd(const YamlEvent::document_end_t& document_end, const YamlMark& start_mark,
+                     const YamlMark& end_mark)
+  {
+    this->Set(EYamlEventType::DocumentEnd, document_end, start_mark, end_mark);
+  }
 
-  if (isImplicit && token->type != EYamlTokenType::VersionDirective &&
-      token->type != EYamlTokenType::TagDirective && token->type != EYamlTokenType::DocumentStart &&
-      token->type != EYamlTokenType::StreamEnd)
+  void OnAlias(const YamlEvent::alias_t& alias, const YamlMark& start_mark,
+               const YamlMark& end_mark)
   {
-    if (!this->ProcessDirectives(nullptr, nullptr, nullptr)) return 0;
-    if (!this->states.Push(*this, EYamlParserState::DocumentEnd)) return 0;
-    this->state = EYamlParserState::BlockNode;
-    event.InitDocumentStart(nullptr, nullptr, nullptr, 1, token->start_mark, token->start_mark);
-    return 1;
+    this->Set(EYamlEventType::Alias, alias, start_mark, end_mark);
   }
 
-  /* Parse an explicit document. */
+  void OnScalar(const YamlEvent::scalar_t& scalar, const YamlMark& start_mark,
+                const YamlMark& end_mark)
+  {
+    this->Set(EYamlEventType::Scalar, scalar, start_mark, end_mark);
+  }
 
-  else if (token->type != EYamlTokenType::StreamEnd)
+  void OnSequenceStart(const YamlEvent::sequence_start_t& sequence_start,
+                       const YamlMark& start_mark, const YamlMark& end_mark)
   {
-    YamlMark start_mark, end_mark;
-    start_mark = token->start_mark;
-    if (!this->ProcessDirectives(&version_directive, &tag_directives.start, &tag_directives.end))
-      return 0;
-    token = this->PeekToken();
-    if (!token) goto error;
-    if (token->type != EYamlTokenType::DocumentStart)
-    {
-      this->SetParserError("did not find expected <document start>", token->start_mark);
-      goto error;
-    }
-    if (!this->states.Push(*this, EYamlParserState::DocumentEnd)) goto error;
-    this->state = EYamlParserState::DocumentContent;
-    end_mark    = token->end_mark;
-    event.InitDocumentStart(version_directive, tag_directives.start, tag_directives.end, 0,
-                            start_mark, end_mark);
-    this->SkipToken();
-    version_directive    = nullptr;
-    tag_directives.start = tag_directives.end = nullptr;
-    return 1;
+    this->Set(EYamlEventType::SequenceStart, sequence_start, start_mark, end_mark);
   }
 
-  /* Parse the stream end. */
+  void OnSequenceEnd(const YamlMark& start_mark, const YamlMark& end_mark)
+  {
+    this->Set(EYamlEventType::SequenceEnd, YamlEvent::stream_start_t(), start_mark, end_mark);
+  }
 
-  else
+  void OnMappingStart(const YamlEvent::mapping_start_t& mapping_start,
+                      const YamlMark& start_mark, const YamlMark& end_mark)
   {
-    this->state = EYamlParserState::End;
-    event.InitStreamEnd(token->start_mark, token->end_mark);
-    this->SkipToken();
-    return 1;
+    this->Set(EYamlEventType::MappingStart, mapping_start, start_mark, end_mark);
   }
 
-error:
-  this->Free(version_directive);
-  while (tag_directives.start != tag_directives.end)
+  void OnMappingEnd(const YamlMark& start_mark, const YamlMark& end_mark)
   {
-    this->Free(tag_directives.end[-1].handle);
-    this->Free(tag_directives.end[-1].prefix);
-    tag_directives.end--;
+    this->Set(EYamlEventType::MappingEnd, YamlEvent::stream_start_t(), start_mark, end_mark);
   }
-  this->Free(tag_directives.start);
-  return 0;
-}
+};
 
 /*
- * Parse the productions:
- * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
- *                                                    ***********
+ * State dispatcher.
  */
-bool YamlParser::ParseDocumentContent(YamlEvent& event)
+bool YamlParser::StateMachine(YamlEvent& event)
 {
-  YamlToken* token;
+  EventSink events = {event};
 
-  token = this->PeekToken();
-  if (!token) return 0;
-
-  if (token->type == EYamlTokenType::VersionDirective ||
-      token->type == EYamlTokenType::TagDirective || token->type == EYamlTokenType::DocumentStart ||
-      token->type == EYamlTokenType::DocumentEnd || token->type == EYamlTokenType::StreamEnd)
-  {
-    this->state = this->states.Pop();
-    return this->ProcessEmptyScalar(event, token->start_mark);
-  }
-  else
-  {
-    return this->ParseNode(event, 1, 0);
-  }
+  return this->StateMachine(events);
 }
 
 /*
- * Parse the productions:
- * implicit_document    ::= block_node DOCUMENT-END*
- *                                     *************
- * explicit_document    ::= DIRECTIVE* DOCUMENT-START block_node? DOCUMENT-END*
- *                                                                *************
+ * Resolve the tag of a node against the directives and intern it, so that
+ * every distinct tag is built only once per parser.  The handle and the
+ * suffix are freed once the tag is interned.
  */
-bool YamlParser::ParseDocumentEnd(YamlEvent& event)
+bool YamlParser::ResolveTag(uint8_t*& tag_handle, uint8_t*& tag_suffix, YamlMark start_mark,
+                            YamlMark tag_mark, uint8_t*& tag, int& tag_id)
 {
-  YamlToken* token;
-  YamlMark start_mark, end_mark;
-  int implicit = 1;
-
-  token = this->PeekToken();
-  if (!token) return 0;
-
-  start_mark = end_mark = token->start_mark;
+  const uint8_t* prefix = nullptr;
+  size_t prefix_length  = 0;
+  const YamlTag* interned;
 
-  if (token->type == EYamlTokenType::DocumentEnd)
+  if (*tag_handle)
   {
-    end_mark = token->end_mark;
-    this->SkipToken();
-    implicit = 0;
+    YamlTagDirective* tag_directive;
+    for (tag_directive = this->tag_directives.start; tag_directive != this->tag_directives.top;
+         tag_directive++)
+    {
+      if (strcmp((char*)tag_directive->handle, (char*)tag_handle) == 0) break;
+    }
+    if (tag_directive == this->tag_directives.top)
+    {
+      return this->SetParserErrorContext("while parsing a node", start_mark,
+                                         "found undefined tag handle", tag_mark);
+    }
+    prefix        = tag_directive->prefix;
+    prefix_length = strlen((char*)prefix);
   }
 
-  // Note: libyaml originally clears the tag directives stack here,
-  // but that is incompatible with Unity's YAML (1.1) files.
-  // It has been moved to the stream end.
+  // A node that is skipped only needs a tag, not the one that it has.
+  if (this->skipping)
+  {
+    tag = yaml_empty_value;
+    this->ValueFree(tag_handle);
+    this->ValueFree(tag_suffix);
+    tag_handle = tag_suffix = nullptr;
+    return true;
+  }
 
-  this->state = EYamlParserState::DocumentStart;
-  event.InitDocumentEnd(implicit, start_mark, end_mark);
+  interned = this->tags.Intern(*this, prefix, prefix_length, tag_suffix,
+                               strlen((char*)tag_suffix));
+  if (!interned) return false;
+  tag    = interned->name;
+  tag_id = interned->id;
+  this->ValueFree(tag_handle);
+  this->ValueFree(tag_suffix);
+  tag_handle = tag_suffix = nullptr;
 
-  return 1;
+  return true;
 }
 
 /*
- * Parse the productions:
- * block_node_or_indentless_sequence    ::=
- *                          ALIAS
- *                          *****
- *                          | properties (block_content | indentless_block_sequence)?
- *                            **********  *
- *                          | block_content | indentless_block_sequence
- *                            *
- * block_node           ::= ALIAS
- *                          *****
- *                          | properties block_content?
- *                            ********** *
- *                          | block_content
- *                            *
- * flow_node            ::= ALIAS
- *                          *****
- *                          | properties flow_content?
- *                            ********** *
- *                          | flow_content
- *                            *
- * properties           ::= TAG ANCHOR? | ANCHOR TAG?
- *                          *************************
- * block_content        ::= block_collection | flow_collection | SCALAR
- *                                                               ******
- * flow_content         ::= flow_collection | SCALAR
- *                                            ******
- */
-bool YamlParser::ParseNode(YamlEvent& event, bool isBlock, bool isIndentless)
+ * Make the value of an empty scalar, or return null without memory.  Nodes
+ * that are skipped share one.
+ */
+uint8_t* YamlParser::EmptyValue()
 {
-  YamlToken* token;
-  uint8_t* anchor     = nullptr;
-  uint8_t* tag_handle = nullptr;
-  uint8_t* tag_suffix = nullptr;
-  uint8_t* tag        = nullptr;
-  YamlMark start_mark, end_mark, tag_mark;
-  int implicit;
+  uint8_t* value;
 
-  token = this->PeekToken();
-  if (!token) return 0;
+  if (this->borrow_scalars || this->skipping) return yaml_empty_value;
 
-  if (token->type == EYamlTokenType::Alias)
+  value = (decltype(value))this->ValueMalloc(1);
+  if (!value)
   {
-    this->state = this->states.Pop();
-    event.InitAlias(std::get<YamlToken::alias_t>(token->data).value, token->start_mark,
-                    token->end_mark);
-    this->SkipToken();
-    return 1;
+    this->error = EYamlError::Memory;
+    return nullptr;
   }
+  value[0] = '\0';
 
-  else
+  return value;
+}
+
+/*
+ * Free the directives of a DOCUMENT-START event.
+ */
+void YamlParser::DeleteDirectives(YamlVersionDirective* version_directive,
+                                  YamlTagDirective* tag_directives_start,
+                                  YamlTagDirective* tag_directives_end)
+{
+  this->ValueFree(version_directive);
+  for (YamlTagDirective* tag_directive = tag_directives_start;
+       tag_directive != tag_directives_end; tag_directive++)
   {
-    start_mark = end_mark = token->start_mark;
+    this->ValueFree(tag_directive->handle);
+    this->ValueFree(tag_directive->prefix);
+  }
+  this->ValueFree(tag_directives_start);
+}
+
+/*
+ * Parse directives.
+ */
+bool YamlParser::ProcessDirectives(YamlVersionDirective** version_directive_ref,
+                                   YamlTagDirective** tag_directives_start_ref,
+                                   YamlTagDirective** tag_directives_end_ref)
+{
+  YamlTagDirective default_tag_directives[] = {{(uint8_t*)"!", (uint8_t*)"!"},
+                                               {(uint8_t*)"!!", (uint8_t*)"tag:yaml.org,2002:"},
+                                               {nullptr, nullptr}};
+  YamlTagDirective* default_tag_directive;
+  YamlVersionDirective* version_directive = nullptr;
+
+  YamlStack<YamlTagDirective> tag_directives;
+  YamlToken* token;
+
+  if (!tag_directives.Init(*this)) goto error;
+
+  token = this->PeekToken();
+  if (!token) goto error;
 
-    if (token->type == EYamlTokenType::Anchor)
+  while (token->type == EYamlTokenType::VersionDirective ||
+         token->type == EYamlTokenType::TagDirective)
+  {
+    if (token->type == EYamlTokenType::VersionDirective)
     {
-      anchor     = std::get<YamlToken::anchor_t>(token->data).value;
-      start_mark = token->start_mark;
-      end_mark   = token->end_mark;
-      this->SkipToken();
-      token = this->PeekToken();
-      if (!token) goto error;
-      if (token->type == EYamlTokenType::Tag)
+      if (version_directive)
       {
-        tag_handle = std::get<YamlToken::tag_t>(token->data).handle;
-        tag_suffix = std::get<YamlToken::tag_t>(token->data).suffix;
-        tag_mark   = token->start_mark;
-        end_mark   = token->end_mark;
-        this->SkipToken();
-        token = this->PeekToken();
-        if (!token) goto error;
+        this->SetParserError("found duplicate %YAML directive", token->start_mark);
+        goto error;
       }
-    }
-    else if (token->type == EYamlTokenType::Tag)
-    {
-      tag_handle = std::get<YamlToken::tag_t>(token->data).handle;
-      tag_suffix = std::get<YamlToken::tag_t>(token->data).suffix;
-      start_mark = tag_mark = token->start_mark;
-      end_mark              = token->end_mark;
-      this->SkipToken();
-      token = this->PeekToken();
-      if (!token) goto error;
-      if (token->type == EYamlTokenType::Anchor)
+      if (std::get<YamlToken::version_directive_t>(token->data).major != 1 ||
+          std::get<YamlToken::version_directive_t>(token->data).minor != 1)
+      {
+        this->SetParserError("found incompatible YAML document", token->start_mark);
+        goto error;
+      }
+      version_directive = (decltype(version_directive))this->ValueMalloc(sizeof(*version_directive));
+      if (!version_directive)
       {
-        anchor   = std::get<YamlToken::anchor_t>(token->data).value;
-        end_mark = token->end_mark;
-        this->SkipToken();
-        token = this->PeekToken();
-        if (!token) goto error;
+        this->error = EYamlError::Memory;
+        goto error;
       }
+      version_directive->major = std::get<YamlToken::version_directive_t>(token->data).major;
+      version_directive->minor = std::get<YamlToken::version_directive_t>(token->data).minor;
     }
 
-    if (tag_handle)
+    else if (token->type == EYamlTokenType::TagDirective)
     {
-      if (!*tag_handle)
-      {
-        tag = tag_suffix;
-        this->Free(tag_handle);
-        tag_handle = tag_suffix = nullptr;
-      }
-      else
-      {
-        YamlTagDirective* tag_directive;
-        for (tag_directive = this->tag_directives.start; tag_directive != this->tag_directives.top;
-             tag_directive++)
-        {
-          if (strcmp((char*)tag_directive->handle, (char*)tag_handle) == 0)
-          {
-            size_t prefix_len = strlen((char*)tag_directive->prefix);
-            size_t suffix_len = strlen((char*)tag_suffix);
-            tag               = (decltype(tag))this->Malloc(prefix_len + suffix_len + 1);
-            if (!tag)
-            {
-              this->error = EYamlError::Memory;
-              goto error;
-            }
-            memcpy(tag, tag_directive->prefix, prefix_len);
-            memcpy(tag + prefix_len, tag_suffix, suffix_len);
-            tag[prefix_len + suffix_len] = '\0';
-            this->Free(tag_handle);
-            this->Free(tag_suffix);
-            tag_handle = tag_suffix = nullptr;
-            break;
-          }
-        }
-        if (!tag)
-        {
-          this->SetParserErrorContext("while parsing a node", start_mark,
-                                      "found undefined tag handle", tag_mark);
-          goto error;
-        }
-      }
+      YamlTagDirective value;
+      value.handle = std::get<YamlToken::tag_directive_t>(token->data).handle;
+      value.prefix = std::get<YamlToken::tag_directive_t>(token->data).prefix;
+
+      if (!this->AppendTagDirective(value, 0, token->start_mark)) goto error;
+      if (!tag_directives.Push(*this, value)) goto error;
     }
 
-    implicit = (!tag || !*tag);
-    if (isIndentless && token->type == EYamlTokenType::BlockEntry)
+    this->SkipToken();
+    token = this->PeekToken();
+    if (!token) goto error;
+  }
+
+  for (default_tag_directive = default_tag_directives; default_tag_directive->handle;
+       default_tag_directive++)
+  {
+    if (!this->AppendTagDirective(*default_tag_directive, 1, token->start_mark)) goto error;
+  }
+
+  if (version_directive_ref)
+  {
+    *version_directive_ref = version_directive;
+  }
+  if (tag_directives_start_ref)
+  {
+    if (tag_directives.Empty())
     {
-      end_mark    = token->end_mark;
-      this->state = EYamlParserState::IndentlessSequenceEntry;
-      event.InitSequenceStart(anchor, tag, implicit, EYamlSequenceStyle::Block, start_mark,
-                              end_mark);
-      return 1;
+      *tag_directives_start_ref = *tag_directives_end_ref = nullptr;
+      tag_directives.Del(*this);
     }
-    else
+    else if (this->arena.block_size)
     {
-      if (token->type == EYamlTokenType::Scalar)
-      {
-        int plain_implicit  = 0;
-        int quoted_implicit = 0;
-        end_mark            = token->end_mark;
-        if ((std::get<YamlToken::scalar_t>(token->data).style == EYamlScalarStyle::Plain && !tag) ||
-            (tag && strcmp((char*)tag, "!") == 0))
-        {
-          plain_implicit = 1;
-        }
-        else if (!tag)
-        {
-          quoted_implicit = 1;
-        }
-        this->state = this->states.Pop();
-        event.InitScalar(anchor, tag, std::get<YamlToken::scalar_t>(token->data).value,
-                         std::get<YamlToken::scalar_t>(token->data).length, plain_implicit,
-                         quoted_implicit, std::get<YamlToken::scalar_t>(token->data).style,
-                         start_mark, end_mark);
-        this->SkipToken();
-        return 1;
-      }
-      else if (token->type == EYamlTokenType::FlowSequenceStart)
-      {
-        end_mark    = token->end_mark;
-        this->state = EYamlParserState::FlowSequenceFirstEntry;
-        event.InitSequenceStart(anchor, tag, implicit, EYamlSequenceStyle::Flow, start_mark,
-                                end_mark);
-        return 1;
-      }
-      else if (token->type == EYamlTokenType::FlowMappingStart)
-      {
-        end_mark    = token->end_mark;
-        this->state = EYamlParserState::FlowMappingFirstKey;
-        event.InitMappingStart(anchor, tag, implicit, EYamlMappingStyle::Flow, start_mark,
-                               end_mark);
-        return 1;
-      }
-      else if (isBlock && token->type == EYamlTokenType::BlockSequenceStart)
-      {
-        end_mark    = token->end_mark;
-        this->state = EYamlParserState::BlockSequenceFirstEntry;
-        event.InitSequenceStart(anchor, tag, implicit, EYamlSequenceStyle::Block, start_mark,
-                                end_mark);
-        return 1;
-      }
-      else if (isBlock && token->type == EYamlTokenType::BlockMappingStart)
-      {
-        end_mark    = token->end_mark;
-        this->state = EYamlParserState::BlockMappingFirstKey;
-        event.InitMappingStart(anchor, tag, implicit, EYamlMappingStyle::Block, start_mark,
-                               end_mark);
-        return 1;
-      }
-      else if (anchor || tag)
-      {
-        uint8_t* value = (decltype(value))this->Malloc(1);
-        if (!value)
-        {
-          this->error = EYamlError::Memory;
-          goto error;
-        }
-        value[0]    = '\0';
-        this->state = this->states.Pop();
-        event.InitScalar(anchor, tag, value, 0, implicit, 0, EYamlScalarStyle::Plain, start_mark,
-                         end_mark);
-        return 1;
-      }
-      else
+      // The event gets a copy of the directives that lives in the arena.
+      size_t size = (char*)tag_directives.top - (char*)tag_directives.start;
+      YamlTagDirective* copy = (YamlTagDirective*)this->ValueMalloc(size);
+      if (!copy)
       {
-        this->SetParserErrorContext(
-            (isBlock ? "while parsing a block node" : "while parsing a flow node"), start_mark,
-            "did not find expected node content", token->start_mark);
+        this->error = EYamlError::Memory;
         goto error;
       }
+      memcpy(copy, tag_directives.start, size);
+      *tag_directives_start_ref = copy;
+      *tag_directives_end_ref   = copy + (tag_directives.top - tag_directives.start);
+      tag_directives.Del(*this);
+    }
+    else
+    {
+      *tag_directives_start_ref = tag_directives.start;
+      *tag_directives_end_ref   = tag_directives.top;
     }
   }
+  else
+  {
+    tag_directives.Del(*this);
+  }
 
-error:
-  this->Free(anchor);
-  this->Free(tag_handle);
-  this->Free(tag_suffix);
-  this->Free(tag);
+  if (!version_directive_ref) this->ValueFree(version_directive);
+  return true;
 
+error:
+  this->ValueFree(version_directive);
+  while (!tag_directives.Empty())
+  {
+    YamlTagDirective tag_directive = tag_directives.Pop();
+    this->ValueFree(tag_directive.handle);
+    this->ValueFree(tag_directive.prefix);
+  }
+  tag_directives.Del(*this);
   return false;
 }
 
 /*
- * Parse the productions:
- * block_sequence ::= BLOCK-SEQUENCE-START (BLOCK-ENTRY block_node?)* BLOCK-END
- *                    ********************  *********** *             *********
+ * Append a tag directive to the directives stack.
  */
-bool YamlParser::ParseBlockSequenceEntry(YamlEvent& event, bool isFirst)
+bool YamlParser::AppendTagDirective(YamlTagDirective value, bool allow_duplicates, YamlMark mark)
 {
-  YamlToken* token;
-
-  if (isFirst)
-  {
-    token = this->PeekToken();
-    if (!this->marks.Push(*this, token->start_mark)) return 0;
-    this->SkipToken();
-  }
-
-  token = this->PeekToken();
-  if (!token) return 0;
+  YamlTagDirective* tag_directive;
+  YamlTagDirective copy = {nullptr, nullptr};
 
-  if (token->type == EYamlTokenType::BlockEntry)
+  for (tag_directive = this->tag_directives.start; tag_directive != this->tag_directives.top;
+       tag_directive++)
   {
-    YamlMark mark = token->end_mark;
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) return 0;
-    if (token->type != EYamlTokenType::BlockEntry && token->type != EYamlTokenType::BlockEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::BlockSequenceEntry)) return 0;
-      return this->ParseNode(event, 1, 0);
-    }
-    else
+    if (strcmp((char*)value.handle, (char*)tag_directive->handle) == 0)
     {
-      this->state = EYamlParserState::BlockSequenceEntry;
-      return this->ProcessEmptyScalar(event, mark);
+      if (allow_duplicates) return true;
+      return this->SetParserError("found duplicate %TAG directive", mark);
     }
   }
 
-  else if (token->type == EYamlTokenType::BlockEnd)
+  copy.handle = (decltype(copy.prefix))this->Strdup((char*)value.handle);
+  copy.prefix = (decltype(copy.prefix))this->Strdup((char*)value.prefix);
+  if (!copy.handle || !copy.prefix)
   {
-    this->state = this->states.Pop();
-    (void)this->marks.Pop();
-    event.InitSequenceEnd(token->start_mark, token->end_mark);
-    this->SkipToken();
-    return 1;
+    this->error = EYamlError::Memory;
+    goto error;
   }
 
-  else
-  {
-    return this->SetParserErrorContext("while parsing a block collection", this->marks.Pop(),
-                                       "did not find expected '-' indicator", token->start_mark);
-  }
+  if (!this->tag_directives.Push(*this, copy)) goto error;
+
+  return true;
+
+error:
+  this->Free(copy.handle);
+  this->Free(copy.prefix);
+  return false;
 }
 
 /*
- * Parse the productions:
- * indentless_sequence  ::= (BLOCK-ENTRY block_node?)+
- *                           *********** *
+ * Get the next event.
  */
-bool YamlParser::ParseIndentlessSequenceEntry(YamlEvent& event)
+bool YamlParser::Parse(YamlEvent& event)
 {
-  YamlToken* token;
-
-  token = this->PeekToken();
-  if (!token) return 0;
+  // Erase the event object.
+  event = {};
 
-  if (token->type == EYamlTokenType::BlockEntry)
+  // No events after the end of the stream or error.
+  if (this->stream_end_produced || (this->error != EYamlError::None) ||
+      this->state == EYamlParserState::End)
   {
-    YamlMark mark = token->end_mark;
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) return 0;
-    if (token->type != EYamlTokenType::BlockEntry && token->type != EYamlTokenType::Key &&
-        token->type != EYamlTokenType::Value && token->type != EYamlTokenType::BlockEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::IndentlessSequenceEntry)) return 0;
-      return this->ParseNode(event, 1, 0);
-    }
-    else
-    {
-      this->state = EYamlParserState::IndentlessSequenceEntry;
-      return this->ProcessEmptyScalar(event, mark);
-    }
+    return true;
   }
 
-  else
-  {
-    this->state = this->states.Pop();
-    event.InitSequenceEnd(token->start_mark, token->start_mark);
-    return 1;
-  }
+  // Generate the next event.
+  if (this->StateMachine(event)) return true;
+
+  // Leave the event empty until more input is fed.  The parser states only
+  // peek past a document indicator line when they start, so they can be
+  // entered again.
+  if (!this->starved) return false;
+  this->starved = false;
+  event         = {};
+
+  return true;
 }
 
 /*
- * Parse the productions:
- * block_mapping        ::= BLOCK-MAPPING_START
- *                          *******************
- *                          ((KEY block_node_or_indentless_sequence?)?
- *                            *** *
- *                          (VALUE block_node_or_indentless_sequence?)?)*
- *
- *                          BLOCK-END
- *                          *********
+ * The events of SkipNode, which only count the collections that are open.
+ * The values that the scanner made before the skip started are freed.
  */
-bool YamlParser::ParseBlockMappingKey(YamlEvent& event, bool isFirst)
+struct YamlParser::SkipEvents
 {
-  YamlToken* token;
+  YamlParser& parser;
+  // Below 0 once an event that does not belong to a node came.
+  int depth = 0;
+  YamlMark mark = {};
 
-  if (isFirst)
+  void Other(const YamlMark& start_mark)
   {
-    token = this->PeekToken();
-    if (!this->marks.Push(*this, token->start_mark)) return 0;
-    this->SkipToken();
+    this->depth = -1;
+    this->mark  = start_mark;
   }
 
-  token = this->PeekToken();
-  if (!token) return 0;
+  void Start(uint8_t* anchor)
+  {
+    this->depth++;
+    this->parser.ValueFree(anchor);
+  }
 
-  if (token->type == EYamlTokenType::Key)
+  void End(const YamlMark& start_mark)
   {
-    YamlMark mark = token->end_mark;
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) return 0;
-    if (token->type != EYamlTokenType::Key && token->type != EYamlTokenType::Value &&
-        token->type != EYamlTokenType::BlockEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::BlockMappingValue)) return 0;
-      return this->ParseNode(event, 1, 1);
-    }
-    else
-    {
-      this->state = EYamlParserState::BlockMappingValue;
-      return this->ProcessEmptyScalar(event, mark);
-    }
+    if (--this->depth < 0) this->mark = start_mark;
   }
 
-  else if (token->type == EYamlTokenType::BlockEnd)
+  void OnStreamStart(const YamlEvent::stream_start_t&, const YamlMark& start_mark,
+                     const YamlMark&)
   {
-    this->state = this->states.Pop();
-    (void)this->marks.Pop();
-    event.InitMappingEnd(token->start_mark, token->end_mark);
-    this->SkipToken();
-    return 1;
+    this->Other(start_mark);
   }
 
-  else
+  void OnStreamEnd(const YamlMark& start_mark, const YamlMark&) { this->Other(start_mark); }
+
+  void OnDocumentStart(const YamlEvent::document_start_t& document_start,
+                       const YamlMark& start_mark, const YamlMark&)
   {
-    return this->SetParserErrorContext("while parsing a block mapping", this->marks.Pop(),
-                                       "did not find expected key", token->start_mark);
+    this->parser.DeleteDirectives(document_start.version_directive,
+                                  document_start.tag_directives.start,
+                                  document_start.tag_directives.end);
+    this->Other(start_mark);
   }
-}
 
-/*
- * Parse the productions:
- * block_mapping        ::= BLOCK-MAPPING_START
- *
- *                          ((KEY block_node_or_indentless_sequence?)?
- *
- *                          (VALUE block_node_or_indentless_sequence?)?)*
- *                           ***** *
- *                          BLOCK-END
- *
- */
-bool YamlParser::ParseBlockMappingValue(YamlEvent& event)
-{
-  YamlToken* token;
+  void OnDocumentEnd(const YamlEvent::document_end_t&, const YamlMark& start_mark,
+                     const YamlMark&)
+  {
+    this->Other(start_mark);
+  }
 
-  token = this->PeekToken();
-  if (!token) return 0;
+  void OnAlias(const YamlEvent::alias_t& alias, const YamlMark&, const YamlMark&)
+  {
+    this->parser.ValueFree(alias.anchor);
+  }
 
-  if (token->type == EYamlTokenType::Value)
+  void OnScalar(const YamlEvent::scalar_t& scalar, const YamlMark&, const YamlMark&)
   {
-    YamlMark mark = token->end_mark;
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) return 0;
-    if (token->type != EYamlTokenType::Key && token->type != EYamlTokenType::Value &&
-        token->type != EYamlTokenType::BlockEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::BlockMappingKey)) return 0;
-      return this->ParseNode(event, 1, 1);
-    }
-    else
+    this->parser.ValueFree(scalar.anchor);
+    if (!scalar.borrowed && scalar.value != yaml_empty_value)
     {
-      this->state = EYamlParserState::BlockMappingKey;
-      return this->ProcessEmptyScalar(event, mark);
+      this->parser.ValueFree(scalar.value);
     }
   }
 
-  else
+  void OnSequenceStart(const YamlEvent::sequence_start_t& sequence_start, const YamlMark&,
+                       const YamlMark&)
   {
-    this->state = EYamlParserState::BlockMappingKey;
-    return this->ProcessEmptyScalar(event, token->start_mark);
+    this->Start(sequence_start.anchor);
+  }
+
+  void OnSequenceEnd(const YamlMark& start_mark, const YamlMark&) { this->End(start_mark); }
+
+  void OnMappingStart(const YamlEvent::mapping_start_t& mapping_start, const YamlMark&,
+                      const YamlMark&)
+  {
+    this->Start(mapping_start.anchor);
   }
-}
+
+  void OnMappingEnd(const YamlMark& start_mark, const YamlMark&) { this->End(start_mark); }
+};
 
 /*
- * Parse the productions:
- * flow_sequence        ::= FLOW-SEQUENCE-START
- *                          *******************
- *                          (flow_sequence_entry FLOW-ENTRY)*
- *                           *                   **********
- *                          flow_sequence_entry?
- *                          *
- *                          FLOW-SEQUENCE-END
- *                          *****************
- * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                          *
+ * Skip the next node together with its children.  The parser states run
+ * without building an event, and the scanner leaves out the scalars and the
+ * anchors inside the node.
  */
-bool YamlParser::ParseFlowSequenceEntry(YamlEvent& event, bool isFirst)
+bool YamlParser::SkipNode()
 {
-  YamlToken* token;
+  SkipEvents events = {*this};
 
-  if (isFirst)
-  {
-    token = this->PeekToken();
-    if (!this->marks.Push(*this, token->start_mark)) return 0;
-    this->SkipToken();
-  }
+  assert(!this->push || this->pushed.finished); /* SkipNode takes finished input. */
 
-  token = this->PeekToken();
-  if (!token) return 0;
+  this->skipping = true;
 
-  if (token->type != EYamlTokenType::FlowSequenceEnd)
+  do
   {
-    if (!isFirst)
+    if (this->error != EYamlError::None) goto error;
+
+    // Past the end of the stream, or with no more input, there is no node.
+    if (this->stream_end_produced || this->state == EYamlParserState::End)
     {
-      if (token->type == EYamlTokenType::FlowEntry)
-      {
-        this->SkipToken();
-        token = this->PeekToken();
-        if (!token) return 0;
-      }
-      else
-      {
-        return this->SetParserErrorContext("while parsing a flow sequence", this->marks.Pop(),
-                                           "did not find expected ',' or ']'", token->start_mark);
-      }
+      events.Other(YamlMark());
     }
-
-    if (token->type == EYamlTokenType::Key)
+    else if (!this->StateMachine(events))
     {
-      this->state = EYamlParserState::FlowSequenceEntryMappingKey;
-      event.InitMappingStart(nullptr, nullptr, 1, EYamlMappingStyle::Flow, token->start_mark,
-                             token->end_mark);
-      this->SkipToken();
-      return 1;
+      if (!this->starved) goto error;
+      this->starved = false;
+      events.Other(YamlMark());
     }
+    if (this->error != EYamlError::None) goto error;
 
-    else if (token->type != EYamlTokenType::FlowSequenceEnd)
+    // Only a node may start the skip.
+    if (events.depth < 0)
     {
-      if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntry)) return 0;
-      return this->ParseNode(event, 0, 0);
+      this->SetParserError("did not find expected node to skip", events.mark);
+      goto error;
     }
-  }
+  } while (events.depth > 0);
 
-  this->state = this->states.Pop();
-  (void)this->marks.Pop();
-  event.InitSequenceEnd(token->start_mark, token->end_mark);
-  this->SkipToken();
-  return 1;
-}
+  this->skipping   = false;
+  this->skip_depth = 0;
 
-/*
- * Parse the productions:
- * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                                      *** *
- */
-bool YamlParser::ParseFlowSequenceEntryMappingKey(YamlEvent& event)
-{
-  YamlToken* token;
+  return true;
 
-  token = this->PeekToken();
-  if (!token) return 0;
+error:
+  this->skipping   = false;
+  this->skip_depth = 0;
 
-  if (token->type != EYamlTokenType::Value && token->type != EYamlTokenType::FlowEntry &&
-      token->type != EYamlTokenType::FlowSequenceEnd)
-  {
-    if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntryMappingValue)) return 0;
-    return this->ParseNode(event, 0, 0);
-  }
-  else
-  {
-    YamlMark mark = token->end_mark;
-    this->SkipToken();
-    this->state = EYamlParserState::FlowSequenceEntryMappingValue;
-    return this->ProcessEmptyScalar(event, mark);
-  }
+  return false;
 }
 
 /*
- * Parse the productions:
- * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                                                      ***** *
+ * Set parser error.
  */
-bool YamlParser::ParseFlowSequenceEntryMappingValue(YamlEvent& event)
+bool YamlParser::SetParserError(const char* problem, YamlMark problem_mark)
 {
-  YamlToken* token;
+  this->error        = EYamlError::Parser;
+  this->problem      = problem;
+  this->problem_mark = problem_mark;
 
-  token = this->PeekToken();
-  if (!token) return 0;
+  this->ResolveErrorMarks();
 
-  if (token->type == EYamlTokenType::Value)
-  {
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) return 0;
-    if (token->type != EYamlTokenType::FlowEntry && token->type != EYamlTokenType::FlowSequenceEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::FlowSequenceEntryMappingEnd)) return 0;
-      return this->ParseNode(event, 0, 0);
-    }
-  }
-  this->state = EYamlParserState::FlowSequenceEntryMappingEnd;
-  return this->ProcessEmptyScalar(event, token->start_mark);
+  return false;
 }
 
-/*
- * Parse the productions:
- * flow_sequence_entry  ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                                                                      *
- */
-bool YamlParser::ParseFlowSequenceEntryMappingEnd(YamlEvent& event)
+bool YamlParser::SetParserErrorContext(const char* context, YamlMark context_mark,
+                                       const char* problem, YamlMark problem_mark)
 {
-  YamlToken* token;
-
-  token = this->PeekToken();
-  if (!token) return 0;
+  this->error        = EYamlError::Parser;
+  this->context      = context;
+  this->context_mark = context_mark;
+  this->problem      = problem;
+  this->problem_mark = problem_mark;
 
-  this->state = EYamlParserState::FlowSequenceEntry;
+  this->ResolveErrorMarks();
 
-  event.InitMappingEnd(token->start_mark, token->start_mark);
-  return 1;
+  return false;
 }
 
 /*
- * Parse the productions:
- * flow_mapping         ::= FLOW-MAPPING-START
- *                          ******************
- *                          (flow_mapping_entry FLOW-ENTRY)*
- *                           *                  **********
- *                          flow_mapping_entry?
- *                          ******************
- *                          FLOW-MAPPING-END
- *                          ****************
- * flow_mapping_entry   ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                          *           *** *
+ * String read handler.
  */
-bool YamlParser::ParseFlowMappingKey(YamlEvent& event, bool isFirst)
+static int yaml_string_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                                    size_t* size_read)
 {
-  YamlToken* token;
-
-  if (isFirst)
+  if (parser.input.current == parser.input.end)
   {
-    token = this->PeekToken();
-    if (!this->marks.Push(*this, token->start_mark)) return 0;
-    this->SkipToken();
+    *size_read = 0;
+    return 1;
   }
 
-  token = this->PeekToken();
-  if (!token) return 0;
-
-  if (token->type != EYamlTokenType::FlowMappingEnd)
+  if (size > (size_t)(parser.input.end - parser.input.current))
   {
-    if (!isFirst)
-    {
-      if (token->type == EYamlTokenType::FlowEntry)
-      {
-        this->SkipToken();
-        token = this->PeekToken();
-        if (!token) return 0;
-      }
-      else
-      {
-        return this->SetParserErrorContext("while parsing a flow mapping", this->marks.Pop(),
-                                           "did not find expected ',' or '}'", token->start_mark);
-      }
-    }
-
-    if (token->type == EYamlTokenType::Key)
-    {
-      this->SkipToken();
-      token = this->PeekToken();
-      if (!token) return 0;
-      if (token->type != EYamlTokenType::Value && token->type != EYamlTokenType::FlowEntry &&
-          token->type != EYamlTokenType::FlowMappingEnd)
-      {
-        if (!this->states.Push(*this, EYamlParserState::FlowMappingValue)) return 0;
-        return this->ParseNode(event, 0, 0);
-      }
-      else
-      {
-        this->state = EYamlParserState::FlowMappingValue;
-        return this->ProcessEmptyScalar(event, token->start_mark);
-      }
-    }
-    else if (token->type != EYamlTokenType::FlowMappingEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::FlowMappingEmptyValue)) return 0;
-      return this->ParseNode(event, 0, 0);
-    }
+    size = parser.input.end - parser.input.current;
   }
 
-  this->state = this->states.Pop();
-  (void)this->marks.Pop();
-  event.InitMappingEnd(token->start_mark, token->end_mark);
-  this->SkipToken();
+  memcpy(buffer, parser.input.current, size);
+  parser.input.current += size;
+  *size_read = size;
   return 1;
 }
 
 /*
- * Parse the productions:
- * flow_mapping_entry   ::= flow_node | KEY flow_node? (VALUE flow_node?)?
- *                                   *                  ***** *
+ * Read handler of a file descriptor.
  */
-bool YamlParser::ParseFlowMappingValue(YamlEvent& event, bool isEmpty)
+int mj::yaml_fd_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                             size_t* size_read)
 {
-  YamlToken* token = this->PeekToken();
-  if (!token)
-  {
-    return false;
-  }
+  int fd = (int)(intptr_t)parser.read_handler_data;
 
-  if (isEmpty)
-  {
-    this->state = EYamlParserState::FlowMappingKey;
-    return this->ProcessEmptyScalar(event, token->start_mark);
-  }
+  if (size >= INPUT_READ_ALIGNMENT) size -= size % INPUT_READ_ALIGNMENT;
 
-  if (token->type == EYamlTokenType::Value)
+#ifdef _WIN32
+  if (size > INT_MAX) size = INT_MAX - INT_MAX % INPUT_READ_ALIGNMENT;
+  int result = _read(fd, buffer, (unsigned int)size);
+#else
+  ssize_t result;
+  do
   {
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token)
-    {
-      return false;
-    }
-    if (token->type != EYamlTokenType::FlowEntry && token->type != EYamlTokenType::FlowMappingEnd)
-    {
-      if (!this->states.Push(*this, EYamlParserState::FlowMappingKey))
-      {
-        return false;
-      }
-      return this->ParseNode(event, false, false);
-    }
-  }
+    result = read(fd, buffer, size);
+  } while (result < 0 && errno == EINTR);
+#endif
 
-  this->state = EYamlParserState::FlowMappingKey;
-  return this->ProcessEmptyScalar(event, token->start_mark);
+  if (result < 0) return 0;
+
+  *size_read = (size_t)result;
+  return 1;
 }
 
 /*
- * Generate an empty scalar event.
+ * Read handler of a FILE*.
  */
-bool YamlParser::ProcessEmptyScalar(YamlEvent& event, YamlMark mark)
+int mj::yaml_file_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
+                               size_t* size_read)
 {
-  uint8_t* value;
-
-  value = (decltype(value))this->Malloc(1);
-  if (!value)
-  {
-    this->error = EYamlError::Memory;
-    return false;
-  }
-  value[0] = '\0';
+  FILE* file = (FILE*)parser.read_handler_data;
 
-  event.InitScalar(nullptr, nullptr, value, 0, 1, 0, EYamlScalarStyle::Plain, mark, mark);
+  if (size >= INPUT_READ_ALIGNMENT) size -= size % INPUT_READ_ALIGNMENT;
 
-  return true;
+  *size_read = fread(buffer, 1, size, file);
+  return !ferror(file);
 }
 
 /*
- * Parse directives.
+ * A raw buffer that the reader thread has filled.  A chunk of size 0 ends the
+ * input, and a failed chunk ends it with an error.
  */
-bool YamlParser::ProcessDirectives(YamlVersionDirective** version_directive_ref,
-                                   YamlTagDirective** tag_directives_start_ref,
-                                   YamlTagDirective** tag_directives_end_ref)
+struct YamlAsyncChunk
 {
-  YamlTagDirective default_tag_directives[] = {{(uint8_t*)"!", (uint8_t*)"!"},
-                                               {(uint8_t*)"!!", (uint8_t*)"tag:yaml.org,2002:"},
-                                               {nullptr, nullptr}};
-  YamlTagDirective* default_tag_directive;
-  YamlVersionDirective* version_directive = nullptr;
+  unsigned char* data = nullptr;
+  size_t size         = 0;
+  bool failed         = false;
+};
 
-  YamlStack<YamlTagDirective> tag_directives;
-  YamlToken* token;
+/*
+ * The reader thread of async_reader and the ring of chunks that it fills.
+ * Only the thread moves 'tail' and only the parser moves 'head', so taking
+ * and filling chunks needs no lock.  A side that finds the ring full or empty sleeps on 'wake',
+ * and the other side takes the lock to notify it only if it is waiting.
+ */
+struct mj::YamlAsyncReader
+{
+  YamlAsyncChunk chunks[ASYNC_READER_CHUNKS];
+  size_t chunk_size = 0;
+  // The octets of the chunk at 'head' that the parser has taken.
+  size_t taken = 0;
 
-  if (!tag_directives.Init(*this)) goto error;
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+  std::atomic<bool> stop{false};
 
-  token = this->PeekToken();
-  if (!token) goto error;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::atomic<bool> thread_waiting{false};
+  std::atomic<bool> parser_waiting{false};
 
-  while (token->type == EYamlTokenType::VersionDirective ||
-         token->type == EYamlTokenType::TagDirective)
+  std::thread thread;
+};
+
+/*
+ * Wake the other side of the ring if it sleeps.  The flag is read after the
+ * index was stored, and the waiter sets it before it checks the index again;
+ * both are sequentially consistent, so one of the two sees the other.
+ */
+static void yaml_async_notify(YamlAsyncReader& reader, std::atomic<bool>& waiting)
+{
+  if (!waiting.load()) return;
+
+  std::lock_guard<std::mutex> guard(reader.lock);
+  reader.wake.notify_one();
+}
+
+/*
+ * Fill the ring until the input ends or the parser stops the thread.
+ */
+static void yaml_async_read(YamlParser& parser, yaml_read_handler_t* handler,
+                            YamlAsyncReader& reader)
+{
+  for (size_t tail = 0;; tail++)
   {
-    if (token->type == EYamlTokenType::VersionDirective)
+    // Wait for the parser to take the chunk that was filled a ring ago.
+    if (tail - reader.head.load() == ASYNC_READER_CHUNKS)
     {
-      if (version_directive)
-      {
-        this->SetParserError("found duplicate %YAML directive", token->start_mark);
-        goto error;
-      }
-      if (std::get<YamlToken::version_directive_t>(token->data).major != 1 ||
-          std::get<YamlToken::version_directive_t>(token->data).minor != 1)
+      std::unique_lock<std::mutex> guard(reader.lock);
+      reader.thread_waiting.store(true);
+      while (!reader.stop.load() && tail - reader.head.load() == ASYNC_READER_CHUNKS)
       {
-        this->SetParserError("found incompatible YAML document", token->start_mark);
-        goto error;
-      }
-      version_directive = (decltype(version_directive))this->Malloc(sizeof(*version_directive));
-      if (!version_directive)
-      {
-        this->error = EYamlError::Memory;
-        goto error;
+        reader.wake.wait(guard);
       }
-      version_directive->major = std::get<YamlToken::version_directive_t>(token->data).major;
-      version_directive->minor = std::get<YamlToken::version_directive_t>(token->data).minor;
+      reader.thread_waiting.store(false);
     }
+    if (reader.stop.load(std::memory_order_relaxed)) return;
 
-    else if (token->type == EYamlTokenType::TagDirective)
-    {
-      YamlTagDirective value;
-      value.handle = std::get<YamlToken::tag_directive_t>(token->data).handle;
-      value.prefix = std::get<YamlToken::tag_directive_t>(token->data).prefix;
-
-      if (!this->AppendTagDirective(value, 0, token->start_mark)) goto error;
-      if (!tag_directives.Push(*this, value)) goto error;
-    }
+    YamlAsyncChunk& chunk = reader.chunks[tail % ASYNC_READER_CHUNKS];
+    chunk.size            = 0;
+    chunk.failed          = !handler(parser, chunk.data, reader.chunk_size, &chunk.size);
+    reader.tail.store(tail + 1);
+    yaml_async_notify(reader, reader.parser_waiting);
 
-    this->SkipToken();
-    token = this->PeekToken();
-    if (!token) goto error;
+    if (chunk.failed || !chunk.size) return;
   }
+}
 
-  for (default_tag_directive = default_tag_directives; default_tag_directive->handle;
-       default_tag_directive++)
+/*
+ * Start the thread that reads ahead, with chunks the size of the raw buffer.
+ */
+bool YamlParser::StartAsyncReader()
+{
+  YamlAsyncReader* reader = (YamlAsyncReader*)this->Malloc(sizeof(YamlAsyncReader));
+  size_t k;
+
+  if (!reader)
   {
-    if (!this->AppendTagDirective(*default_tag_directive, 1, token->start_mark)) goto error;
+    this->error = EYamlError::Memory;
+    return false;
   }
+  new (reader) YamlAsyncReader();
+  reader->chunk_size = this->raw_buffer.end - this->raw_buffer.start;
 
-  if (version_directive_ref)
+  for (k = 0; k < ASYNC_READER_CHUNKS; k++)
   {
-    *version_directive_ref = version_directive;
+    reader->chunks[k].data = (unsigned char*)this->Malloc(reader->chunk_size);
+    if (!reader->chunks[k].data) goto error;
   }
-  if (tag_directives_start_ref)
+
+  // Without a thread the handler is called from Parse: async_reader is only a
+  // hint, so it is dropped rather than failing the parse.
+  try
   {
-    if (tag_directives.Empty())
-    {
-      *tag_directives_start_ref = *tag_directives_end_ref = nullptr;
-      tag_directives.Del(*this);
-    }
-    else
-    {
-      *tag_directives_start_ref = tag_directives.start;
-      *tag_directives_end_ref   = tag_directives.top;
-    }
+    reader->thread = std::thread(yaml_async_read, std::ref(*this), this->read_handler,
+                                 std::ref(*reader));
   }
-  else
+  catch (const std::exception&)
   {
-    tag_directives.Del(*this);
+    this->async_reader = false;
+    goto done;
   }
-
-  if (!version_directive_ref) this->Free(version_directive);
+  this->async = reader;
   return true;
 
 error:
-  this->Free(version_directive);
-  while (!tag_directives.Empty())
+  this->error = EYamlError::Memory;
+done:
+  while (k--)
   {
-    YamlTagDirective tag_directive = tag_directives.Pop();
-    this->Free(tag_directive.handle);
-    this->Free(tag_directive.prefix);
+    this->Free(reader->chunks[k].data);
   }
-  tag_directives.Del(*this);
-  return false;
+  reader->~YamlAsyncReader();
+  this->Free(reader);
+  return this->error == EYamlError::None;
 }
 
 /*
- * Append a tag directive to the directives stack.
+ * Stop the thread that reads ahead and free its chunks.  A read that the
+ * thread is in is waited out.
  */
-bool YamlParser::AppendTagDirective(YamlTagDirective value, bool allow_duplicates, YamlMark mark)
+void YamlParser::StopAsyncReader()
 {
-  YamlTagDirective* tag_directive;
-  YamlTagDirective copy = {nullptr, nullptr};
+  YamlAsyncReader* reader = this->async;
+
+  if (!reader) return;
 
-  for (tag_directive = this->tag_directives.start; tag_directive != this->tag_directives.top;
-       tag_directive++)
   {
-    if (strcmp((char*)value.handle, (char*)tag_directive->handle) == 0)
-    {
-      if (allow_duplicates) return true;
-      return this->SetParserError("found duplicate %TAG directive", mark);
-    }
+    std::lock_guard<std::mutex> guard(reader->lock);
+    reader->stop.store(true);
+    reader->wake.notify_all();
   }
-
-  copy.handle = (decltype(copy.prefix))this->Strdup((char*)value.handle);
-  copy.prefix = (decltype(copy.prefix))this->Strdup((char*)value.prefix);
-  if (!copy.handle || !copy.prefix)
+  reader->thread.join();
+  for (size_t k = 0; k < ASYNC_READER_CHUNKS; k++)
   {
-    this->error = EYamlError::Memory;
-    goto error;
+    this->Free(reader->chunks[k].data);
   }
-
-  if (!this->tag_directives.Push(*this, copy)) goto error;
-
-  return true;
-
-error:
-  this->Free(copy.handle);
-  this->Free(copy.prefix);
-  return false;
+  reader->~YamlAsyncReader();
+  this->Free(reader);
+  this->async = nullptr;
 }
 
 /*
- * Get the next event.
+ * Take up to 'size' octets of what the reader thread has read, in place of
+ * calling the read handler.  The chunk that ends the input stays at the head
+ * of the ring, so that every later read ends the same way.
  */
-bool YamlParser::Parse(YamlEvent& event)
+bool YamlParser::ReadAsync(unsigned char* buffer, size_t size, size_t* size_read)
 {
-  // Erase the event object.
-  event = {};
+  YamlAsyncReader& reader = *this->async;
+  size_t head             = reader.head.load(std::memory_order_relaxed);
 
-  // No events after the end of the stream or error.
-  if (this->stream_end_produced || (this->error != EYamlError::None) ||
-      this->state == EYamlParserState::End)
+  if (reader.tail.load() == head)
   {
-    return true;
+    std::unique_lock<std::mutex> guard(reader.lock);
+    reader.parser_waiting.store(true);
+    while (reader.tail.load() == head)
+    {
+      reader.wake.wait(guard);
+    }
+    reader.parser_waiting.store(false);
   }
 
-  // Generate the next event.
-  return this->StateMachine(event);
-}
+  YamlAsyncChunk& chunk = reader.chunks[head % ASYNC_READER_CHUNKS];
+  if (chunk.failed) return false;
 
-/*
- * Set parser error.
- */
-bool YamlParser::SetParserError(const char* problem, YamlMark problem_mark)
-{
-  this->error        = EYamlError::Parser;
-  this->problem      = problem;
-  this->problem_mark = problem_mark;
+  if (size > chunk.size - reader.taken)
+  {
+    size = chunk.size - reader.taken;
+  }
+  memcpy(buffer, chunk.data + reader.taken, size);
+  reader.taken += size;
+  *size_read = size;
 
-  return false;
-}
-
-bool YamlParser::SetParserErrorContext(const char* context, YamlMark context_mark,
-                                       const char* problem, YamlMark problem_mark)
-{
-  this->error        = EYamlError::Parser;
-  this->context      = context;
-  this->context_mark = context_mark;
-  this->problem      = problem;
-  this->problem_mark = problem_mark;
-
-  return false;
-}
-
-/*
- * String read handler.
- */
-static int yaml_string_read_handler(YamlParser& parser, unsigned char* buffer, size_t size,
-                                    size_t* size_read)
-{
-  if (parser.input.current == parser.input.end)
-  {
-    *size_read = 0;
-    return 1;
-  }
-
-  if (size > (size_t)(parser.input.end - parser.input.current))
+  // Hand a chunk that is used up back to the thread.
+  if (chunk.size && reader.taken == chunk.size)
   {
-    size = parser.input.end - parser.input.current;
+    reader.taken = 0;
+    reader.head.store(head + 1);
+    yaml_async_notify(reader, reader.thread_waiting);
   }
 
-  memcpy(buffer, parser.input.current, size);
-  parser.input.current += size;
-  *size_read = size;
-  return 1;
+  return true;
 }
 
 YamlParser::YamlParser(const YamlFns& Fns, const unsigned char* input, size_t size)
@@ -5082,6 +6418,8 @@ YamlParser::YamlParser(const YamlFns& Fns, const unsigned char* input, size_t si
   this->Free    = Fns.Free;
   this->Strdup  = Fns.Strdup;
 
+  this->arena.block_size = Fns.ArenaBlockSize;
+
   this->read_handler      = yaml_string_read_handler;
   this->read_handler_data = this;
 
@@ -5089,14 +6427,17 @@ YamlParser::YamlParser(const YamlFns& Fns, const unsigned char* input, size_t si
   this->input.current = input;
   this->input.end     = input + size;
 
-  if (!this->raw_buffer.Init(*this, INPUT_RAW_BUFFER_SIZE)) goto error;
-  if (!this->buffer.Init(*this, INPUT_BUFFER_SIZE)) goto error;
+  // The raw buffer and the buffer are only allocated if the reader has to
+  // leave the input.
+  this->in_place = true;
+
   if (!this->tokens.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
   if (!this->indents.Init(*this)) goto error;
   if (!this->simple_keys.Init(*this)) goto error;
   if (!this->states.Init(*this)) goto error;
   if (!this->marks.Init(*this)) goto error;
   if (!this->tag_directives.Init(*this)) goto error;
+  if (this->arena.block_size && !this->document_marks.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
 
   return;
 
@@ -5105,6 +6446,80 @@ error:
   // TODO: this is moved to the constructor but this can
   // currently fail
 
+  this->tokens.Del(*this);
+  this->indents.Del(*this);
+  this->simple_keys.Del(*this);
+  this->states.Del(*this);
+  this->marks.Del(*this);
+  this->tag_directives.Del(*this);
+  this->document_marks.Del(*this);
+}
+
+YamlParser::YamlParser(const YamlFns& Fns, const char* path)
+{
+  this->Malloc  = Fns.Malloc;
+  this->Realloc = Fns.Realloc;
+  this->Free    = Fns.Free;
+  this->Strdup  = Fns.Strdup;
+
+  this->arena.block_size = Fns.ArenaBlockSize;
+
+  this->read_handler      = yaml_string_read_handler;
+  this->read_handler_data = this;
+
+  if (!this->MapFile(path)) return;
+
+  // The raw buffer and the buffer are only allocated if the reader has to
+  // leave the mapping.
+  this->in_place = true;
+
+  if (!this->tokens.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+  if (!this->indents.Init(*this)) goto error;
+  if (!this->simple_keys.Init(*this)) goto error;
+  if (!this->states.Init(*this)) goto error;
+  if (!this->marks.Init(*this)) goto error;
+  if (!this->tag_directives.Init(*this)) goto error;
+  if (this->arena.block_size && !this->document_marks.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+
+  return;
+
+error:
+  this->tokens.Del(*this);
+  this->indents.Del(*this);
+  this->simple_keys.Del(*this);
+  this->states.Del(*this);
+  this->marks.Del(*this);
+  this->tag_directives.Del(*this);
+  this->document_marks.Del(*this);
+}
+
+YamlParser::YamlParser(const YamlFns& Fns)
+{
+  this->Malloc  = Fns.Malloc;
+  this->Realloc = Fns.Realloc;
+  this->Free    = Fns.Free;
+  this->Strdup  = Fns.Strdup;
+
+  this->arena.block_size = Fns.ArenaBlockSize;
+
+  // The pieces are gathered where the string read handler takes them from.
+  this->read_handler      = yaml_string_read_handler;
+  this->read_handler_data = this;
+  this->push              = true;
+
+  if (!this->raw_buffer.Init(*this, INPUT_RAW_BUFFER_SIZE)) goto error;
+  if (!this->buffer.Init(*this, INPUT_BUFFER_SIZE)) goto error;
+  if (!this->tokens.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+  if (!this->indents.Init(*this)) goto error;
+  if (!this->simple_keys.Init(*this)) goto error;
+  if (!this->states.Init(*this)) goto error;
+  if (!this->marks.Init(*this)) goto error;
+  if (!this->tag_directives.Init(*this)) goto error;
+  if (this->arena.block_size && !this->document_marks.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+
+  return;
+
+error:
   this->raw_buffer.Del(*this);
   this->buffer.Del(*this);
   this->tokens.Del(*this);
@@ -5113,12 +6528,165 @@ error:
   this->states.Del(*this);
   this->marks.Del(*this);
   this->tag_directives.Del(*this);
+  this->document_marks.Del(*this);
 }
 
-YamlParser::~YamlParser()
+YamlParser::YamlParser(const YamlFns& Fns, yaml_read_handler_t* handler, void* data,
+                       size_t raw_buffer_size)
 {
+  this->Malloc  = Fns.Malloc;
+  this->Realloc = Fns.Realloc;
+  this->Free    = Fns.Free;
+  this->Strdup  = Fns.Strdup;
+
+  this->arena.block_size = Fns.ArenaBlockSize;
+
+  this->read_handler      = handler;
+  this->read_handler_data = data;
+
+  if (!raw_buffer_size) raw_buffer_size = INPUT_RAW_BUFFER_SIZE;
+  if (raw_buffer_size < MIN_RAW_BUFFER_SIZE)
+  {
+    this->SetReaderError("raw buffer is too small", 0, -1);
+    return;
+  }
+
+  // The buffer has room for the whole raw buffer decoded, as with
+  // INPUT_BUFFER_SIZE, behind the characters that are still unread.  With a
+  // small raw buffer those are not lost in the slack.
+  if (!this->raw_buffer.Init(*this, raw_buffer_size)) goto error;
+  if (!this->buffer.Init(*this, raw_buffer_size * 3 + MAX_CACHE_LENGTH * 4)) goto error;
+  if (!this->tokens.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+  if (!this->indents.Init(*this)) goto error;
+  if (!this->simple_keys.Init(*this)) goto error;
+  if (!this->states.Init(*this)) goto error;
+  if (!this->marks.Init(*this)) goto error;
+  if (!this->tag_directives.Init(*this)) goto error;
+  if (this->arena.block_size && !this->document_marks.Init(*this, INITIAL_QUEUE_SIZE)) goto error;
+
+  return;
+
+error:
   this->raw_buffer.Del(*this);
   this->buffer.Del(*this);
+  this->tokens.Del(*this);
+  this->indents.Del(*this);
+  this->simple_keys.Del(*this);
+  this->states.Del(*this);
+  this->marks.Del(*this);
+  this->tag_directives.Del(*this);
+  this->document_marks.Del(*this);
+}
+
+/*
+ * Map the input file into memory.
+ */
+bool YamlParser::MapFile(const char* path)
+{
+  const unsigned char* data = nullptr;
+  size_t size               = 0;
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return this->SetReaderError("could not open the input file", 0, -1);
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || (unsigned long long)file_size.QuadPart > SIZE_MAX)
+  {
+    CloseHandle(file);
+    return this->SetReaderError("could not determine the input file size", 0, -1);
+  }
+  size = (size_t)file_size.QuadPart;
+
+  // Empty files cannot be mapped.
+  if (size)
+  {
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+    {
+      // The view keeps the mapping alive.
+      data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+  {
+    return this->SetReaderError("could not open the input file", 0, -1);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (unsigned long long)st.st_size > SIZE_MAX)
+  {
+    close(fd);
+    return this->SetReaderError("could not determine the input file size", 0, -1);
+  }
+  size = (size_t)st.st_size;
+
+  // Empty files cannot be mapped.
+  if (size)
+  {
+    void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED)
+    {
+      // The input is read front to back exactly once.
+      madvise(view, size, MADV_SEQUENTIAL);
+      data = (const unsigned char*)view;
+    }
+  }
+  close(fd);
+#endif
+
+  if (size && !data)
+  {
+    return this->SetReaderError("could not map the input file", 0, -1);
+  }
+
+  this->mapped        = (data != nullptr);
+  this->input.start   = data;
+  this->input.current = data;
+  this->input.end     = data + size;
+
+  return true;
+}
+
+/*
+ * Unmap the input file.
+ */
+void YamlParser::UnmapFile()
+{
+  if (!this->mapped) return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(this->input.start);
+#else
+  munmap((void*)this->input.start, this->input.end - this->input.start);
+#endif
+
+  this->mapped = false;
+}
+
+YamlParser::~YamlParser()
+{
+  // The reader thread fills the parser's chunks until it is stopped.
+  this->StopAsyncReader();
+  this->raw_buffer.Del(*this);
+  // In-place input is not owned by the buffer.
+  if (!this->in_place)
+  {
+    this->buffer.Del(*this);
+  }
+  this->UnmapFile();
+  if (this->push)
+  {
+    this->Free((void*)this->input.start);
+  }
   while (!this->tokens.Empty())
   {
     this->tokens.Dequeue().Delete(*this);
@@ -5135,69 +6703,2364 @@ YamlParser::~YamlParser()
     this->Free(tag_directive.prefix);
   }
   this->tag_directives.Del(*this);
+  this->document_marks.Del(*this);
+  this->ClearComposer();
+  this->composer_nodes.Del(*this);
+  this->composer_items.Del(*this);
+  this->composer_pairs.Del(*this);
+  this->composer_children.Del(*this);
+  this->composer_frames.Del(*this);
+  this->aliases.Del(*this);
+  this->tags.Del(*this);
+  this->scratch.Del(*this);
+  this->line_starts.Del(*this);
+  this->arena.Del(*this);
+  this->kept_buffer.Del(*this);
 
   memset(this, 0, sizeof(*this));
 }
 
 /*
- * State dispatcher.
+ * Start over on new input in memory.  Everything the parser held of the
+ * previous input is dropped, but the buffers, stacks and queues keep their
+ * storage and the arena keeps its blocks.
  */
-bool YamlParser::StateMachine(YamlEvent& event)
+bool YamlParser::Reset(const unsigned char* input, size_t size)
 {
-  switch (this->state)
-  {
-  case EYamlParserState::StreamStart:
-    return this->ParseStreamStart(event);
-  case EYamlParserState::ImplicitDocumentStart:
-    return this->ParseDocumentStart(event, true);
-  case EYamlParserState::DocumentStart:
-    return this->ParseDocumentStart(event, false);
-  case EYamlParserState::DocumentContent:
-    return this->ParseDocumentContent(event);
-  case EYamlParserState::DocumentEnd:
-    return this->ParseDocumentEnd(event);
-  case EYamlParserState::BlockNode:
-    return this->ParseNode(event, true, false);
-  case EYamlParserState::BlockNodeOrIndentlessSequence:
-    return this->ParseNode(event, true, true);
-  case EYamlParserState::FlowNode:
-    return this->ParseNode(event, false, false);
-  case EYamlParserState::BlockSequenceFirstEntry:
-    return this->ParseBlockSequenceEntry(event, true);
-  case EYamlParserState::BlockSequenceEntry:
-    return this->ParseBlockSequenceEntry(event, false);
-  case EYamlParserState::IndentlessSequenceEntry:
-    return this->ParseIndentlessSequenceEntry(event);
-  case EYamlParserState::BlockMappingFirstKey:
-    return this->ParseBlockMappingKey(event, true);
-  case EYamlParserState::BlockMappingKey:
-    return this->ParseBlockMappingKey(event, false);
-  case EYamlParserState::BlockMappingValue:
-    return this->ParseBlockMappingValue(event);
-  case EYamlParserState::FlowSequenceFirstEntry:
-    return this->ParseFlowSequenceEntry(event, true);
-  case EYamlParserState::FlowSequenceEntry:
-    return this->ParseFlowSequenceEntry(event, false);
-  case EYamlParserState::FlowSequenceEntryMappingKey:
-    return this->ParseFlowSequenceEntryMappingKey(event);
-  case EYamlParserState::FlowSequenceEntryMappingValue:
-    return this->ParseFlowSequenceEntryMappingValue(event);
-  case EYamlParserState::FlowSequenceEntryMappingEnd:
-    return this->ParseFlowSequenceEntryMappingEnd(event);
-  case EYamlParserState::FlowMappingFirstKey:
-    return this->ParseFlowMappingKey(event, true);
-  case EYamlParserState::FlowMappingKey:
-    return this->ParseFlowMappingKey(event, false);
-  case EYamlParserState::FlowMappingValue:
-    return this->ParseFlowMappingValue(event, false);
-  case EYamlParserState::FlowMappingEmptyValue:
-    return this->ParseFlowMappingValue(event, true);
-  case EYamlParserState::End:
-    break;
-  default:
-    break;
+  // Let go of the source of the previous input.
+  this->StopAsyncReader();
+  this->UnmapFile();
+  if (this->push)
+  {
+    this->Free((void*)this->input.start);
+    this->push   = false;
+    this->pushed = YamlPushInput();
+  }
+
+  // An in-place buffer only points into the input. The owned buffers are kept
+  // for LeaveInPlace if they have the sizes it allocates.
+  if (this->in_place)
+  {
+    this->buffer = YamlBuffer();
+  }
+  if (this->raw_buffer.start &&
+      (size_t)(this->raw_buffer.end - this->raw_buffer.start) != INPUT_RAW_BUFFER_SIZE)
+  {
+    this->raw_buffer.Del(*this);
+    this->buffer.Del(*this);
+  }
+  if (this->buffer.start)
+  {
+    this->kept_buffer         = this->buffer;
+    this->kept_buffer.pointer = this->kept_buffer.start;
+    this->kept_buffer.last    = this->kept_buffer.start;
+    this->buffer              = YamlBuffer();
+  }
+  this->raw_buffer.pointer = this->raw_buffer.start;
+  this->raw_buffer.last    = this->raw_buffer.start;
+
+  // Drop what was scanned, parsed and composed of the previous input.
+  while (!this->tokens.Empty())
+  {
+    this->tokens.Dequeue().Delete(*this);
   }
+  while (!this->tag_directives.Empty())
+  {
+    YamlTagDirective tag_directive = this->tag_directives.Pop();
+    this->Free(tag_directive.handle);
+    this->Free(tag_directive.prefix);
+  }
+  this->ClearComposer();
+  this->document = nullptr;
+  this->arena.Release(*this, this->arena.Mark());
+  this->document_marks.head = this->document_marks.tail;
+  this->indents.top         = this->indents.start;
+  this->simple_keys.top     = this->simple_keys.start;
+  this->states.top          = this->states.start;
+  this->marks.top           = this->marks.start;
+  this->line_starts.top     = this->line_starts.start;
+
+  this->error          = EYamlError::None;
+  this->problem        = nullptr;
+  this->problem_offset = 0;
+  this->problem_value  = 0;
+  this->problem_mark   = YamlMark();
+  this->context        = nullptr;
+  this->context_mark   = YamlMark();
+
+  this->read_handler      = yaml_string_read_handler;
+  this->read_handler_data = this;
+
+  this->input.start   = input;
+  this->input.current = input;
+  this->input.end     = input + size;
+
+  this->eof                   = false;
+  this->in_place              = true;
+  this->starved               = false;
+  this->unread                = 0;
+  this->encoding              = EYamlEncoding::Any;
+  this->offset                = 0;
+  this->mark                  = YamlMark();
+  this->line_start            = 0;
+  this->stream_start_produced = false;
+  this->stream_end_produced   = false;
+  this->flow_level            = 0;
+  this->tokens_parsed         = 0;
+  this->token_available       = false;
+  this->indent                = 0;
+  this->simple_key_allowed    = false;
+  this->oldest_simple_key     = 0;
+  this->state                 = EYamlParserState::StreamStart;
+  this->in_directives         = false;
+  this->skipping              = false;
+  this->skip_depth            = 0;
+
+  // A parser whose file could not be mapped has no stacks yet.
+  if (!this->tokens.start && !this->tokens.Init(*this, INITIAL_QUEUE_SIZE)) return false;
+  if (!this->indents.start && !this->indents.Init(*this)) return false;
+  if (!this->simple_keys.start && !this->simple_keys.Init(*this)) return false;
+  if (!this->states.start && !this->states.Init(*this)) return false;
+  if (!this->marks.start && !this->marks.Init(*this)) return false;
+  if (!this->tag_directives.start && !this->tag_directives.Init(*this)) return false;
+  if (this->arena.block_size && !this->document_marks.start &&
+      !this->document_marks.Init(*this, INITIAL_QUEUE_SIZE))
+    return false;
 
-  event.type = EYamlEventType::StreamEnd;
   return true;
 }
+
+bool YamlParser::Reset(const char* path)
+{
+  return this->Reset(nullptr, 0) && this->MapFile(path);
+}
+
+// YamlDocument
+
+/*
+ * The tags of nodes that have none, or the non-specific tag '!'.
+ */
+static uint8_t yaml_default_scalar_tag[]   = "tag:yaml.org,2002:str";
+static uint8_t yaml_default_sequence_tag[] = "tag:yaml.org,2002:seq";
+static uint8_t yaml_default_mapping_tag[]  = "tag:yaml.org,2002:map";
+
+static bool yaml_is_default_tag(const uint8_t* tag)
+{
+  return tag == yaml_default_scalar_tag || tag == yaml_default_sequence_tag ||
+         tag == yaml_default_mapping_tag;
+}
+
+/*
+ * Free the values that a node owns.
+ */
+static void yaml_node_delete(YamlParser& parser, YamlNode& node)
+{
+  if (node.type == EYamlNodeType::Scalar && !std::get<YamlNode::scalar_t>(node.data).borrowed)
+  {
+    parser.ValueFree(std::get<YamlNode::scalar_t>(node.data).value);
+  }
+}
+
+YamlNode* YamlDocument::GetNode(int index)
+{
+  if (index > 0 && this->nodes.start + index <= this->nodes.top)
+  {
+    return this->nodes.start + index - 1;
+  }
+  return nullptr;
+}
+
+YamlNode* YamlDocument::GetRootNode()
+{
+  if (this->nodes.top != this->nodes.start)
+  {
+    return this->nodes.start;
+  }
+  return nullptr;
+}
+
+int* YamlDocument::GetItems(const YamlNode& node)
+{
+  assert(node.type == EYamlNodeType::Sequence);
+  return this->items.start + std::get<YamlNode::sequence_t>(node.data).start;
+}
+
+YamlNodePair* YamlDocument::GetPairs(const YamlNode& node)
+{
+  assert(node.type == EYamlNodeType::Mapping);
+  return this->pairs.start + std::get<YamlNode::mapping_t>(node.data).start;
+}
+
+void YamlDocument::Delete(YamlParser& parser)
+{
+  for (YamlNode* node = this->nodes.start; node != this->nodes.top; node++)
+  {
+    yaml_node_delete(parser, *node);
+  }
+  parser.ValueFree(this->nodes.start);
+  parser.ValueFree(this->items.start);
+  parser.ValueFree(this->pairs.start);
+
+  parser.ValueFree(this->version_directive);
+  for (YamlTagDirective* tag_directive = this->tag_directives.start;
+       tag_directive != this->tag_directives.end; tag_directive++)
+  {
+    parser.ValueFree(tag_directive->handle);
+    parser.ValueFree(tag_directive->prefix);
+  }
+  parser.ValueFree(this->tag_directives.start);
+
+  *this = {};
+}
+
+// YamlAliasMap
+
+/*
+ * FNV-1a over the anchor, or a multiplicative hash of the number that it was
+ * taken as.
+ */
+static size_t yaml_hash_anchor(const uint8_t* anchor, uint64_t number)
+{
+  uint64_t hash = 14695981039346656037ULL;
+
+  if (!anchor)
+  {
+    hash = number * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash ^ (hash >> 32));
+  }
+  while (*anchor)
+  {
+    hash = (hash ^ *anchor++) * 1099511628211ULL;
+  }
+  return (size_t)hash;
+}
+
+YamlAlias* YamlAliasMap::Find(const uint8_t* anchor, uint64_t number)
+{
+  size_t mask = this->capacity - 1;
+  size_t k;
+
+  if (!this->count) return nullptr;
+
+  for (k = yaml_hash_anchor(anchor, number) & mask; this->start[k].index; k = (k + 1) & mask)
+  {
+    YamlAlias& slot = this->start[k];
+    if (anchor ? slot.anchor && strcmp((char*)slot.anchor, (char*)anchor) == 0
+               : !slot.anchor && slot.number == number)
+    {
+      return &slot;
+    }
+  }
+
+  return nullptr;
+}
+
+bool YamlAliasMap::Insert(YamlParser& parser, const YamlAlias& alias)
+{
+  size_t mask;
+  size_t k;
+
+  // Keep the table at most half full.
+  if ((this->count + 1) * 2 > this->capacity && !this->Grow(parser))
+  {
+    parser.error = EYamlError::Memory;
+    return false;
+  }
+
+  mask = this->capacity - 1;
+  for (k = yaml_hash_anchor(alias.anchor, alias.number) & mask; this->start[k].index;
+       k = (k + 1) & mask)
+  {
+  }
+
+  this->start[k] = alias;
+  this->count++;
+
+  return true;
+}
+
+bool YamlAliasMap::Grow(YamlParser& parser)
+{
+  YamlAlias* old      = this->start;
+  size_t old_capacity = this->capacity;
+  size_t capacity     = old_capacity ? old_capacity * 2 : INITIAL_STACK_SIZE;
+  size_t k;
+
+  this->start = (YamlAlias*)parser.Malloc(capacity * sizeof(YamlAlias));
+  if (!this->start)
+  {
+    this->start = old;
+    return false;
+  }
+  for (k = 0; k < capacity; k++)
+  {
+    this->start[k] = YamlAlias();
+  }
+  this->capacity = capacity;
+  this->count    = 0;
+
+  // Rehash; the new table has room for all of the old anchors.
+  for (k = 0; k < old_capacity; k++)
+  {
+    if (old[k].index) this->Insert(parser, old[k]);
+  }
+  parser.Free(old);
+
+  return true;
+}
+
+/*
+ * Forget the anchors of a document and free them.
+ */
+void YamlAliasMap::Clear(YamlParser& parser)
+{
+  size_t k;
+
+  if (!this->count) return;
+
+  for (k = 0; k < this->capacity; k++)
+  {
+    parser.ValueFree(this->start[k].anchor);
+    this->start[k] = YamlAlias();
+  }
+  this->count = 0;
+}
+
+void YamlAliasMap::Del(YamlParser& parser)
+{
+  this->Clear(parser);
+  parser.Free(this->start);
+  *this = YamlAliasMap();
+}
+
+// YamlTagTable
+
+/*
+ * FNV-1a over a tag, as the prefix of its handle followed by its suffix.
+ */
+static size_t yaml_hash_tag(const uint8_t* prefix, size_t prefix_length, const uint8_t* suffix,
+                            size_t suffix_length)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t k;
+
+  for (k = 0; k < prefix_length; k++)
+  {
+    hash = (hash ^ prefix[k]) * 1099511628211ULL;
+  }
+  for (k = 0; k < suffix_length; k++)
+  {
+    hash = (hash ^ suffix[k]) * 1099511628211ULL;
+  }
+  return (size_t)hash;
+}
+
+/*
+ * Start the table with the default tags, under their fixed IDs.  They are not
+ * copied.
+ */
+bool YamlTagTable::Init(YamlParser& parser)
+{
+  static uint8_t* defaults[] = {yaml_default_scalar_tag, yaml_default_sequence_tag,
+                                yaml_default_mapping_tag};
+
+  if (!this->names.Init(parser)) return false;
+
+  for (uint8_t* name : defaults)
+  {
+    YamlTag tag;
+    tag.name   = name;
+    tag.length = strlen((char*)name);
+    tag.id     = (int)(this->names.top - this->names.start) + 1;
+    if (!this->names.Push(parser, name) || !this->Insert(parser, tag))
+    {
+      this->Del(parser);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Find the tag that is the prefix followed by the suffix, or add it.  The
+ * prefix is null for a tag without a handle.
+ */
+const YamlTag* YamlTagTable::Intern(YamlParser& parser, const uint8_t* prefix,
+                                    size_t prefix_length, const uint8_t* suffix,
+                                    size_t suffix_length)
+{
+  size_t length = prefix_length + suffix_length;
+  YamlTag* inserted;
+  YamlTag tag;
+  size_t mask;
+  size_t k;
+
+  if (!this->capacity && !this->Init(parser)) return nullptr;
+
+  mask = this->capacity - 1;
+  for (k = yaml_hash_tag(prefix, prefix_length, suffix, suffix_length) & mask; this->start[k].name;
+       k = (k + 1) & mask)
+  {
+    YamlTag& slot = this->start[k];
+    if (slot.length == length && (!prefix_length || !memcmp(slot.name, prefix, prefix_length)) &&
+        !memcmp(slot.name + prefix_length, suffix, suffix_length))
+    {
+      return &slot;
+    }
+  }
+
+  // The names outlive the documents, so they are not in the arena.
+  tag.name = (uint8_t*)parser.Malloc(length + 1);
+  if (!tag.name)
+  {
+    parser.error = EYamlError::Memory;
+    return nullptr;
+  }
+  if (prefix_length) memcpy(tag.name, prefix, prefix_length);
+  memcpy(tag.name + prefix_length, suffix, suffix_length);
+  tag.name[length] = '\0';
+  tag.length       = length;
+  tag.id           = (int)(this->names.top - this->names.start) + 1;
+
+  if (!this->names.Push(parser, tag.name))
+  {
+    parser.Free(tag.name);
+    return nullptr;
+  }
+  inserted = this->Insert(parser, tag);
+  if (!inserted)
+  {
+    this->names.top--;
+    parser.Free(tag.name);
+  }
+
+  return inserted;
+}
+
+/*
+ * Add a tag that is in the names but not in the table yet.
+ */
+YamlTag* YamlTagTable::Insert(YamlParser& parser, const YamlTag& tag)
+{
+  size_t mask;
+  size_t k;
+
+  // Keep the table at most half full.
+  if ((size_t)(this->names.top - this->names.start) * 2 > this->capacity && !this->Grow(parser))
+  {
+    parser.error = EYamlError::Memory;
+    return nullptr;
+  }
+
+  mask = this->capacity - 1;
+  for (k = yaml_hash_tag(nullptr, 0, tag.name, tag.length) & mask; this->start[k].name;
+       k = (k + 1) & mask)
+  {
+  }
+
+  this->start[k] = tag;
+
+  return this->start + k;
+}
+
+bool YamlTagTable::Grow(YamlParser& parser)
+{
+  YamlTag* old        = this->start;
+  size_t old_capacity = this->capacity;
+  size_t capacity     = old_capacity ? old_capacity * 2 : INITIAL_STACK_SIZE;
+  size_t k;
+
+  this->start = (YamlTag*)parser.Malloc(capacity * sizeof(YamlTag));
+  if (!this->start)
+  {
+    this->start = old;
+    return false;
+  }
+  for (k = 0; k < capacity; k++)
+  {
+    this->start[k] = YamlTag();
+  }
+  this->capacity = capacity;
+
+  // Rehash; the new table has room for all of the old tags.
+  for (k = 0; k < old_capacity; k++)
+  {
+    if (old[k].name) this->Insert(parser, old[k]);
+  }
+  parser.Free(old);
+
+  return true;
+}
+
+void YamlTagTable::Del(YamlParser& parser)
+{
+  for (uint8_t** name = this->names.start; name != this->names.top; name++)
+  {
+    if (!yaml_is_default_tag(*name)) parser.Free(*name);
+  }
+  this->names.Del(parser);
+  parser.Free(this->start);
+  *this = YamlTagTable();
+}
+
+const uint8_t* YamlParser::GetTag(int id)
+{
+  // The default tags have their IDs before any tag is interned.
+  if (!this->tags.capacity && !this->tags.Init(*this)) return nullptr;
+
+  if (id < 1 || id > this->tags.names.top - this->tags.names.start) return nullptr;
+  return this->tags.names.start[id - 1];
+}
+
+// Composer
+
+/*
+ * Compose the next document of the stream.
+ */
+bool YamlParser::Load(YamlDocument& document)
+{
+  YamlEvent event;
+
+  document = {};
+
+  assert(!this->push || this->pushed.finished); /* Load takes finished input. */
+
+  if (!this->stream_start_produced)
+  {
+    if (!this->Parse(event)) goto error;
+    assert(event.type == EYamlEventType::StreamStart);
+  }
+
+  if (this->stream_end_produced) return true;
+
+  if (!this->composer_nodes.start)
+  {
+    if (!this->composer_nodes.Init(*this)) goto error;
+    if (!this->composer_items.Init(*this)) goto error;
+    if (!this->composer_pairs.Init(*this)) goto error;
+    if (!this->composer_children.Init(*this)) goto error;
+    if (!this->composer_frames.Init(*this)) goto error;
+  }
+
+  // Like Parse, there are no documents after the end of the stream or error.
+  if (!this->Parse(event)) goto error;
+  if (event.type != EYamlEventType::DocumentStart) return true;
+
+  this->document = &document;
+
+  if (!this->LoadDocument(event)) goto error;
+
+  this->ClearComposer();
+  this->document = nullptr;
+
+  return true;
+
+error:
+  this->ClearComposer();
+  document.Delete(*this);
+  this->document = nullptr;
+
+  return false;
+}
+
+/*
+ * Set composer error.
+ */
+bool YamlParser::SetComposerError(const char* problem, YamlMark problem_mark)
+{
+  this->error        = EYamlError::Composer;
+  this->problem      = problem;
+  this->problem_mark = problem_mark;
+
+  this->ResolveErrorMarks();
+
+  return false;
+}
+
+bool YamlParser::SetComposerErrorContext(const char* context, YamlMark context_mark,
+                                         const char* problem, YamlMark problem_mark)
+{
+  this->error        = EYamlError::Composer;
+  this->context      = context;
+  this->context_mark = context_mark;
+  this->problem      = problem;
+  this->problem_mark = problem_mark;
+
+  this->ResolveErrorMarks();
+
+  return false;
+}
+
+/*
+ * Free what is left of an unfinished document and forget its anchors.
+ */
+void YamlParser::ClearComposer()
+{
+  for (YamlNode* node = this->composer_nodes.start; node != this->composer_nodes.top; node++)
+  {
+    yaml_node_delete(*this, *node);
+  }
+  this->composer_nodes.top    = this->composer_nodes.start;
+  this->composer_items.top    = this->composer_items.start;
+  this->composer_pairs.top    = this->composer_pairs.start;
+  this->composer_children.top = this->composer_children.start;
+  this->composer_frames.top   = this->composer_frames.start;
+
+  this->aliases.Clear(*this);
+}
+
+/*
+ * Compose a document object.
+ */
+bool YamlParser::LoadDocument(YamlEvent& event)
+{
+  YamlEvent::document_start_t& document_start =
+      std::get<YamlEvent::document_start_t>(event.data);
+
+  assert(event.type == EYamlEventType::DocumentStart);
+
+  // The document takes over the directives of the event.
+  this->document->version_directive    = document_start.version_directive;
+  this->document->tag_directives.start = document_start.tag_directives.start;
+  this->document->tag_directives.end   = document_start.tag_directives.end;
+  this->document->start_implicit       = document_start.implicit;
+  this->document->start_mark           = event.start_mark;
+
+  return this->LoadNodes() && this->FinishDocument();
+}
+
+/*
+ * Compose the nodes of a document.
+ */
+bool YamlParser::LoadNodes()
+{
+  YamlEvent event;
+
+  do
+  {
+    if (!this->Parse(event)) return false;
+
+    switch (event.type)
+    {
+    case EYamlEventType::Alias:
+      if (!this->LoadAlias(event)) return false;
+      break;
+    case EYamlEventType::Scalar:
+      if (!this->LoadScalar(event)) return false;
+      break;
+    case EYamlEventType::SequenceStart:
+      if (!this->LoadSequence(event)) return false;
+      break;
+    case EYamlEventType::SequenceEnd:
+      if (!this->LoadSequenceEnd(event)) return false;
+      break;
+    case EYamlEventType::MappingStart:
+      if (!this->LoadMapping(event)) return false;
+      break;
+    case EYamlEventType::MappingEnd:
+      if (!this->LoadMappingEnd(event)) return false;
+      break;
+    case EYamlEventType::DocumentEnd:
+      break;
+    default:
+      assert(0);
+      return false;
+    }
+  } while (event.type != EYamlEventType::DocumentEnd);
+
+  this->document->end_implicit = std::get<YamlEvent::document_end_t>(event.data).implicit;
+  this->document->end_mark     = event.end_mark;
+
+  return true;
+}
+
+/*
+ * Copy the composed document out of the composer's stacks.  Each array gets
+ * one allocation of its exact size.
+ */
+bool YamlParser::FinishDocument()
+{
+  size_t nodes = (char*)this->composer_nodes.top - (char*)this->composer_nodes.start;
+  size_t items = (char*)this->composer_items.top - (char*)this->composer_items.start;
+  size_t pairs = (char*)this->composer_pairs.top - (char*)this->composer_pairs.start;
+  YamlDocument* document = this->document;
+
+  if (nodes)
+  {
+    document->nodes.start = (YamlNode*)this->ValueMalloc(nodes);
+    if (!document->nodes.start) goto error;
+    memcpy(document->nodes.start, this->composer_nodes.start, nodes);
+    document->nodes.top = document->nodes.end =
+        document->nodes.start + (this->composer_nodes.top - this->composer_nodes.start);
+    // The document owns the values of the nodes now.
+    this->composer_nodes.top = this->composer_nodes.start;
+  }
+
+  if (items)
+  {
+    document->items.start = (int*)this->ValueMalloc(items);
+    if (!document->items.start) goto error;
+    memcpy(document->items.start, this->composer_items.start, items);
+    document->items.top = document->items.end =
+        document->items.start + (this->composer_items.top - this->composer_items.start);
+  }
+
+  if (pairs)
+  {
+    document->pairs.start = (YamlNodePair*)this->ValueMalloc(pairs);
+    if (!document->pairs.start) goto error;
+    memcpy(document->pairs.start, this->composer_pairs.start, pairs);
+    document->pairs.top = document->pairs.end =
+        document->pairs.start + (this->composer_pairs.top - this->composer_pairs.start);
+  }
+
+  return true;
+
+error:
+  this->error = EYamlError::Memory;
+  return false;
+}
+
+/*
+ * Add an anchor to the document's anchors.
+ */
+bool YamlParser::RegisterAnchor(int index, uint8_t* anchor, bool numeric_anchor,
+                                uint64_t anchor_number)
+{
+  YamlAlias data;
+  YamlAlias* alias;
+
+  if (!anchor && !numeric_anchor) return true;
+
+  data.anchor = anchor;
+  data.number = anchor_number;
+  data.index  = index;
+  data.mark   = this->composer_nodes.start[index - 1].start_mark;
+
+  alias = this->aliases.Find(anchor, anchor_number);
+  if (alias)
+  {
+    this->ValueFree(anchor);
+    return this->SetComposerErrorContext("found duplicate anchor; first occurrence", alias->mark,
+                                         "second occurrence", data.mark);
+  }
+
+  if (!this->aliases.Insert(*this, data))
+  {
+    this->ValueFree(anchor);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Add a node to the collection that is being composed, if any.
+ */
+bool YamlParser::LoadNodeAdd(int index)
+{
+  // The root node has no parent.
+  if (this->composer_frames.Empty()) return true;
+
+  return this->composer_children.Push(*this, index);
+}
+
+/*
+ * Append a node to the document, then register its anchor and add it to its
+ * parent.  The node takes over the tag and the value; the anchor is freed if
+ * anything fails.
+ */
+bool YamlParser::PushNode(YamlNode& node, uint8_t* anchor, bool numeric_anchor,
+                          uint64_t anchor_number)
+{
+  int index;
+
+  if (!this->composer_nodes.Limit(*this, INT_MAX - 1) ||
+      !this->composer_nodes.Push(*this, node))
+  {
+    yaml_node_delete(*this, node);
+    this->ValueFree(anchor);
+    return false;
+  }
+
+  index = (int)(this->composer_nodes.top - this->composer_nodes.start);
+
+  if (!this->RegisterAnchor(index, anchor, numeric_anchor, anchor_number)) return false;
+
+  return this->LoadNodeAdd(index);
+}
+
+/*
+ * Compose a node for an alias.
+ */
+bool YamlParser::LoadAlias(YamlEvent& event)
+{
+  YamlEvent::alias_t& data = std::get<YamlEvent::alias_t>(event.data);
+  uint8_t* anchor          = data.anchor;
+  YamlAlias* alias         = this->aliases.Find(anchor, data.anchor_number);
+  int index;
+
+  if (!alias)
+  {
+    this->ValueFree(anchor);
+    return this->SetComposerError("found undefined alias", event.start_mark);
+  }
+
+  index = alias->index;
+  this->ValueFree(anchor);
+
+  return this->LoadNodeAdd(index);
+}
+
+/*
+ * Compose a scalar node.
+ */
+bool YamlParser::LoadScalar(YamlEvent& event)
+{
+  YamlEvent::scalar_t& data = std::get<YamlEvent::scalar_t>(event.data);
+  YamlNode node;
+  YamlNode::scalar_t scalar;
+
+  node.type   = EYamlNodeType::Scalar;
+  node.tag    = data.tag;
+  node.tag_id = data.tag_id;
+  if (!node.tag || strcmp((char*)node.tag, "!") == 0)
+  {
+    node.tag    = yaml_default_scalar_tag;
+    node.tag_id = YAML_STR_TAG_ID;
+  }
+
+  scalar.value    = data.value;
+  scalar.length   = data.length;
+  scalar.style    = data.style;
+  scalar.borrowed = data.borrowed;
+
+  node.data       = scalar;
+  node.start_mark = event.start_mark;
+  node.end_mark   = event.end_mark;
+
+  return this->PushNode(node, data.anchor, data.numeric_anchor, data.anchor_number);
+}
+
+/*
+ * Compose a sequence node.
+ */
+bool YamlParser::LoadSequence(YamlEvent& event)
+{
+  YamlEvent::sequence_start_t& data = std::get<YamlEvent::sequence_start_t>(event.data);
+  YamlNode node;
+  YamlNode::sequence_t sequence;
+  YamlComposerFrame frame;
+
+  node.type   = EYamlNodeType::Sequence;
+  node.tag    = data.tag;
+  node.tag_id = data.tag_id;
+  if (!node.tag || strcmp((char*)node.tag, "!") == 0)
+  {
+    node.tag    = yaml_default_sequence_tag;
+    node.tag_id = YAML_SEQ_TAG_ID;
+  }
+
+  sequence.style = data.style;
+
+  node.data       = sequence;
+  node.start_mark = event.start_mark;
+  node.end_mark   = event.end_mark;
+
+  if (!this->PushNode(node, data.anchor, data.numeric_anchor, data.anchor_number)) return false;
+
+  frame.node     = (int)(this->composer_nodes.top - this->composer_nodes.start);
+  frame.children = this->composer_children.top - this->composer_children.start;
+
+  return this->composer_frames.Push(*this, frame);
+}
+
+/*
+ * Finish a sequence node: its items are copied next to each other.
+ */
+bool YamlParser::LoadSequenceEnd(YamlEvent& event)
+{
+  YamlComposerFrame frame;
+  YamlNode* node;
+  int* child;
+
+  assert(!this->composer_frames.Empty());
+
+  frame = this->composer_frames.Pop();
+  node  = this->composer_nodes.start + frame.node - 1;
+  assert(node->type == EYamlNodeType::Sequence);
+
+  YamlNode::sequence_t& sequence = std::get<YamlNode::sequence_t>(node->data);
+  sequence.start = this->composer_items.top - this->composer_items.start;
+  sequence.count = (this->composer_children.top - this->composer_children.start) - frame.children;
+
+  for (child = this->composer_children.start + frame.children;
+       child != this->composer_children.top; child++)
+  {
+    if (!this->composer_items.Push(*this, *child)) return false;
+  }
+  this->composer_children.top = this->composer_children.start + frame.children;
+
+  node->end_mark = event.end_mark;
+
+  return true;
+}
+
+/*
+ * Compose a mapping node.
+ */
+bool YamlParser::LoadMapping(YamlEvent& event)
+{
+  YamlEvent::mapping_start_t& data = std::get<YamlEvent::mapping_start_t>(event.data);
+  YamlNode node;
+  YamlNode::mapping_t mapping;
+  YamlComposerFrame frame;
+
+  node.type   = EYamlNodeType::Mapping;
+  node.tag    = data.tag;
+  node.tag_id = data.tag_id;
+  if (!node.tag || strcmp((char*)node.tag, "!") == 0)
+  {
+    node.tag    = yaml_default_mapping_tag;
+    node.tag_id = YAML_MAP_TAG_ID;
+  }
+
+  mapping.style = data.style;
+
+  node.data       = mapping;
+  node.start_mark = event.start_mark;
+  node.end_mark   = event.end_mark;
+
+  if (!this->PushNode(node, data.anchor, data.numeric_anchor, data.anchor_number)) return false;
+
+  frame.node     = (int)(this->composer_nodes.top - this->composer_nodes.start);
+  frame.children = this->composer_children.top - this->composer_children.start;
+
+  return this->composer_frames.Push(*this, frame);
+}
+
+/*
+ * Finish a mapping node: its keys and values alternate on the stack of
+ * children, and are copied next to each other as pairs.
+ */
+bool YamlParser::LoadMappingEnd(YamlEvent& event)
+{
+  YamlComposerFrame frame;
+  YamlNode* node;
+  int* child;
+
+  assert(!this->composer_frames.Empty());
+
+  frame = this->composer_frames.Pop();
+  node  = this->composer_nodes.start + frame.node - 1;
+  assert(node->type == EYamlNodeType::Mapping);
+
+  YamlNode::mapping_t& mapping = std::get<YamlNode::mapping_t>(node->data);
+  mapping.start = this->composer_pairs.top - this->composer_pairs.start;
+  mapping.count =
+      ((this->composer_children.top - this->composer_children.start) - frame.children) / 2;
+
+  for (child = this->composer_children.start + frame.children;
+       child + 1 < this->composer_children.top; child += 2)
+  {
+    YamlNodePair pair;
+    pair.key   = child[0];
+    pair.value = child[1];
+    if (!this->composer_pairs.Push(*this, pair)) return false;
+  }
+  this->composer_children.top = this->composer_children.start + frame.children;
+
+  node->end_mark = event.end_mark;
+
+  return true;
+}
+
+// LoadAll
+
+/*
+ * A run of whole documents that LoadAll composes with a parser of its own.
+ * Its marks count from the start of the run until they are shifted.
+ */
+struct mj::YamlLoadChunk
+{
+  const unsigned char* start = nullptr;
+  size_t size                = 0;
+
+  YamlStack<YamlDocument> documents;
+  // The arena blocks that hold the values of the documents.
+  YamlArenaBlock* head = nullptr;
+  YamlArenaBlock* tail = nullptr;
+  // The tags that the nodes of the documents point to, by the chunk's IDs.
+  YamlTagTable tags;
+  YamlMark end_mark;
+  bool last = false;
+
+  EYamlError error      = EYamlError::None;
+  const char* problem   = nullptr;
+  const char* context   = nullptr;
+  size_t problem_offset = 0;
+  int problem_value     = 0;
+  YamlMark problem_mark;
+  YamlMark context_mark;
+
+  std::thread thread;
+};
+
+/*
+ * Check if the octets at 'pointer' end a document indicator, like
+ * IsBlankOrNulAt does in the buffer.
+ */
+static bool yaml_is_indicator_end(const unsigned char* pointer, const unsigned char* end)
+{
+  if (pointer == end) return true;
+
+  switch (pointer[0])
+  {
+  case '\0':
+  case ' ':
+  case '\t':
+  case '\r':
+  case '\n':
+    return true;
+  case 0xC2: // NEL
+    return end - pointer >= 2 && pointer[1] == 0x85;
+  case 0xE2: // LS, PS
+    return end - pointer >= 3 && pointer[1] == 0x80 && (pointer[2] == 0xA8 || pointer[2] == 0xA9);
+  default:
+    return false;
+  }
+}
+
+/*
+ * Check if a line starts with a document indicator: '---' or '...'.
+ */
+static bool yaml_is_document_indicator(const unsigned char* pointer, const unsigned char* end,
+                                       unsigned char indicator)
+{
+  return end - pointer >= 3 && pointer[0] == indicator && pointer[1] == indicator &&
+         pointer[2] == indicator && yaml_is_indicator_end(pointer + 3, end);
+}
+
+/*
+ * Check if a line holds more than white space and a comment.
+ */
+static bool yaml_is_content_line(const unsigned char* pointer, const unsigned char* end)
+{
+  while (pointer != end && (*pointer == ' ' || *pointer == '\t')) pointer++;
+
+  return pointer != end && *pointer != '#' && *pointer != '\r' && *pointer != '\n';
+}
+
+/*
+ * Find where the documents after the first one start: at the '---' lines at
+ * column 0.  A document start indicator there ends the document before it
+ * wherever it is, even in a quoted or block scalar, so the documents in
+ * between can be composed apart.
+ *
+ * Only the directives before the first document are handed to the chunks, so
+ * streams with directives further on are not split; neither is UTF-16.  The
+ * first document starts at its '---' or, if it is implicit, at its first line
+ * of content.
+ */
+static bool yaml_split_documents(YamlParser& parser, const unsigned char* start,
+                                 const unsigned char* end, YamlStack<size_t>& starts)
+{
+  const unsigned char* pointer = start;
+  bool started                 = false;
+
+  if (end - start >= 2 && (!memcmp(start, BOM_UTF16LE, 2) || !memcmp(start, BOM_UTF16BE, 2)))
+  {
+    return true;
+  }
+  if (end - start >= 3 && !memcmp(start, BOM_UTF8, 3))
+  {
+    pointer += 3;
+  }
+
+  for (;;)
+  {
+    if (yaml_is_document_indicator(pointer, end, '-'))
+    {
+      // The first document stays with the directives before it.
+      if (started && !starts.Push(parser, (size_t)(pointer - start))) return false;
+      started = true;
+    }
+    else if (pointer != end && pointer[0] == '%')
+    {
+      if (started)
+      {
+        starts.top = starts.start;
+        return true;
+      }
+    }
+    else if (!started && !yaml_is_document_indicator(pointer, end, '.') &&
+             yaml_is_content_line(pointer, end))
+    {
+      started = true;
+    }
+
+    pointer = (const unsigned char*)memchr(pointer, '\n', end - pointer);
+    if (!pointer) return true;
+    pointer++;
+  }
+}
+
+/*
+ * Move a mark of a chunk to where the chunk lies in the stream.  Chunks start
+ * at column 0.
+ */
+static void yaml_shift_mark(YamlMark& mark, const YamlMark& base)
+{
+  mark.index += base.index;
+  mark.line += base.line;
+}
+
+/*
+ * Lazy marks of a chunk are octet offsets from where the chunk starts instead.
+ */
+static void yaml_lazy_base(const YamlParser& parser, const YamlLoadChunk& chunk, YamlMark& base)
+{
+  base       = YamlMark();
+  base.index = chunk.start - parser.input.start;
+}
+
+/*
+ * Parse up to the first document, for the tag directives before it.
+ */
+bool YamlParser::ParseHeader(bool& document)
+{
+  YamlEvent event;
+
+  document = false;
+
+  if (!this->Parse(event)) return false;
+  if (!this->Parse(event)) return false;
+  if (event.type != EYamlEventType::DocumentStart) return true;
+  event.Delete(*this);
+
+  document = true;
+  return true;
+}
+
+void YamlDocumentList::Delete(YamlParser& parser)
+{
+  for (size_t k = 0; k < this->count; k++)
+  {
+    this->start[k].Delete(parser);
+  }
+  parser.Free(this->start);
+
+  *this = {};
+}
+
+/*
+ * Compose all documents of the stream, a run of documents per thread.  On an
+ * error the documents before it are returned, as a run of Load would have.
+ */
+bool YamlParser::LoadAll(YamlDocumentList& documents, unsigned threads)
+{
+  YamlStack<size_t> starts;
+  YamlLoadChunk* chunks = nullptr;
+  int* ids              = nullptr;
+  size_t count          = 0;
+  size_t used           = 0;
+  size_t total          = 0;
+  size_t size           = this->input.end - this->input.start;
+  bool found            = false;
+  YamlDocument* document;
+  YamlMark base;
+  size_t k;
+
+  documents = {};
+
+  assert(!this->stream_start_produced); /* LoadAll takes the whole stream. */
+  assert(!this->push);
+  if (this->error != EYamlError::None) return false;
+
+  // The read handler of the other parsers has no input for the split to scan.
+  if (!this->in_place) return this->SetReaderError("input is not in memory", 0, -1);
+
+  // The later chunks are seeded with the tag directives of the header.
+  if (!this->ParseHeader(found)) return false;
+  if (!found) return true;
+
+  if (!starts.Init(*this)) goto error;
+  if (!yaml_split_documents(*this, this->input.start, this->input.end, starts)) goto error;
+
+  if (!threads) threads = std::thread::hardware_concurrency();
+  if (!threads) threads = 1;
+
+  // Cut the stream into chunks of about the same size.
+  chunks = (YamlLoadChunk*)this->Malloc(threads * sizeof(YamlLoadChunk));
+  if (!chunks)
+  {
+    this->error = EYamlError::Memory;
+    goto error;
+  }
+  new (chunks) YamlLoadChunk();
+  chunks[0].start = this->input.start;
+  count           = 1;
+  for (size_t* start = starts.start; start != starts.top && count < threads; start++)
+  {
+    if (*start >= count * (size / threads))
+    {
+      new (chunks + count) YamlLoadChunk();
+      chunks[count].start = this->input.start + *start;
+      count++;
+    }
+  }
+  // A chunk reads on into the '---' of the next one, so that it ends the way
+  // it does in the stream.  The document this starts is dropped.
+  for (k = 0; k < count; k++)
+  {
+    const unsigned char* end = k + 1 < count ? chunks[k + 1].start + 3 : this->input.end;
+    chunks[k].size           = end - chunks[k].start;
+    chunks[k].last           = k + 1 == count;
+  }
+
+  // The chunks that get no thread are loaded on this one after the first.
+  for (k = 1; k < count; k++)
+  {
+    try
+    {
+      chunks[k].thread = std::thread(&YamlParser::LoadChunk, this, std::ref(chunks[k]));
+    }
+    catch (const std::exception&)
+    {
+      break;
+    }
+  }
+  this->LoadChunk(chunks[0]);
+  for (; k < count; k++)
+  {
+    this->LoadChunk(chunks[k]);
+  }
+
+  for (k = 0; k < count; k++)
+  {
+    if (chunks[k].thread.joinable()) chunks[k].thread.join();
+
+    // The values in the chunk's arena are freed with the parser's.
+    if (chunks[k].head)
+    {
+      if (this->arena.tail)
+      {
+        this->arena.tail->next = chunks[k].head;
+      }
+      else
+      {
+        this->arena.head = chunks[k].head;
+      }
+      this->arena.tail = chunks[k].tail;
+      this->arena.last = nullptr;
+    }
+  }
+
+  // Report the first error in the stream.  The documents that the chunk
+  // finished before it are kept, and the chunks after it are dropped.
+  for (used = 0; used < count; used++)
+  {
+    YamlLoadChunk& chunk = chunks[used];
+
+    if (this->lazy_marks) yaml_lazy_base(*this, chunk, base);
+
+    total += chunk.documents.top - chunk.documents.start;
+    if (chunk.error != EYamlError::None)
+    {
+      this->error          = chunk.error;
+      this->problem        = chunk.problem;
+      this->context        = chunk.context;
+      this->problem_offset = chunk.problem_offset;
+      this->problem_value  = chunk.problem_value;
+      this->problem_mark   = chunk.problem_mark;
+      this->context_mark   = chunk.context_mark;
+      if (chunk.error == EYamlError::Reader)
+      {
+        this->problem_offset += chunk.start - this->input.start;
+      }
+      yaml_shift_mark(this->problem_mark, base);
+      // Only the scanner sets a context mark without a context.
+      if (chunk.error == EYamlError::Scanner || chunk.context)
+      {
+        yaml_shift_mark(this->context_mark, base);
+      }
+      // The chunk resolved lazy marks from its own start.
+      this->ResolveErrorMarks();
+      used++;
+      break;
+    }
+
+    yaml_shift_mark(base, chunk.end_mark);
+  }
+
+  // Intern the tags of each chunk here and move its nodes over to them.
+  for (k = 0; k < used; k++)
+  {
+    YamlLoadChunk& chunk = chunks[k];
+    size_t tag_count     = chunk.tags.names.top - chunk.tags.names.start;
+
+    if (!tag_count) continue;
+
+    ids = (int*)this->Malloc(tag_count * sizeof(int));
+    if (!ids)
+    {
+      this->error = EYamlError::Memory;
+      goto error;
+    }
+    for (size_t id = 0; id < tag_count; id++)
+    {
+      uint8_t* name      = chunk.tags.names.start[id];
+      const YamlTag* tag = this->tags.Intern(*this, nullptr, 0, name, strlen((char*)name));
+      if (!tag) goto error;
+      ids[id] = tag->id;
+    }
+
+    for (document = chunk.documents.start; document != chunk.documents.top; document++)
+    {
+      for (YamlNode* node = document->nodes.start; node != document->nodes.top; node++)
+      {
+        node->tag_id = ids[node->tag_id - 1];
+        node->tag    = this->tags.names.start[node->tag_id - 1];
+      }
+    }
+    this->Free(ids);
+    ids = nullptr;
+  }
+
+  // Gather the documents in order.
+  if (total)
+  {
+    documents.start = (YamlDocument*)this->Malloc(total * sizeof(YamlDocument));
+    if (!documents.start)
+    {
+      this->error = EYamlError::Memory;
+      goto error;
+    }
+  }
+
+  base = YamlMark();
+  for (k = 0; k < used; k++)
+  {
+    YamlLoadChunk& chunk = chunks[k];
+
+    if (this->lazy_marks) yaml_lazy_base(*this, chunk, base);
+
+    for (document = chunk.documents.start; document != chunk.documents.top; document++)
+    {
+      yaml_shift_mark(document->start_mark, base);
+      yaml_shift_mark(document->end_mark, base);
+      for (YamlNode* node = document->nodes.start; node != document->nodes.top; node++)
+      {
+        yaml_shift_mark(node->start_mark, base);
+        yaml_shift_mark(node->end_mark, base);
+      }
+      documents.start[documents.count++] = *document;
+    }
+    chunk.documents.top = chunk.documents.start;
+
+    yaml_shift_mark(base, chunk.end_mark);
+  }
+
+  for (k = 0; k < count; k++)
+  {
+    for (document = chunks[k].documents.start; document != chunks[k].documents.top; document++)
+    {
+      document->Delete(*this);
+    }
+    chunks[k].documents.Del(*this);
+    chunks[k].tags.Del(*this);
+    chunks[k].~YamlLoadChunk();
+  }
+  this->Free(chunks);
+  starts.Del(*this);
+  this->stream_end_produced = true;
+
+  return this->error == EYamlError::None;
+
+error:
+  for (k = 0; k < count; k++)
+  {
+    for (document = chunks[k].documents.start; document != chunks[k].documents.top; document++)
+    {
+      document->Delete(*this);
+    }
+    chunks[k].documents.Del(*this);
+    chunks[k].tags.Del(*this);
+    chunks[k].~YamlLoadChunk();
+  }
+  this->Free(chunks);
+  this->Free(ids);
+  starts.Del(*this);
+  this->stream_end_produced = true;
+
+  return false;
+}
+
+/*
+ * Compose the documents of a chunk.  This runs on a thread of its own, and
+ * only reads the parser it is called on.
+ */
+void YamlParser::LoadChunk(YamlLoadChunk& chunk)
+{
+  YamlFns fns;
+  fns.Malloc         = this->Malloc;
+  fns.Realloc        = this->Realloc;
+  fns.Free           = this->Free;
+  fns.Strdup         = this->Strdup;
+  fns.ArenaBlockSize = this->arena.block_size;
+
+  YamlParser parser(fns, chunk.start, chunk.size);
+  YamlDocument document;
+
+  // The anchors do not make it into the documents, so they are taken as
+  // numbers where they can be.
+  parser.borrow_scalars  = this->borrow_scalars;
+  parser.lazy_marks      = this->lazy_marks;
+  parser.keep_values     = true;
+  parser.numeric_anchors = true;
+
+  if (parser.error != EYamlError::None) goto error;
+  if (!chunk.documents.Init(parser)) goto error;
+
+  // The first chunk reads the directives itself.
+  if (chunk.start != this->input.start)
+  {
+    for (YamlTagDirective* tag_directive = this->tag_directives.start;
+         tag_directive != this->tag_directives.top; tag_directive++)
+    {
+      if (!parser.AppendTagDirective(*tag_directive, 1, parser.mark)) goto error;
+    }
+  }
+
+  for (;;)
+  {
+    if (!parser.Load(document)) goto error;
+    if (!document.GetRootNode()) break;
+    if (!chunk.documents.Push(parser, document))
+    {
+      document.Delete(parser);
+      goto error;
+    }
+  }
+
+  if (chunk.last)
+  {
+    chunk.end_mark = parser.mark;
+  }
+  else
+  {
+    assert(!chunk.documents.Empty());
+    document       = chunk.documents.Pop();
+    chunk.end_mark = document.start_mark;
+    document.Delete(parser);
+  }
+  goto done;
+
+error:
+  chunk.error          = parser.error;
+  chunk.problem        = parser.problem;
+  chunk.context        = parser.context;
+  chunk.problem_offset = parser.problem_offset;
+  chunk.problem_value  = parser.problem_value;
+  chunk.problem_mark   = parser.problem_mark;
+  chunk.context_mark   = parser.context_mark;
+
+done:
+  // Take the arena blocks and the tags away from the parser before it frees
+  // them.
+  chunk.head        = parser.arena.head;
+  chunk.tail        = parser.arena.tail;
+  parser.arena.head = nullptr;
+  parser.arena.tail = nullptr;
+  parser.arena.last = nullptr;
+  chunk.tags        = parser.tags;
+  parser.tags       = YamlTagTable();
+}
+
+// LoadBatch
+
+/*
+ * The inputs left to a thread of LoadBatch, as positions [next, end) in the
+ * order they were dealt out in.  The thread takes them from the front; the
+ * others steal the back half when they run out.  The parser of the thread
+ * lives as long as the batch, since the results it holds for their turn point
+ * to its tags.
+ */
+struct YamlBatchWorker
+{
+  std::mutex lock;
+  size_t next = 0;
+  size_t end  = 0;
+
+  std::thread thread;
+  YamlParser parser;
+
+  YamlBatchWorker(const YamlFns& Fns) : parser(Fns, (const unsigned char*)"", 0) {}
+};
+
+/*
+ * The result of an input of an ordered batch that was done before its turn,
+ * with the arena blocks that hold the values of its documents.
+ */
+struct YamlBatchSlot
+{
+  YamlBatchResult result;
+  YamlArenaBlock* head = nullptr;
+  bool done            = false;
+};
+
+struct mj::YamlBatchRun
+{
+  const YamlBatchInput* inputs    = nullptr;
+  size_t count                    = 0;
+  const YamlBatchOptions* options = nullptr;
+  yaml_batch_handler_t* handler   = nullptr;
+  void* data                      = nullptr;
+  size_t* order                   = nullptr;
+  YamlBatchWorker* workers        = nullptr;
+  unsigned worker_count           = 0;
+  std::atomic<size_t> delivered{0};
+
+  // Held while the threads are started, which wait on it before they take
+  // an input.
+  std::mutex start_lock;
+
+  // The results held for their turn in an ordered batch, one per input.
+  std::mutex deliver_lock;
+  YamlBatchSlot* slots = nullptr;
+};
+
+/*
+ * Take the next input for a thread of a batch, or steal the back half of the
+ * inputs left to another thread when it has none left.  Only one lock is held
+ * at a time.
+ */
+static bool yaml_batch_take(YamlBatchRun& run, unsigned self, size_t& index)
+{
+  YamlBatchWorker& worker = run.workers[self];
+  size_t next;
+  size_t end;
+
+  {
+    std::lock_guard<std::mutex> guard(worker.lock);
+    if (worker.next != worker.end)
+    {
+      index = run.order[worker.next++];
+      return true;
+    }
+  }
+
+  for (unsigned k = 1; k < run.worker_count; k++)
+  {
+    YamlBatchWorker& victim = run.workers[(self + k) % run.worker_count];
+
+    {
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (victim.next == victim.end) continue;
+      next       = victim.next + (victim.end - victim.next) / 2;
+      end        = victim.end;
+      victim.end = next;
+    }
+
+    std::lock_guard<std::mutex> guard(worker.lock);
+    index       = run.order[next];
+    worker.next = next + 1;
+    worker.end  = end;
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * Deal the inputs of a batch out round-robin to the first 'threads' threads.
+ */
+static void yaml_batch_deal(YamlBatchRun& run, unsigned threads)
+{
+  size_t position = 0;
+
+  for (unsigned k = 0; k < threads; k++)
+  {
+    run.workers[k].next = position;
+    for (size_t index = k; index < run.count; index += threads)
+    {
+      run.order[position++] = index;
+    }
+    run.workers[k].end = position;
+  }
+  run.worker_count = threads;
+}
+
+/*
+ * Compose the inputs of a batch in many threads at once.  The inputs are dealt
+ * out round-robin, so the threads go through them about in order, which keeps
+ * the results of an ordered batch from being held long.
+ */
+bool YamlParser::LoadBatch(const YamlFns& Fns, const YamlBatchInput* inputs, size_t count,
+                           const YamlBatchOptions& options, yaml_batch_handler_t* handler,
+                           void* data)
+{
+  YamlBatchRun run;
+  unsigned threads = options.threads;
+  unsigned built   = 0;
+  bool success     = false;
+  unsigned k;
+
+  if (!count) return true;
+
+  if (!threads) threads = std::thread::hardware_concurrency();
+  if (!threads) threads = 1;
+  if (threads > count) threads = (unsigned)count;
+
+  run.inputs  = inputs;
+  run.count   = count;
+  run.options = &options;
+  run.handler = handler;
+  run.data    = data;
+
+  run.order   = (size_t*)Fns.Malloc(count * sizeof(size_t));
+  run.workers = (YamlBatchWorker*)Fns.Malloc(threads * sizeof(YamlBatchWorker));
+  if (!run.order || !run.workers) goto done;
+  if (options.ordered)
+  {
+    run.slots = (YamlBatchSlot*)Fns.Malloc(count * sizeof(YamlBatchSlot));
+    if (!run.slots) goto done;
+    for (size_t index = 0; index < count; index++)
+    {
+      new (run.slots + index) YamlBatchSlot();
+    }
+  }
+
+  for (built = 0; built < threads; built++)
+  {
+    new (run.workers + built) YamlBatchWorker(Fns);
+  }
+  yaml_batch_deal(run, threads);
+
+  // When a thread cannot be started, the inputs are dealt out again among the
+  // ones that were, before any of them takes one.
+  {
+    std::unique_lock<std::mutex> gate(run.start_lock);
+    for (k = 1; k < threads; k++)
+    {
+      try
+      {
+        run.workers[k].thread = std::thread(&YamlParser::LoadBatchWorker, std::ref(run), k);
+      }
+      catch (const std::exception&)
+      {
+        break;
+      }
+    }
+    if (k < threads) yaml_batch_deal(run, k);
+  }
+  YamlParser::LoadBatchWorker(run, 0);
+  for (k = 1; k < threads; k++)
+  {
+    if (run.workers[k].thread.joinable()) run.workers[k].thread.join();
+  }
+
+  success = run.delivered == count;
+
+done:
+  for (k = 0; k < built; k++)
+  {
+    run.workers[k].~YamlBatchWorker();
+  }
+  if (run.slots)
+  {
+    for (size_t index = 0; index < count; index++)
+    {
+      run.slots[index].~YamlBatchSlot();
+    }
+  }
+  Fns.Free(run.slots);
+  Fns.Free(run.workers);
+  Fns.Free(run.order);
+
+  return success;
+}
+
+/*
+ * Compose the inputs that a thread of a batch takes, with a parser that is
+ * Reset for each of them.
+ */
+void YamlParser::LoadBatchWorker(YamlBatchRun& run, unsigned worker)
+{
+  YamlParser& parser = run.workers[worker].parser;
+  YamlStack<YamlDocument> documents;
+  YamlDocument document;
+  size_t index;
+
+  // Wait for LoadBatch to have started all the threads it can.
+  {
+    std::lock_guard<std::mutex> gate(run.start_lock);
+  }
+
+  // The documents of an input outlive the ones after them. The anchors do not
+  // make it into the documents, so they are taken as numbers where they can be.
+  parser.keep_values     = true;
+  parser.numeric_anchors = true;
+
+  // Without room for documents the thread takes no inputs, and the others do.
+  if (parser.error != EYamlError::None) return;
+  if (!documents.Init(parser)) return;
+
+  while (yaml_batch_take(run, worker, index))
+  {
+    const YamlBatchInput& input = run.inputs[index];
+    YamlBatchResult result;
+    bool success;
+
+    if (input.path)
+    {
+      success = parser.Reset(input.path);
+    }
+    else
+    {
+      success = parser.Reset(input.data, input.size);
+    }
+    parser.borrow_scalars = run.options->borrow_scalars && !input.path;
+
+    documents.top = documents.start;
+    while (success)
+    {
+      if (!parser.Load(document))
+      {
+        success = false;
+        break;
+      }
+      if (!document.GetRootNode()) break;
+      if (!documents.Push(parser, document))
+      {
+        document.Delete(parser);
+        success = false;
+      }
+    }
+
+    result.index           = index;
+    result.documents.start = documents.start;
+    result.documents.count = documents.top - documents.start;
+    if (!success)
+    {
+      result.error          = parser.error;
+      result.problem        = parser.problem;
+      result.context        = parser.context;
+      result.problem_offset = parser.problem_offset;
+      result.problem_value  = parser.problem_value;
+      result.problem_mark   = parser.problem_mark;
+      result.context_mark   = parser.context_mark;
+    }
+
+    parser.DeliverBatchResult(run, result);
+  }
+
+  documents.Del(parser);
+}
+
+/*
+ * Hand the result of an input over and delete its documents, which are held
+ * in the documents stack of the thread.  An ordered batch holds on to a result
+ * that is early, with a copy of its documents and the arena blocks of their
+ * values, and hands it over when the inputs before it are done.
+ */
+void YamlParser::DeliverBatchResult(YamlBatchRun& run, YamlBatchResult& result)
+{
+  if (!run.options->ordered)
+  {
+    run.handler(run.data, result);
+    run.delivered++;
+    for (size_t k = 0; k < result.documents.count; k++)
+    {
+      result.documents.start[k].Delete(*this);
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(run.deliver_lock);
+
+  if (result.index != run.delivered)
+  {
+    YamlBatchSlot& slot = run.slots[result.index];
+    size_t size         = result.documents.count * sizeof(YamlDocument);
+
+    // The documents stack is reused for the next input.
+    slot.result           = result;
+    slot.result.documents = YamlDocumentList();
+    if (size)
+    {
+      slot.result.documents.start = (YamlDocument*)this->Malloc(size);
+      slot.result.documents.count = result.documents.count;
+      if (slot.result.documents.start)
+      {
+        memcpy(slot.result.documents.start, result.documents.start, size);
+      }
+      else
+      {
+        for (size_t k = 0; k < result.documents.count; k++)
+        {
+          result.documents.start[k].Delete(*this);
+        }
+        slot.result       = YamlBatchResult();
+        slot.result.index = result.index;
+        slot.result.error = EYamlError::Memory;
+      }
+    }
+
+    // Take the arena blocks away from the parser before Reset releases them.
+    slot.head        = this->arena.head;
+    this->arena.head = nullptr;
+    this->arena.tail = nullptr;
+    this->arena.last = nullptr;
+    slot.done        = true;
+    return;
+  }
+
+  run.handler(run.data, result);
+  run.delivered++;
+  for (size_t k = 0; k < result.documents.count; k++)
+  {
+    result.documents.start[k].Delete(*this);
+  }
+
+  // Hand over the results that were waiting on this one.
+  while (run.delivered != run.count && run.slots[run.delivered].done)
+  {
+    YamlBatchSlot& slot = run.slots[run.delivered];
+
+    run.handler(run.data, slot.result);
+    run.delivered++;
+    slot.result.documents.Delete(*this);
+    while (slot.head)
+    {
+      YamlArenaBlock* block = slot.head;
+      slot.head             = block->next;
+      this->arena.Recycle(*this, block);
+    }
+  }
+}
+
+// Document index
+
+/*
+ * Get the width of the line break at a position: CR, LF, "\r\n", NEL, LS or
+ * PS.  Returns 0 if there is none.
+ */
+static size_t yaml_break_width(const unsigned char* pointer, const unsigned char* end)
+{
+  if (pointer[0] == '\r' && end - pointer >= 2 && pointer[1] == '\n') return 2;
+  if (pointer[0] == '\r' || pointer[0] == '\n') return 1;
+  if (pointer[0] == 0xC2 && end - pointer >= 2 && pointer[1] == 0x85) return 2;
+  if (pointer[0] == 0xE2 && end - pointer >= 3 && pointer[1] == 0x80 &&
+      (pointer[2] == 0xA8 || pointer[2] == 0xA9))
+  {
+    return 3;
+  }
+  return 0;
+}
+
+/*
+ * Find where the line after the one at a position starts, or the end.
+ */
+static const unsigned char* yaml_next_line(const unsigned char* pointer, const unsigned char* end)
+{
+  while (pointer != end)
+  {
+    size_t width;
+
+    pointer += yaml_line_run(pointer, end - pointer);
+    if (pointer == end) break;
+
+    width = yaml_break_width(pointer, end);
+    if (width) return pointer + width;
+    pointer++;
+  }
+
+  return end;
+}
+
+/*
+ * Move a mark over a line of the input the way the reader counts: in
+ * characters, with "\r\n" as a single break.
+ */
+static void yaml_advance_mark(YamlMark& mark, const unsigned char* pointer,
+                              const unsigned char* end)
+{
+  size_t size = end - pointer;
+
+  // Most lines are printable ASCII, with at most a CR, an LF or a "\r\n" at
+  // their end.
+  if (yaml_printable_ascii_run(pointer, size) == size &&
+      (size < 2 || !memchr(pointer, '\r', size - 2)))
+  {
+    mark.index += size;
+    if (size && (end[-1] == '\n' || end[-1] == '\r'))
+    {
+      mark.line++;
+      mark.column = 0;
+    }
+    else
+    {
+      mark.column += size;
+    }
+    return;
+  }
+
+  while (pointer != end)
+  {
+    unsigned char octet = pointer[0];
+    size_t width        = octet >= 0xF0 ? 4 : octet >= 0xE0 ? 3 : octet >= 0xC0 ? 2 : 1;
+    bool is_break       = octet == '\r' || octet == '\n';
+
+    // NEL, LS and PS.
+    if (octet == 0xC2 && end - pointer >= 2)
+    {
+      is_break = pointer[1] == 0x85;
+    }
+    else if (octet == 0xE2 && end - pointer >= 3)
+    {
+      is_break = pointer[1] == 0x80 && (pointer[2] == 0xA8 || pointer[2] == 0xA9);
+    }
+
+    if (octet == '\r' && end - pointer >= 2 && pointer[1] == '\n')
+    {
+      mark.index += 2;
+      mark.line++;
+      mark.column = 0;
+      pointer += 2;
+      continue;
+    }
+
+    mark.index++;
+    if (is_break)
+    {
+      mark.line++;
+      mark.column = 0;
+    }
+    else
+    {
+      mark.column++;
+    }
+
+    pointer += (size_t)(end - pointer) < width ? end - pointer : width;
+  }
+}
+
+/*
+ * Take the properties after a '---': a tag and an anchor, in either order.
+ */
+static void yaml_scan_entry_properties(YamlDocumentEntry& entry, const unsigned char* pointer,
+                                       const unsigned char* end)
+{
+  for (int k = 0; k < 2; k++)
+  {
+    const unsigned char* start;
+
+    while (pointer != end && (*pointer == ' ' || *pointer == '\t')) pointer++;
+    if (pointer == end) return;
+
+    start = pointer;
+    if (*pointer == '!' && !entry.tag)
+    {
+      while (pointer != end && !yaml_is_indicator_end(pointer, end)) pointer++;
+      entry.tag        = start;
+      entry.tag_length = pointer - start;
+    }
+    else if (*pointer == '&' && !entry.anchor)
+    {
+      start = ++pointer;
+      while (pointer != end && ((*pointer >= '0' && *pointer <= '9') ||
+                                ((*pointer | 0x20) >= 'a' && (*pointer | 0x20) <= 'z') ||
+                                *pointer == '_' || *pointer == '-'))
+      {
+        pointer++;
+      }
+      entry.anchor        = start;
+      entry.anchor_length = pointer - start;
+    }
+    else
+    {
+      return;
+    }
+  }
+}
+
+YamlDocumentEntry* YamlDocumentIndex::Find(const uint8_t* anchor, size_t length)
+{
+  for (YamlDocumentEntry* entry = this->entries.start; entry != this->entries.top; entry++)
+  {
+    if (entry->anchor_length == length && !memcmp(entry->anchor, anchor, length))
+    {
+      return entry;
+    }
+  }
+
+  return nullptr;
+}
+
+void YamlDocumentIndex::Delete(YamlParser& parser)
+{
+  while (!this->tag_directives.Empty())
+  {
+    YamlTagDirective tag_directive = this->tag_directives.Pop();
+    parser.Free(tag_directive.handle);
+    parser.Free(tag_directive.prefix);
+  }
+  this->tag_directives.Del(parser);
+  this->entries.Del(parser);
+}
+
+/*
+ * Index the documents of the stream.  A document starts at a '---' line at
+ * column 0, or at the directives before it; the first one starts at the start
+ * of the stream.  Lines that start with '%' are only directives before the
+ * first document or after a '...' line; elsewhere they go on a scalar.
+ */
+bool YamlParser::BuildIndex(YamlDocumentIndex& index)
+{
+  const unsigned char* start      = this->input.start;
+  const unsigned char* end        = this->input.end;
+  const unsigned char* pointer    = start;
+  const unsigned char* directives = nullptr;
+  bool found                      = false;
+  bool started                    = false;
+  bool ended                      = false;
+  YamlDocumentEntry entry;
+  YamlMark mark, directives_mark;
+
+  index = {};
+
+  assert(!this->stream_start_produced); /* BuildIndex takes the whole stream. */
+  assert(!this->push);
+  if (this->error != EYamlError::None) return false;
+
+  // The read handler of the other parsers has no input for the index to scan.
+  if (!this->in_place) return this->SetReaderError("input is not in memory", 0, -1);
+
+  // Documents that are parsed on their own are seeded with the tag directives
+  // of the header.
+  if (!this->ParseHeader(found)) return false;
+  this->stream_end_produced = true;
+  if (!found) return true;
+
+  if (!index.entries.Init(*this)) goto error;
+  if (!index.tag_directives.Init(*this)) goto error;
+  if (!this->IndexTagDirectives(index, *this)) goto error;
+
+  if (end - start >= 2 && (!memcmp(start, BOM_UTF16LE, 2) || !memcmp(start, BOM_UTF16BE, 2)))
+  {
+    if (!index.entries.Push(*this, entry)) goto error;
+    return true;
+  }
+  if (end - start >= 3 && !memcmp(start, BOM_UTF8, 3))
+  {
+    pointer += 3;
+  }
+
+  while (pointer != end)
+  {
+    const unsigned char* next = yaml_next_line(pointer, end);
+
+    if (yaml_is_document_indicator(pointer, end, '-'))
+    {
+      entry = YamlDocumentEntry();
+      if (started)
+      {
+        entry.offset = (directives ? directives : pointer) - start;
+        entry.mark   = directives ? directives_mark : mark;
+      }
+      entry.tag_directive_count = index.tag_directives.top - index.tag_directives.start;
+      yaml_scan_entry_properties(entry, pointer + 3, next);
+      if (!index.entries.Push(*this, entry)) goto error;
+
+      // The directives of a later document stay in effect after it, as they do
+      // in Parse.  A document reads its own directives.
+      if (started && directives)
+      {
+        YamlFns fns;
+        fns.Malloc  = this->Malloc;
+        fns.Realloc = this->Realloc;
+        fns.Free    = this->Free;
+        fns.Strdup  = this->Strdup;
+
+        YamlParser parser(fns, directives, next - directives);
+        bool document = false;
+
+        // Directives that do not parse fail the document that reads them.
+        if (parser.ParseHeader(document) && document &&
+            !this->IndexTagDirectives(index, parser))
+        {
+          goto error;
+        }
+      }
+
+      started    = true;
+      ended      = false;
+      directives = nullptr;
+    }
+    else if (*pointer == '%' && (!started || ended))
+    {
+      if (!directives)
+      {
+        directives      = pointer;
+        directives_mark = mark;
+      }
+    }
+    else if (yaml_is_document_indicator(pointer, end, '.'))
+    {
+      ended = true;
+    }
+    else if (yaml_is_content_line(pointer, next))
+    {
+      // Anything but a comment before the first '---' is an implicit document.
+      if (!started)
+      {
+        entry = YamlDocumentEntry();
+        if (!index.entries.Push(*this, entry)) goto error;
+        started = true;
+      }
+      ended = false;
+    }
+
+    yaml_advance_mark(mark, pointer, next);
+    pointer = next;
+  }
+
+  return true;
+
+error:
+  index.Delete(*this);
+  return false;
+}
+
+/*
+ * Add the tag directives of a parser to an index, but for the handles it has
+ * already.
+ */
+bool YamlParser::IndexTagDirectives(YamlDocumentIndex& index, const YamlParser& parser)
+{
+  for (YamlTagDirective* tag_directive = parser.tag_directives.start;
+       tag_directive != parser.tag_directives.top; tag_directive++)
+  {
+    YamlTagDirective* indexed = index.tag_directives.start;
+    YamlTagDirective copy;
+
+    while (indexed != index.tag_directives.top &&
+           strcmp((char*)indexed->handle, (char*)tag_directive->handle))
+    {
+      indexed++;
+    }
+    if (indexed != index.tag_directives.top) continue;
+
+    copy.handle = (uint8_t*)this->Strdup((char*)tag_directive->handle);
+    copy.prefix = (uint8_t*)this->Strdup((char*)tag_directive->prefix);
+    if (!copy.handle || !copy.prefix || !index.tag_directives.Push(*this, copy))
+    {
+      this->Free(copy.handle);
+      this->Free(copy.prefix);
+      this->error = EYamlError::Memory;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Start at a document of an index instead of at the start of the input.
+ */
+bool YamlParser::StartAt(const YamlDocumentIndex& index, const YamlDocumentEntry& entry)
+{
+  assert(!this->stream_start_produced); /* Call StartAt before parsing. */
+  assert(!this->push);
+
+  if (this->error != EYamlError::None) return false;
+
+  // The read handler of the other parsers cannot start in mid-stream.
+  if (!this->in_place) return this->SetReaderError("input is not in memory", 0, -1);
+
+  assert(this->encoding == EYamlEncoding::Any);
+  assert(entry.offset <= (size_t)(this->input.end - this->input.start));
+
+  this->input.current = this->input.start + entry.offset;
+  this->offset        = entry.offset;
+  this->mark          = entry.mark;
+  this->line_start    = entry.mark.index - entry.mark.column;
+
+  // The first document reads the directives itself.
+  if (!entry.offset) return true;
+
+  for (YamlTagDirective* tag_directive = index.tag_directives.start;
+       tag_directive != index.tag_directives.start + entry.tag_directive_count; tag_directive++)
+  {
+    if (!this->AppendTagDirective(*tag_directive, 1, this->Mark())) return false;
+  }
+
+  return true;
+}
+
+// Line index
+
+/*
+ * Note where each line of the input starts, with the breaks the reader counts:
+ * CR, LF, "\r\n", NEL, LS and PS.
+ */
+bool YamlParser::IndexLines()
+{
+  const unsigned char* start   = this->input.start;
+  const unsigned char* pointer = this->input.start;
+  const unsigned char* end     = this->input.end;
+
+  if (!this->line_starts.Init(*this)) return false;
+
+  // The first line starts after the BOM, like the reader's marks do.
+  if (end - pointer >= 3 && !memcmp(pointer, BOM_UTF8, 3)) pointer += 3;
+  if (!this->line_starts.Push(*this, pointer - start)) goto error;
+
+  while (pointer != end)
+  {
+    pointer += yaml_line_run(pointer, end - pointer);
+    if (pointer == end) break;
+
+    size_t width = yaml_break_width(pointer, end);
+    if (!width)
+    {
+      pointer++;
+      continue;
+    }
+
+    pointer += width;
+    if (!this->line_starts.Push(*this, pointer - start)) goto error;
+  }
+
+  return true;
+
+error:
+  this->line_starts.Del(*this);
+  return false;
+}
+
+/*
+ * Fill in the line and the column of a lazy mark from its octet offset.
+ */
+bool YamlParser::ResolveMark(YamlMark& mark)
+{
+  if (!this->LazyMarks()) return true;
+
+  assert(mark.index <= (size_t)(this->input.end - this->input.start));
+
+  if (!this->line_starts.start && !this->IndexLines()) return false;
+
+  // Find the last line that starts at or before the mark.
+  size_t low  = 0;
+  size_t high = this->line_starts.top - this->line_starts.start;
+  while (high - low > 1)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (this->line_starts.start[middle] <= mark.index)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  // Columns count characters, so leave out the trailing octets of UTF-8.
+  mark.line   = low;
+  mark.column = 0;
+  for (size_t k = this->line_starts.start[low]; k < mark.index; k++)
+  {
+    if ((this->input.start[k] & 0xC0) != 0x80) mark.column++;
+  }
+
+  return true;
+}
+
+// Push input
+
+/*
+ * Append a piece of the input and look for document indicators at the start
+ * of the lines that it completes.
+ */
+bool YamlParser::Feed(const unsigned char* chunk, size_t size)
+{
+  YamlPushInput& pushed = this->pushed;
+  unsigned char* start  = (unsigned char*)this->input.start;
+  size_t used           = this->input.end - this->input.start;
+  size_t taken          = this->input.current - this->input.start;
+  size_t drop           = taken;
+  const unsigned char* line;
+
+  assert(this->push && !pushed.finished); /* Feed a parser made without input. */
+
+  if (this->error != EYamlError::None) return false;
+
+  // Drop the octets that the reader has taken, but not the line that has not
+  // been checked yet.
+  if (drop > pushed.line - pushed.offset) drop = pushed.line - pushed.offset;
+  if (drop)
+  {
+    memmove(start, start + drop, used - drop);
+    used -= drop;
+    taken -= drop;
+    pushed.offset += drop;
+  }
+
+  if (pushed.capacity - used < size)
+  {
+    size_t capacity = pushed.capacity ? pushed.capacity : INPUT_RAW_BUFFER_SIZE;
+    while (capacity - used < size) capacity *= 2;
+
+    start = (unsigned char*)this->Realloc(start, capacity);
+    if (!start)
+    {
+      this->error = EYamlError::Memory;
+      return false;
+    }
+    pushed.capacity = capacity;
+  }
+
+  if (size) memcpy(start + used, chunk, size);
+  this->input.start   = start;
+  this->input.current = start + taken;
+  this->input.end     = start + used + size;
+
+  line = start + (pushed.line - pushed.offset);
+  for (;;)
+  {
+    const unsigned char* end = (const unsigned char*)memchr(line, '\n', this->input.end - line);
+    if (!end) break;
+    end++;
+
+    // The first line starts after the BOM.
+    const unsigned char* first = line;
+    if (pushed.offset + (line - start) == 0 && end - line >= 3 && !memcmp(line, BOM_UTF8, 3))
+    {
+      first += 3;
+    }
+    if (yaml_is_document_indicator(first, end, '-') || yaml_is_document_indicator(first, end, '.'))
+    {
+      pushed.limit = pushed.offset + (first - start) + 1;
+    }
+
+    line = end;
+  }
+  pushed.line = pushed.offset + (line - start);
+
+  return true;
+}
+
+/*
+ * Let the scanner run on to the end of the input that has been fed.
+ */
+bool YamlParser::Finish()
+{
+  assert(this->push); /* Finish a parser made without input. */
+
+  this->pushed.finished = true;
+
+  return this->error == EYamlError::None;
+}